@@ -16,6 +16,7 @@ end
 -- CaModel DSL Environment
 
 local coType = co.Type
+local coNew = co.new
 
 local caModelEnv = {}
 local caModelEnvMT = { __index = caModelEnv }
@@ -36,12 +37,63 @@ function caModelEnv.Type( name )
 	return typeDecl
 end
 
+-- an update followed by a list of steps is declarative (e.g. Update "v2" { ... })
+local updateMT = { __call = function( updateDecl, steps )
+	if type( steps ) ~= 'table' or #steps == 0 then
+		error( "update '" .. updateDecl.name .. "' should have a list of migration steps", 0 )
+	end
+	updateDecl.steps = steps
+end }
+
 function caModelEnv.Update( updateScript )
 	if type( updateScript ) ~= 'string' then
 		error( "illegal script name '" .. tostring( updateScript ) .. "'", 0 )
 	end
 
-	updateList[#updateList + 1] = updateScript
+	local updateDecl = setmetatable( { name = updateScript }, updateMT )
+	updateList[#updateList + 1] = updateDecl
+	return updateDecl
+end
+
+local function checkName( value, stepName, argName )
+	if type( value ) ~= 'string' or value == "" then
+		error( "illegal " .. argName .. " '" .. tostring( value ) .. "' in " .. stepName, 0 )
+	end
+	return value
+end
+
+-- Converts a default value to the literal stored for it.
+local function toLiteral( value )
+	local t = type( value )
+	if t == 'number' then
+		return string.format( "%.17g", value )
+	elseif t == 'boolean' then
+		return tostring( value )
+	elseif t == 'string' and not value:find( "]=]", 1, true ) then
+		return "[=[" .. value .. "]=]"
+	end
+	error( "illegal default value '" .. tostring( value ) .. "' in DefaultValue", 0 )
+end
+
+function caModelEnv.RenameMember( typeName, member, newName )
+	return { kind = 'MIG_RENAME_MEMBER',
+		typeName = checkName( typeName, "RenameMember", "type name" ),
+		member = checkName( member, "RenameMember", "member name" ),
+		value = checkName( newName, "RenameMember", "member name" ) }
+end
+
+function caModelEnv.ChangeType( typeName, newTypeName )
+	return { kind = 'MIG_CHANGE_TYPE',
+		typeName = checkName( typeName, "ChangeType", "type name" ),
+		member = "",
+		value = checkName( newTypeName, "ChangeType", "type name" ) }
+end
+
+function caModelEnv.DefaultValue( typeName, member, value )
+	return { kind = 'MIG_DEFAULT_VALUE',
+		typeName = checkName( typeName, "DefaultValue", "type name" ),
+		member = checkName( member, "DefaultValue", "member name" ),
+		value = toLiteral( value ) }
 end
 
 -------------------------------------------------------------------------------
@@ -128,8 +180,17 @@ local function loadModelFile( objModel, filePath )
 	
 	chunk()
 	
-	for _, script in ipairs( updateList ) do
-		objModel:addUpdate( script )
+	for _, updateDecl in ipairs( updateList ) do
+		objModel:addUpdate( updateDecl.name )
+		for _, step in ipairs( updateDecl.steps or {} ) do
+			local migration = coNew( "ca.Migration" )
+			migration.update = updateDecl.name
+			migration.kind = step.kind
+			migration.typeName = step.typeName
+			migration.member = step.member
+			migration.value = step.value
+			objModel:addMigration( migration )
+		end
 	end
 
 	processTypes( currentEnv, objModel )
@@ -97,6 +97,12 @@ local idCache, conversionCache, valueMap
 
 local namespaces = {}
 
+-- restored tables are only tracked (see updateEnv.track) when there are updates to apply
+local function noTrack( t )
+	return t
+end
+local wrap = noTrack
+
 local coNew = co.new
 local coType = co.Type
 local coRaise = co.raise
@@ -118,6 +124,15 @@ local function refKind( fieldValue )
 	return 0
 end
 
+local function parseValue( value )
+	local chunk = load( "return " .. value )
+	local runtimeValue = chunk()
+	if value:sub( 1, 4 ) == "[=[\n" then
+		runtimeValue = '\n' .. runtimeValue
+	end
+	return runtimeValue
+end
+
 local restoreService
 
 local function restoreObject( spaceStore, objModel, objectId, revision )
@@ -128,7 +143,7 @@ local function restoreObject( spaceStore, objModel, objectId, revision )
 	local typeName = allValues[ "_type" ]
 	
 	local luaObject = { _type = typeName, _id = objectId }
-	idCache[ objectId ] = track( luaObject )
+	idCache[ objectId ] = wrap( luaObject )
 
 	local fieldNames = {}
 	local values = {}
@@ -150,7 +165,7 @@ local function restoreObject( spaceStore, objModel, objectId, revision )
 		luaObject[ fieldNames[i] ] = service
 	end
 
-	return luaObject
+	return idCache[ objectId ]
 end
 
 restoreService = function( spaceStore, objModel, objectId, serviceId, revision )
@@ -159,11 +174,9 @@ restoreService = function( spaceStore, objModel, objectId, serviceId, revision )
 	elseif idCache[serviceId] == nil then
 		local allValues = valueMap[ serviceId ]
 		local typeName = allValues[ "_type" ]
-	
-		namespaces[ extractNamespaceFullName( typeName ) ] = true
 
 		local luaObjectTable = { _type = typeName, _id = serviceId }
-		idCache[ serviceId ] = track( luaObjectTable )
+		idCache[ serviceId ] = wrap( luaObjectTable )
 
 		local fieldNames = {}
 		local values = {}
@@ -205,12 +218,7 @@ restoreService = function( spaceStore, objModel, objectId, serviceId, revision )
 				end
 				luaObjectTable[ fieldNames[i] ] = serviceList
 			else
-				local chunk = load( "return " .. value )
-				local runtimeValue = chunk()
-				if value:sub( 1, 4 ) == "[=[\n" then
-					runtimeValue = '\n' .. runtimeValue
-				end
-				luaObjectTable[ fieldNames[i] ] = runtimeValue
+				luaObjectTable[ fieldNames[i] ] = parseValue( value )
 			end
 		end
 		luaObjectTable._provider = idCache[ objectId ]
@@ -258,6 +266,28 @@ local function applyUpdate( updateScript, coralGraph )
 
 end
 
+-- Applies the declarative steps of an update (ca.Migration structs) to all restored tables.
+local function applyMigration( steps )
+	for _, step in ipairs( steps ) do
+		local kind, typeName, member, value = step.kind, step.typeName, step.member, step.value
+		for _, t in pairs( idCache ) do
+			if t._type == typeName then
+				if kind == 'MIG_CHANGE_TYPE' then
+					t._type = value
+				elseif kind == 'MIG_RENAME_MEMBER' then
+					local memberValue = t[member]
+					if memberValue ~= nil then
+						t[member] = nil
+						t[value] = memberValue
+					end
+				elseif t[member] == nil then
+					t[member] = parseValue( value )
+				end
+			end
+		end
+	end
+end
+
 local fillServiceValues
 
 local function convertToCoral( obj, objModel, spaceLoader )
@@ -396,6 +426,10 @@ end
 local function restoreFast( space, spaceStore, objModel, revision, spaceLoader )
 	idCache = {}
 	conversionCache = {}
+	namespaces = {}
+	for k in pairs( assignmentCache ) do
+		assignmentCache[k] = nil
+	end
 
 	updateEnv.model = objModel
 	spaceStore:open()
@@ -413,26 +447,54 @@ local function restoreFast( space, spaceStore, objModel, revision, spaceLoader )
 		valueMap[id][fieldNames[it]] = values[it]
 	end
 	
-	local rootId = spaceStore:getRootObject( revision )
-	
-	local obj = restoreObject( spaceStore, objModel, rootId, revision )
+	-- load the CaModels of all stored types, so that pending updates are known before restoring
+	for id, allValues in pairs( valueMap ) do
+		local ns = allValues._type and extractNamespaceFullName( allValues._type )
+		if ns then
+			namespaces[ns] = true
+		end
+	end
+	loadCaModels( objModel )
 
 	local appliedUpdates = spaceStore:getUpdates( revision )
 
-	loadCaModels( objModel )
-	local availableUpdates = objModel.updates
-
 	local hasApplied = {}
 
 	for script in appliedUpdates:gmatch( "[^;]+" ) do
 	   hasApplied[script] = true
 	end
 
-	for _, script in ipairs( availableUpdates ) do
+	local pendingUpdates = {}
+	for _, script in ipairs( objModel.updates ) do
 		if not hasApplied[script] then
+			pendingUpdates[ #pendingUpdates + 1 ] = script
+		end
+	end
+
+	-- declarative updates have migration steps instead of a script
+	local migrationSteps = {}
+	for _, migration in ipairs( objModel.migrations ) do
+		local steps = migrationSteps[migration.update]
+		if not steps then
+			steps = {}
+			migrationSteps[migration.update] = steps
+		end
+		steps[ #steps + 1 ] = migration
+	end
+
+	wrap = ( #pendingUpdates > 0 ) and track or noTrack
+
+	local rootId = spaceStore:getRootObject( revision )
+	local obj = restoreObject( spaceStore, objModel, rootId, revision )
+
+	for _, script in ipairs( pendingUpdates ) do
+		local steps = migrationSteps[script]
+		if steps then
+			applyMigration( steps )
+		else
 			applyUpdate( script, obj )
-			appliedUpdates = appliedUpdates .. script ..";"
 		end
+		appliedUpdates = appliedUpdates .. script ..";"
 	end
 
 	spaceStore:close()
@@ -18,6 +18,8 @@ local traceback = require( "debug" ).traceback
 
 co.system.modules:load( "ca" )
 
+local luaManager = co.getService( "ca.ILuaManager" )
+
 --------------------------------------------------------------------------------
 -- Smart Change Events (with memoized, simplified and lazily computed fields)
 --------------------------------------------------------------------------------
@@ -34,7 +36,9 @@ local function createEventMT( fieldCalculators )
 end
 
 local function unchanged( t, k )
-	return t._ref[k]
+	-- batch events have no '_ref' (their nil fields end up here)
+	local ref = t._ref
+	if ref then return ref[k] end
 end
 
 local function makeArraySmart( array, MT )
@@ -52,6 +56,29 @@ local function arrayToSmartMap( array, map, indexFieldName, MT )
 	return map
 end
 
+-- returns a set { value => #occurrences } for the values in an array
+local function countMap( array )
+	local set = {}
+	for i = 1, #array do
+		local v = array[i]
+		set[v] = ( set[v] or 0 ) + 1
+	end
+	return set
+end
+
+-- returns the 'added' or 'removed' array computed by Calcium for a ref-vec field (if any)
+local function nativeDelta( t, k )
+	local batched = t['_' .. k]
+	if batched then return batched end
+	local ref = t._ref
+	if ref then
+		local fieldType = t.field.type
+		if fieldType.kind == 'TK_ARRAY' and fieldType.elementType.kind == 'TK_INTERFACE' then
+			return ref[k]
+		end
+	end
+end
+
 local fieldEventMT = createEventMT{
 	field = unchanged,
 	previous = unchanged,
@@ -67,15 +94,12 @@ local fieldEventMT = createEventMT{
 		-- INTERNAL: a set { value => #occurrences } based on 'previous'
 		local previous = t.previous
 		assert( type( previous ) == 'table', "field is not an array" )
-		local set = {}
-		for i = 1, #previous do
-			local v = previous[i]
-			set[v] = ( set[v] or 0 ) + 1
-		end
-		return set
+		return countMap( previous )
 	end,
 	added = function( t )
 		-- a map { value => #added } for the values in 'current' which are not in 'previous'
+		local native = nativeDelta( t, 'added' )
+		if native then return countMap( native ) end
 		local current, countOf = t.current, t.countOf
 		local res = {}
 		for i = 1, #current do
@@ -91,6 +115,8 @@ local fieldEventMT = createEventMT{
 	end,
 	removed = function( t )
 		-- a map { value => #removed } for the values in 'previous' removed from 'current'
+		local native = nativeDelta( t, 'removed' )
+		if native then return countMap( native ) end
 		local added = t.added -- triggers required calculations
 		local res = {}
 		for v, count in pairs( t.countOf ) do
@@ -132,6 +158,32 @@ local objectEventMT = createEventMT{
 	changedFields = function( t ) return t.changedConnections end
 }
 
+--[[
+ Events delivered by ca.LuaManager are read from a flattened batch of arrays
+ (see ca.ILuaObserver), where the changed members of an event are at the
+ indices [_first, _last]. The 'memberKey' is 'receptacle' or 'field'.
+--]]
+local function batchToSmartMap( t, memberKey, MT )
+	local batch, map = t._batch, {}
+	local members, names, previous, current = batch.members, batch.names, batch.previous, batch.current
+	local added, removed = batch.added, batch.removed
+	for i = t._first, t._last do
+		map[names[i]] = setmetatable( { [memberKey] = members[i], previous = previous[i],
+			current = current[i], _added = added[i], _removed = removed[i], _sup = t }, MT )
+	end
+	return map
+end
+
+local batchServiceEventMT = createEventMT{
+	changedFields = function( t ) return batchToSmartMap( t, 'field', fieldEventMT ) end
+}
+
+local batchObjectEventMT = createEventMT{
+	changedServices = function( t, k ) return makeArraySmart( t._ref[k], serviceEventMT ) end,
+	changedConnections = function( t ) return batchToSmartMap( t, 'receptacle', connectionEventMT ) end,
+	changedFields = function( t ) return t.changedConnections end
+}
+
 local graphEventMT = createEventMT{
 	graph = unchanged,
 	addedObjects = unchanged,
@@ -148,6 +200,9 @@ local graphEventMT = createEventMT{
  or a table of closures. If it is a closure, it's called directly with a subject change event
  table. Otherwise, if it's a table of closures, only the closures whose keys correspond to
  a changed 'field name' are called (in this case, with a 'field' event table).
+
+ The subjects in this table are mirrored by ca.LuaManager, which only delivers
+ the events whose subjects (or their types) are observed.
 --]]
 local observers = {}
 
@@ -175,33 +230,43 @@ local function dispatchToMap( event, observerMap )
 	end
 end
 
-local function dispatch( event, subject, defaultHandler )
-	local instanceObservers = observers[subject]
-	if instanceObservers then
-		dispatchToMap( event, instanceObservers )
-	end
-	local typeObservers = observers[coTypeOf( subject )]
+--[[
+ This table maps { type name => { observer maps } }, listing the observers of a concrete
+ type and of its observed super-types. Each entry is resolved on the first event of its
+ type (so it covers types loaded after an observer was registered) and the whole table
+ is reset whenever a type starts or stops being observed.
+--]]
+local typeFanOut = {}
+
+local function resolveFanOut( typeName )
+	local maps = {}
+	local typeObservers = observers[typeName]
 	if typeObservers then
-		dispatchToMap( event, typeObservers )
+		maps[#maps + 1] = typeObservers
 	end
-	if defaultHandler then
-		defaultHandler( event )
+	local coralType = coType[typeName]
+	if coralType.kind == 'TK_INTERFACE' then
+		local superTypes = coralType.superTypes
+		for i = 1, #superTypes do
+			local superObservers = observers[superTypes[i].fullName]
+			if superObservers then
+				maps[#maps + 1] = superObservers
+			end
+		end
 	end
+	typeFanOut[typeName] = maps
+	return maps
 end
 
-local function dispatchChangedServices( objectEvent )
-	local changedServices = objectEvent.changedServices
-	for i = 1, #changedServices do
-		local serviceEvent = changedServices[i]
-		dispatch( serviceEvent, serviceEvent.service )
+local function dispatch( event, subject )
+	local instanceObservers = observers[subject]
+	if instanceObservers then
+		dispatchToMap( event, instanceObservers )
 	end
-end
-
-local function dispatchChangedObjects( graphEvent )
-	local changedObjects = graphEvent.changedObjects
-	for i = 1, #changedObjects do
-		local objectEvent = changedObjects[i]
-		dispatch( objectEvent, objectEvent.object, dispatchChangedServices )
+	local typeName = coTypeOf( subject )
+	local typeObservers = typeFanOut[typeName] or resolveFanOut( typeName )
+	for i = 1, #typeObservers do
+		dispatchToMap( event, typeObservers[i] )
 	end
 end
 
@@ -212,6 +277,26 @@ end
 -- maps observer tables to their subjects
 local observerTables = {}
 
+-- maps observer tables to their observed members { 'member name' => co.IMember }
+local observerMembers = {}
+
+-- informs ca.LuaManager about an observer of a 'member' of a subject (or of all its changes, if nil)
+local function observeSubject( subject, member )
+	if type( subject ) == 'string' then
+		luaManager:observeType( coType[subject], member )
+	else
+		luaManager:observeService( subject, member )
+	end
+end
+
+local function unobserveSubject( subject, member )
+	if type( subject ) == 'string' then
+		luaManager:unobserveType( coType[subject], member )
+	else
+		luaManager:unobserveService( subject, member )
+	end
+end
+
 local fieldObserversMT = {
 	__newindex = function( t, key, value )
 		if type( key ) ~= 'string' then error( "observer tables can only have strings as keys", 2 ) end
@@ -219,9 +304,15 @@ local fieldObserversMT = {
 		local subject = observerTables[t]
 		if not subject then error( "cannot modify an unregistered observer table", 2 ) end
 		local typeName = ( type( subject ) == 'string' and subject or coTypeOf( subject ) )
-		if not coType[typeName]:getMember( key ) then
+		local member = coType[typeName]:getMember( key )
+		if not member then
 			error( "cannot observe non-existing member '" .. key .. "' in subject of type " .. typeName, 2 )
 		end
+		local members = observerMembers[t]
+		if not members[key] then
+			observeSubject( subject, member )
+			members[key] = member
+		end
 		rawset( t, key, value )
 	end
 }
@@ -231,11 +322,20 @@ local function registerObserver( subject, observer, observerType )
 	if not subjectObservers then
 		subjectObservers = {}
 		observers[subject] = subjectObservers
+		if type( subject ) == 'string' then
+			typeFanOut = {}
+		end
 	end
 	assert( subjectObservers[observer] == nil, "registering the same observer twice?" )
 	observerType = observerType or type( observer )
 	assert( observerType == 'function' or observerType == 'table', "unsupported observer type" )
 	subjectObservers[observer] = observerType
+	-- table observers only subscribe to the members they observe (see fieldObserversMT)
+	if observerType == 'function' then
+		observeSubject( subject, nil )
+	else
+		observerMembers[observer] = {}
+	end
 end
 
 local function unregisterObserver( subject, observer )
@@ -244,58 +344,72 @@ local function unregisterObserver( subject, observer )
 		coLog( 'WARNING', "ca.stopObserving(): subject '" .. tostring( subject ) .. "' is not being observed" )
 		return false
 	end
-	if not subjectObservers[observer] then
+	local observerType = subjectObservers[observer]
+	if not observerType then
 		coLog( 'WARNING', "ca.stopObserving(): no such observer '"  .. tostring( observer ) ..
 			"' for subject '" .. tostring( subject ) .. "'" )
+	elseif observerType == 'function' then
+		unobserveSubject( subject, nil )
+	else
+		for _, member in pairs( observerMembers[observer] ) do
+			unobserveSubject( subject, member )
+		end
+		observerMembers[observer] = nil
 	end
 	subjectObservers[observer] = nil
 	-- if this was the last observer for the subject, remove the table
 	if not next( subjectObservers ) then
 		observers[subject] = nil
+		if type( subject ) == 'string' then
+			typeFanOut = {}
+		end
 	end
 	return true
 end
 
-local function registerInterfaceObserver( itfType, observer, observerType )
-	registerObserver( itfType.fullName, observer, observerType )
-	-- also register the observer for all known subtypes of the interface
-	local subTypes = itfType.subTypes
-	for i = 1, #subTypes do
-		registerInterfaceObserver( subTypes[i], observer, observerType )
-	end
-end
-
-local function unregisterInterfaceObserver( itfType, observer )
-	local res = unregisterObserver( itfType.fullName, observer )
-	-- also unregister the observer for all known subtypes of the interface
-	local subTypes = itfType.subTypes
-	for i = 1, #subTypes do
-		local succeeded = unregisterInterfaceObserver( subTypes[i], observer )
-		res = res and succeeded
-	end
-	return res
-end
-
 --------------------------------------------------------------------------------
 -- Universal Graph Observer Component
 --------------------------------------------------------------------------------
 
 local UniversalObserver = co.Component {
 	name = "ca.UniversalObserver",
-	provides = { graphObserver = "ca.IGraphObserver" }
+	provides = { luaObserver = "ca.ILuaObserver" }
 }
 
-function UniversalObserver:onGraphChanged( changes )
-	local graphEvent = setmetatable( { _ref = changes }, graphEventMT )
-	dispatch( graphEvent, graphEvent.graph, dispatchChangedObjects )
+-- only called with the events whose subjects are observed (see ca.LuaManager)
+function UniversalObserver:onChanges( changes, graphObserved, objects, subjects, ends,
+		members, names, previous, current, added, removed )
+	if graphObserved then
+		local graphEvent = setmetatable( { _ref = changes }, graphEventMT )
+		dispatch( graphEvent, graphEvent.graph )
+	end
+	local batch = { members = members, names = names, previous = previous, current = current,
+		added = added, removed = removed }
+	local numObjects = #objects
+	local first = 1
+	for i = 1, #subjects do
+		local subject, last = subjects[i], ends[i]
+		local event
+		if i <= numObjects then
+			event = setmetatable( { object = subject, _ref = objects[i],
+				_batch = batch, _first = first, _last = last }, batchObjectEventMT )
+		else
+			event = setmetatable( { service = subject,
+				_batch = batch, _first = first, _last = last }, batchServiceEventMT )
+		end
+		dispatch( event, subject )
+		first = last + 1
+	end
 end
 
 function UniversalObserver:__gc()
 	observers = nil
 	observerTables = nil
+	observerMembers = nil
+	typeFanOut = nil
 end
 
-co.getService( "ca.ILuaManager" ).observer = UniversalObserver().graphObserver
+luaManager.observer = UniversalObserver().luaObserver
 
 --------------------------------------------------------------------------------
 -- Module Functions
@@ -358,11 +472,8 @@ function M.observe( subject, observer )
 		end
 		registerObserver( subject, observer, observerType )
 	elseif subjectType == 'string' then
-		local coralType = coType[subject]
-		local kind = coralType.kind
-		if kind == 'TK_INTERFACE' then
-			registerInterfaceObserver( coralType, observer, observerType )
-		elseif kind == 'TK_COMPONENT' then
+		local kind = coType[subject].kind
+		if kind == 'TK_INTERFACE' or kind == 'TK_COMPONENT' then
 			registerObserver( subject, observer, observerType )
 		else
 			error( "illegal subject type (" .. subject .. " is neither an interface nor a component)", 2 )
@@ -385,16 +496,8 @@ function M.stopObserving( subject, observer )
 		observerTables[observer] = nil
 	end
 	if type( subject ) == 'string' then
-		local coralType = coType[subject]
-		if coralType.kind == 'TK_INTERFACE' then
-			local res = unregisterInterfaceObserver( coralType, observer )
-			if not res then
-				coLog( 'ERROR', "ca.stopObserving(): not all subtypes of " .. subject
-					.. " had been registered for observer '" .. tostring( observer )
-					.. "'; it may have missed notifications" )
-			end
-			return res
-		end
+		-- raises an error if the type does not exist
+		local _ = coType[subject]
 	end
 	return unregisterObserver( subject, observer )
 end
@@ -4,6 +4,8 @@
  */
 
 #include "GraphChanges.h"
+#include "Universe.h"
+#include <co/IPort.h>
 #include <algorithm>
 
 namespace ca {
@@ -56,6 +58,207 @@ IGraphChanges* GraphChanges::finalize( ca::IGraph* graph )
 	return new GraphChanges( graph, *this );
 }
 
+inline bool isNoOp( const ChangedRefField& change )
+{
+	return change.previous == change.current;
+}
+
+inline bool isNoOp( const ChangedRefVecField& change )
+{
+	return change.previous == change.current;
+}
+
+inline bool isNoOp( const ChangedValueField& change )
+{
+	return change.previous.getAny().equals( change.current.getAny() );
+}
+
+inline bool isNoOp( const ChangedConnection& change )
+{
+	return change.previous == change.current;
+}
+
+// Ports are sorted by name, which is also the order in which changes are reported.
+inline int portCompare( co::IPort* a, co::IPort* b )
+{
+	return a->getName().compare( b->getName() );
+}
+
+/*
+	Merges lists of field changes, keeping the first 'previous' and the last 'current' values.
+	Fields that end up with their original value are dropped.
+ */
+template<typename T>
+void mergeFieldChanges( co::TSlice<T> older, co::TSlice<T> newer, std::vector<T>& result )
+{
+	size_t first = result.size();
+	for( ; older; older.popFirst() )
+		result.push_back( older.getFirst() );
+
+	size_t last = result.size();
+	for( ; newer; newer.popFirst() )
+	{
+		const T& change = newer.getFirst();
+		size_t i = first;
+		while( i < last && result[i].field != change.field )
+			++i;
+
+		if( i < last )
+			result[i].current = change.current;
+		else
+			result.push_back( change );
+	}
+
+	size_t numKept = first;
+	for( size_t i = first; i < result.size(); ++i )
+		if( !isNoOp( result[i] ) )
+			result[numKept++] = result[i];
+	result.resize( numKept );
+}
+
+// Returns NULL if the merged changes cancel each other out.
+static ServiceChanges* mergeServiceChanges( IServiceChanges* older, IServiceChanges* newer )
+{
+	std::vector<ChangedRefField> refFields;
+	mergeFieldChanges( older->getChangedRefFields(), newer->getChangedRefFields(), refFields );
+
+	std::vector<ChangedRefVecField> refVecFields;
+	mergeFieldChanges( older->getChangedRefVecFields(), newer->getChangedRefVecFields(), refVecFields );
+
+	std::vector<ChangedValueField> valueFields;
+	mergeFieldChanges( older->getChangedValueFields(), newer->getChangedValueFields(), valueFields );
+
+	if( refFields.empty() && refVecFields.empty() && valueFields.empty() )
+		return NULL;
+
+	ServiceChanges* sc = new ServiceChanges( older->getService() );
+
+	for( size_t i = 0; i < refFields.size(); ++i )
+		sc->addChangedRefField() = refFields[i];
+
+	for( size_t i = 0; i < refVecFields.size(); ++i )
+	{
+		ChangedRefVecField& cf = sc->addChangedRefVecField();
+		cf = refVecFields[i];
+		ServiceChanges::computeDelta( cf );
+	}
+
+	for( size_t i = 0; i < valueFields.size(); ++i )
+		sc->addChangedValueField() = valueFields[i];
+
+	return sc;
+}
+
+// Returns NULL if the merged changes cancel each other out.
+static ObjectChanges* mergeObjectChanges( IObjectChanges* older, IObjectChanges* newer )
+{
+	// connections are sorted by receptacle
+	std::vector<ChangedConnection> connections;
+	co::TSlice<ChangedConnection> a = older->getChangedConnections();
+	co::TSlice<ChangedConnection> b = newer->getChangedConnections();
+	while( a || b )
+	{
+		int cmp = ( !a ? 1 : ( !b ? -1 : portCompare( a.getFirst().receptacle.get(), b.getFirst().receptacle.get() ) ) );
+		if( cmp < 0 )
+		{
+			connections.push_back( a.getFirst() );
+			a.popFirst();
+		}
+		else if( cmp > 0 )
+		{
+			connections.push_back( b.getFirst() );
+			b.popFirst();
+		}
+		else
+		{
+			ChangedConnection merged = a.getFirst();
+			merged.current = b.getFirst().current;
+			if( !isNoOp( merged ) )
+				connections.push_back( merged );
+			a.popFirst();
+			b.popFirst();
+		}
+	}
+
+	// services are sorted by facet
+	std::vector<IServiceChangesRef> services;
+	co::TSlice<IServiceChanges*> c = older->getChangedServices();
+	co::TSlice<IServiceChanges*> d = newer->getChangedServices();
+	while( c || d )
+	{
+		int cmp = ( !c ? 1 : ( !d ? -1 : portCompare( c.getFirst()->getService()->getFacet(),
+					d.getFirst()->getService()->getFacet() ) ) );
+		if( cmp < 0 )
+		{
+			services.push_back( c.getFirst() );
+			c.popFirst();
+		}
+		else if( cmp > 0 )
+		{
+			services.push_back( d.getFirst() );
+			d.popFirst();
+		}
+		else
+		{
+			IServiceChanges* merged = mergeServiceChanges( c.getFirst(), d.getFirst() );
+			if( merged )
+				services.push_back( merged );
+			c.popFirst();
+			d.popFirst();
+		}
+	}
+
+	if( connections.empty() && services.empty() )
+		return NULL;
+
+	ObjectChanges* oc = new ObjectChanges( older->getObject() );
+
+	for( size_t i = 0; i < connections.size(); ++i )
+		oc->addChangedConnection() = connections[i];
+
+	for( size_t i = 0; i < services.size(); ++i )
+		oc->addChangedService( static_cast<ServiceChanges*>( services[i].get() ) );
+
+	return oc;
+}
+
+IGraphChanges* GraphChanges::merge( IGraphChanges* older, IGraphChanges* newer )
+{
+	assert( older->getGraph() == newer->getGraph() );
+	assert( older->getAddedObjects().isEmpty() && older->getRemovedObjects().isEmpty() );
+	assert( newer->getAddedObjects().isEmpty() && newer->getRemovedObjects().isEmpty() );
+
+	GraphChanges merged;
+
+	// both lists are sorted by object, and unchanged entries are shared
+	co::TSlice<IObjectChanges*> a = older->getChangedObjects();
+	co::TSlice<IObjectChanges*> b = newer->getChangedObjects();
+	while( a || b )
+	{
+		int cmp = ( !a ? 1 : ( !b ? -1 : objectCompare( a.getFirst()->getObject(), b.getFirst()->getObject() ) ) );
+		if( cmp < 0 )
+		{
+			merged.addChangedObject( static_cast<ObjectChanges*>( a.getFirst() ) );
+			a.popFirst();
+		}
+		else if( cmp > 0 )
+		{
+			merged.addChangedObject( static_cast<ObjectChanges*>( b.getFirst() ) );
+			b.popFirst();
+		}
+		else
+		{
+			ObjectChanges* oc = mergeObjectChanges( a.getFirst(), b.getFirst() );
+			if( oc )
+				merged.addChangedObject( oc );
+			a.popFirst();
+			b.popFirst();
+		}
+	}
+
+	return merged.finalize( older->getGraph() );
+}
+
 ca::IGraph* GraphChanges::getGraph()
 {
 	return _graph.get();
@@ -97,12 +300,9 @@ co::int32 GraphChanges::findChangedObject( co::IObject* object )
 		object, changesKeyCompare, pos ) ? static_cast<co::int32>( pos ) : -1;
 }
 
-void revertFieldChanges( IGraph* graph, IServiceChanges* changes )
+void GraphChanges::revertFields( IServiceChanges* changes )
 {
-	co::IService* service = changes->getService();
-	graph->addChange( service );
-
-	co::Any instance( service );
+	co::Any instance( changes->getService() );
 
 	// revert all Ref fields
 	co::TSlice<ChangedRefField> refFields = changes->getChangedRefFields();
@@ -136,6 +336,10 @@ void revertFieldChanges( IGraph* graph, IServiceChanges* changes )
 
 void GraphChanges::revertChanges()
 {
+	// graphs of a ca.Universe are reverted in bulk
+	if( Universe::revertChanges( _graph.get(), this, false ) )
+		return;
+
 	// for each changed object
 	for( co::Slice<IObjectChanges*> objects( _changedObjects ); objects; objects.popFirst() )
 	{
@@ -155,7 +359,10 @@ void GraphChanges::revertChanges()
 		// revert field changes for each changed service
 		co::TSlice<IServiceChanges*> services = objects.getFirst()->getChangedServices();
 		for( ; services; services.popFirst() )
-			revertFieldChanges( _graph.get(), services.getFirst() );
+		{
+			_graph->addChange( services.getFirst()->getService() );
+			revertFields( services.getFirst() );
+		}
 	}
 }
 
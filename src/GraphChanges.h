@@ -31,6 +31,16 @@ public:
 		_removedObjects.push_back( object->instance );
 	}
 
+	void addAddedObject( co::IObject* object )
+	{
+		_addedObjects.push_back( object );
+	}
+
+	void addRemovedObject( co::IObject* object )
+	{
+		_removedObjects.push_back( object );
+	}
+
 	void addChangedObject( ObjectChanges* objectChanges )
 	{
 		_changedObjects.push_back( objectChanges );
@@ -42,6 +52,18 @@ public:
 	 */
 	IGraphChanges* finalize( ca::IGraph* graph );
 
+	/*
+		Merges two consecutive changesets of the same graph into a new changeset,
+		keeping the \a older 'previous' and the \a newer 'current' value of each
+		field and connection. Changes that cancel each other out are dropped, so the
+		result may have no changed objects. Changesets with added or removed objects
+		cannot be merged.
+	 */
+	static IGraphChanges* merge( IGraphChanges* older, IGraphChanges* newer );
+
+	// Restores the 'previous' value of each field in a service's \a changes.
+	static void revertFields( IServiceChanges* changes );
+
 	// ------ ca.IGraphChanges Methods ------ //
 
 	ca::IGraph* getGraph();
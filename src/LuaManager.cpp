@@ -6,11 +6,129 @@
 #include "Model.h"
 #include "Universe.h"
 #include "LuaManager_Base.h"
+#include <ca/IGraph.h>
+#include <ca/ILuaObserver.h>
+#include <ca/IGraphChanges.h>
+#include <ca/IObjectChanges.h>
+#include <ca/IServiceChanges.h>
 #include <ca/IGraphObserver.h>
 #include <co/IllegalStateException.h>
+#include <co/IllegalArgumentException.h>
+#include <co/IMember.h>
+#include <co/IField.h>
+#include <co/IPort.h>
+#include <map>
 
 namespace ca {
 
+// Bit of a member in an EventFilter's mask (members with the same bit may yield false positives).
+inline co::uint64 maskOf( co::IMember* member )
+{
+	return co::uint64( 1 ) << ( member->getIndex() % 64 );
+}
+
+// Mask of the fields changed in a service.
+static co::uint64 changedMask( ca::IServiceChanges* changes )
+{
+	co::uint64 mask = 0;
+	for( co::TSlice<ChangedRefField> f = changes->getChangedRefFields(); f; f.popFirst() )
+		mask |= maskOf( f.getFirst().field.get() );
+	for( co::TSlice<ChangedRefVecField> f = changes->getChangedRefVecFields(); f; f.popFirst() )
+		mask |= maskOf( f.getFirst().field.get() );
+	for( co::TSlice<ChangedValueField> f = changes->getChangedValueFields(); f; f.popFirst() )
+		mask |= maskOf( f.getFirst().field.get() );
+	return mask;
+}
+
+// Mask of the receptacles changed in an object.
+static co::uint64 changedMask( ca::IObjectChanges* changes )
+{
+	co::uint64 mask = 0;
+	for( co::TSlice<ChangedConnection> c = changes->getChangedConnections(); c; c.popFirst() )
+		mask |= maskOf( c.getFirst().receptacle.get() );
+	return mask;
+}
+
+// Selects the change events of a subject based on its changed members.
+struct EventFilter
+{
+	bool all;			// whether all events are selected
+	co::uint64 mask;	// members of interest (see maskOf())
+
+	EventFilter() : all( false ), mask( 0 )
+	{;}
+
+	inline void merge( const EventFilter& other )
+	{
+		all = all || other.all;
+		mask |= other.mask;
+	}
+
+	inline bool matches( co::uint64 changed ) const
+	{
+		return all || ( mask & changed ) != 0;
+	}
+
+	inline bool selectsAny() const
+	{
+		return all || mask != 0;
+	}
+};
+
+// Lua observers of a subject (either a service instance or a type).
+struct Subscription
+{
+	typedef std::map<co::IMember*, co::uint32> MemberCountMap;
+
+	co::uint32 numObservers;	// observers of all changes to the subject
+	MemberCountMap members;		// observed members, with their numbers of observers
+	EventFilter filter;
+
+	Subscription() : numObservers( 0 )
+	{;}
+
+	inline bool isEmpty() const { return numObservers == 0 && members.empty(); }
+
+	// Accounts for an observer of a \a member (or of all changes, if \a member is null).
+	void add( co::IMember* member )
+	{
+		if( !member )
+			++numObservers;
+		else
+			++members[member];
+		updateFilter();
+	}
+
+	// Accounts for the removal of an observer. Raises an exception if it was not added.
+	void remove( co::IMember* member )
+	{
+		if( !member )
+		{
+			if( numObservers == 0 )
+				throw co::IllegalArgumentException( "subject is not being observed" );
+			--numObservers;
+		}
+		else
+		{
+			MemberCountMap::iterator it = members.find( member );
+			if( it == members.end() )
+				throw co::IllegalArgumentException( "member is not being observed" );
+			if( --it->second == 0 )
+				members.erase( it );
+		}
+		updateFilter();
+	}
+
+private:
+	void updateFilter()
+	{
+		filter.all = ( numObservers > 0 );
+		filter.mask = 0;
+		for( MemberCountMap::iterator it = members.begin(); it != members.end(); ++it )
+			filter.mask |= maskOf( it->first );
+	}
+};
+
 class LuaManager : public LuaManager_Base, public MultiverseObserver
 {
 public:
@@ -25,7 +143,7 @@ public:
 		{
 			size_t numUniverses = _universes.size();
 			for( size_t i = 0; i < numUniverses; ++i )
-				_universes[i]->removeGraphObserver( _universalObserver.get() );
+				_universes[i]->removeGraphObserver( this );
 		}
 
 		Universe::setMultiverseObserver( NULL );
@@ -36,25 +154,25 @@ public:
 	void onUniverseCreated( Universe* universe )
 	{
 		if( _universalObserver.isValid() )
-			universe->addGraphObserver( _universalObserver.get() );
+			universe->addGraphObserver( this );
 		_universes.push_back( universe );
 	}
 
 	void onUniverseDestroyed( Universe* universe )
 	{
 		if( _universalObserver.isValid() )
-			universe->removeGraphObserver( _universalObserver.get() );
+			universe->removeGraphObserver( this );
 		_universes.erase( std::remove( _universes.begin(), _universes.end(), universe ), _universes.end() );
 	}
 
 	// ------ ca.ILuaManager Methods ------ //
 
-	ca::IGraphObserver* getObserver()
+	ca::ILuaObserver* getObserver()
 	{
 		return _universalObserver.get();
 	}
 
-	void setObserver( ca::IGraphObserver* observer )
+	void setObserver( ca::ILuaObserver* observer )
 	{
 		if( _universalObserver.isValid() )
 			throw co::IllegalStateException( "the observer can only be set once" );
@@ -63,7 +181,92 @@ public:
 
 		size_t numUniverses = _universes.size();
 		for( size_t i = 0; i < numUniverses; ++i )
-			_universes[i]->addGraphObserver( observer );
+			_universes[i]->addGraphObserver( this );
+	}
+
+	void observeService( co::IService* service, co::IMember* member )
+	{
+		if( !service )
+			throw co::IllegalArgumentException( "illegal null service" );
+		_observedServices[service].add( member );
+	}
+
+	void unobserveService( co::IService* service, co::IMember* member )
+	{
+		release( _observedServices, service, member );
+	}
+
+	void observeType( co::IType* type, co::IMember* member )
+	{
+		if( !type )
+			throw co::IllegalArgumentException( "illegal null type" );
+		_observedTypes[type].add( member );
+		_typeIndex.clear();
+	}
+
+	void unobserveType( co::IType* type, co::IMember* member )
+	{
+		release( _observedTypes, type, member );
+		_typeIndex.clear();
+	}
+
+	// ------ ca.IGraphObserver Methods ------ //
+
+	void onGraphChanged( ca::IGraphChanges* changes )
+	{
+		if( !_universalObserver.isValid() || ( _observedServices.empty() && _observedTypes.empty() ) )
+			return;
+
+		// the graph may be observed as an instance or through its interface (e.g. "ca.IUniverse")
+		ca::IGraph* graph = changes->getGraph();
+		bool graphObserved = getFilter( graph, graph->getInterface() ).selectsAny();
+
+		_objects.clear();
+		_services.clear();
+		_subjects.clear();
+		_ends.clear();
+		_members.clear();
+		_names.clear();
+		_previous.clear();
+		_current.clear();
+		_added.clear();
+		_removed.clear();
+
+		// events are only selected if an observer cares about one of their changed members
+		co::TSlice<ca::IObjectChanges*> objects = changes->getChangedObjects();
+		for( ; objects; objects.popFirst() )
+		{
+			ca::IObjectChanges* objectChanges = objects.getFirst();
+			co::IObject* object = objectChanges->getObject();
+			if( getFilter( object, object->getComponent() ).matches( changedMask( objectChanges ) ) )
+			{
+				_objects.push_back( objectChanges );
+				_subjects.push_back( object );
+				addConnections( objectChanges->getChangedConnections() );
+			}
+
+			co::TSlice<ca::IServiceChanges*> services = objectChanges->getChangedServices();
+			for( ; services; services.popFirst() )
+			{
+				co::IService* service = services.getFirst()->getService();
+				if( getFilter( service, service->getInterface() ).matches( changedMask( services.getFirst() ) ) )
+					_services.push_back( services.getFirst() );
+			}
+		}
+
+		for( size_t i = 0; i < _services.size(); ++i )
+		{
+			_subjects.push_back( _services[i]->getService() );
+			addFields( _services[i]->getChangedRefFields() );
+			addFields( _services[i]->getChangedRefVecFields() );
+			addFields( _services[i]->getChangedValueFields() );
+			_ends.push_back( static_cast<co::uint32>( _members.size() ) );
+		}
+
+		// Lua is only entered if there are events to deliver
+		if( graphObserved || !_subjects.empty() )
+			_universalObserver->onChanges( changes, graphObserved, _objects, _subjects,
+				_ends, _members, _names, _previous, _current, _added, _removed );
 	}
 
 	// ------ lua.IInterceptor Methods ------ //
@@ -104,6 +307,119 @@ public:
 	}
 
 private:
+	// Appends the changed receptacles of an object to the batch.
+	void addConnections( co::TSlice<ChangedConnection> connections )
+	{
+		for( ; connections; connections.popFirst() )
+		{
+			const ChangedConnection& cc = connections.getFirst();
+			addMember( cc.receptacle.get(), cc.previous.get(), cc.current.get() );
+		}
+		_ends.push_back( static_cast<co::uint32>( _members.size() ) );
+	}
+
+	// Appends changed fields of a service to the batch.
+	void addFields( co::TSlice<ChangedRefField> fields )
+	{
+		for( ; fields; fields.popFirst() )
+		{
+			const ChangedRefField& cf = fields.getFirst();
+			addMember( cf.field.get(), cf.previous.get(), cf.current.get() );
+		}
+	}
+
+	void addFields( co::TSlice<ChangedRefVecField> fields )
+	{
+		for( ; fields; fields.popFirst() )
+		{
+			// arrays are passed with their real element type
+			const ChangedRefVecField& cf = fields.getFirst();
+			co::IType* type = cf.field->getType();
+			addMember( cf.field.get(), toArray( type, cf.previous ), toArray( type, cf.current ) );
+			_added.back() = toArray( type, cf.added );
+			_removed.back() = toArray( type, cf.removed );
+		}
+	}
+
+	void addFields( co::TSlice<ChangedValueField> fields )
+	{
+		for( ; fields; fields.popFirst() )
+		{
+			const ChangedValueField& cf = fields.getFirst();
+			addMember( cf.field.get(), cf.previous.getAny(), cf.current.getAny() );
+		}
+	}
+
+	inline void addMember( co::IMember* member, const co::Any& previous, const co::Any& current )
+	{
+		_members.push_back( member );
+		_names.push_back( member->getName() );
+		_previous.push_back( previous );
+		_current.push_back( current );
+		_added.push_back( co::Any() );
+		_removed.push_back( co::Any() );
+	}
+
+	inline static co::Any toArray( co::IType* type, const std::vector<co::IServiceRef>& services )
+	{
+		return co::Any( true, type, services.empty() ? nullptr : &services[0], services.size() );
+	}
+
+	template<typename Map>
+	void release( Map& map, typename Map::key_type key, co::IMember* member )
+	{
+		typename Map::iterator it = map.find( key );
+		if( it == map.end() )
+			throw co::IllegalArgumentException( "subject is not being observed" );
+		it->second.remove( member );
+		if( it->second.isEmpty() )
+			map.erase( it );
+	}
+
+	// Combined filter for the events of a \a service, given its concrete \a type.
+	inline EventFilter getFilter( co::IService* service, co::IType* type )
+	{
+		EventFilter filter;
+		if( !_observedTypes.empty() )
+			filter = getTypeFilter( type );
+
+		ServiceSubscriptions::iterator it = _observedServices.find( service );
+		if( it != _observedServices.end() )
+			filter.merge( it->second.filter );
+
+		return filter;
+	}
+
+	/*
+		Filter for all instances of a component or interface, combining the observers
+		of the type and of its super-types. Resolved once per type (so types loaded after
+		an observer was registered are also covered) and cached in the _typeIndex.
+	 */
+	const EventFilter& getTypeFilter( co::IType* type )
+	{
+		TypeIndex::iterator it = _typeIndex.find( type );
+		if( it != _typeIndex.end() )
+			return it->second;
+
+		EventFilter filter;
+		TypeSubscriptions::iterator sub = _observedTypes.find( type );
+		if( sub != _observedTypes.end() )
+			filter.merge( sub->second.filter );
+
+		if( type->getKind() == co::TK_INTERFACE )
+		{
+			co::TSlice<co::IInterface*> superTypes = static_cast<co::IInterface*>( type )->getSuperTypes();
+			for( ; superTypes; superTypes.popFirst() )
+			{
+				sub = _observedTypes.find( superTypes.getFirst() );
+				if( sub != _observedTypes.end() )
+					filter.merge( sub->second.filter );
+			}
+		}
+
+		return _typeIndex.insert( TypeIndex::value_type( type, filter ) ).first->second;
+	}
+
 	void tryAddChange( co::IService* service )
 	{
 		co::IObject* object = service->getProvider();
@@ -117,8 +433,30 @@ private:
 	}
 
 private:
-	ca::IGraphObserverRef _universalObserver;
+	ca::ILuaObserverRef _universalObserver;
 	std::vector<Universe*> _universes;
+
+	// subjects observed from Lua
+	typedef std::map<co::IService*, Subscription> ServiceSubscriptions;
+	typedef std::map<co::IType*, Subscription> TypeSubscriptions;
+	ServiceSubscriptions _observedServices;
+	TypeSubscriptions _observedTypes;
+
+	// event filter of each component or interface (cleared when _observedTypes changes)
+	typedef std::map<co::IType*, EventFilter> TypeIndex;
+	TypeIndex _typeIndex;
+
+	// events to deliver, and their flattened batch (reused across notifications)
+	std::vector<ca::IObjectChanges*> _objects;
+	std::vector<ca::IServiceChanges*> _services;
+	std::vector<co::IService*> _subjects;
+	std::vector<co::uint32> _ends;
+	std::vector<co::IMember*> _members;
+	std::vector<std::string> _names;
+	std::vector<co::Any> _previous;
+	std::vector<co::Any> _current;
+	std::vector<co::Any> _added;
+	std::vector<co::Any> _removed;
 };
 
 CORAL_EXPORT_COMPONENT( LuaManager, LuaManager );
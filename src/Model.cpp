@@ -355,11 +355,26 @@ void Model::setName( const std::string& name )
 	_name = name;
 }
 
+std::string Model::getCacheDir()
+{
+	return _cacheDir;
+}
+
+void Model::setCacheDir( const std::string& cacheDir )
+{
+	_cacheDir = cacheDir;
+}
+
 co::TSlice<std::string> Model::getUpdates()
 {
 	return _updates;
 }
 
+co::TSlice<ca::Migration> Model::getMigrations()
+{
+	return _migrations;
+}
+
 bool Model::alreadyContains( co::IType* type )
 {
 	assert( type );
@@ -442,13 +457,14 @@ void Model::discardChanges()
 			_transaction[i]->destroy();
 
 		_transaction.clear();
+		_transactionIndex.clear();
 	}
 }
 
 void Model::addEnum( co::IEnum* enumType )
 {
 	checkCanAddType( enumType );
-	_transaction.push_back( TypeRecord::create( enumType ) );
+	addToTransaction( TypeRecord::create( enumType ) );
 }
 
 void Model::addRecordType( co::IRecordType* recordType, co::Slice<co::IField*> fields )
@@ -517,7 +533,7 @@ void Model::addRecordType( co::IRecordType* recordType, co::Slice<co::IField*> f
 		throw;
 	}
 
-	_transaction.push_back( rec );
+	addToTransaction( rec );
 }
 
 void Model::addComponent( co::IComponent* component, co::Slice<co::IPort*> ports )
@@ -547,7 +563,7 @@ void Model::addComponent( co::IComponent* component, co::Slice<co::IPort*> ports
 		throw;
 	}
 
-	_transaction.push_back( rec );
+	addToTransaction( rec );
 }
 
 void Model::addUpdate( const std::string& update )
@@ -555,12 +571,55 @@ void Model::addUpdate( const std::string& update )
 	_updates.push_back( update );
 }
 
+void Model::addMigration( const ca::Migration& migration )
+{
+	if( std::find( _updates.begin(), _updates.end(), migration.update ) == _updates.end() )
+		CORAL_THROW( co::IllegalArgumentException, "no such update '" << migration.update << "'" );
+
+	_migrations.push_back( migration );
+}
+
 bool Model::loadDefinitionsFor( const std::string& moduleName )
 {
 	co::INamespace* ns = co::getSystem()->getTypes()->getNamespace( moduleName );
 	return ns == NULL ? false : loadDefinitionsFor( ns );
 }
 
+void Model::preloadDefinitions( co::Slice<std::string> namespaces )
+{
+	co::ITypeManager* types = co::getSystem()->getTypes();
+
+	// on failure, the discarded namespaces may be loaded again later
+	std::set<co::INamespace*> visitedNamespaces( _visitedNamespaces );
+	size_t numUpdates = _updates.size();
+	size_t numMigrations = _migrations.size();
+
+	// nested transactions are only validated by the outermost applyChanges()
+	beginChanges();
+
+	try
+	{
+		for( ; namespaces; namespaces.popFirst() )
+		{
+			co::INamespace* ns = types->getNamespace( namespaces.getFirst() );
+			if( !ns )
+				CORAL_THROW( co::IllegalArgumentException, "no such namespace '" << namespaces.getFirst() << "'" );
+			loadDefinitionsFor( ns );
+		}
+		applyChanges();
+	}
+	catch( ... )
+	{
+		discardChanges();
+		_visitedNamespaces.swap( visitedNamespaces );
+
+		// so are the updates they declared, which must not be listed twice
+		_updates.erase( _updates.begin() + numUpdates, _updates.end() );
+		_migrations.erase( _migrations.begin() + numMigrations, _migrations.end() );
+		throw;
+	}
+}
+
 TypeRecord* Model::getType( co::IType* type )
 {
 	TypeRecord* res = findType( _types, type );
@@ -607,12 +666,41 @@ bool Model::loadDefinitionsFor( co::INamespace* ns )
 	if( !co::findFile( ns->getFullName(), fileName, filePath ) )
 		return false;
 
+	// try to skip the CaModel DSL using precompiled definitions
+	std::string cacheFile;
+	co::uint64 key = 0;
+	ModelCache::Definitions defs;
+	if( !_cacheDir.empty() )
+	{
+		cacheFile = _cacheDir + "/CaModel_" + _name + "." + ns->getFullName() + ".cache";
+		try
+		{
+			key = ModelCache::computeKey( filePath );
+		}
+		catch( co::Exception& )
+		{
+			cacheFile.clear();
+		}
+
+		if( !cacheFile.empty() && ModelCache::read( cacheFile, key, defs ) )
+		{
+			applyDefinitions( filePath, defs );
+			return true;
+		}
+	}
+
+	size_t firstType = _transaction.size();
+	size_t firstUpdate = _updates.size();
+	size_t firstMigration = _migrations.size();
+
 	beginChanges();
 
 	try
 	{
 		co::Any args[] = { static_cast<ca::IModel*>( this ), filePath };
 		co::getService<lua::IState>()->call( "ca.ModelLoader", std::string(), args, co::Slice<co::Any>() );
+		if( !cacheFile.empty() )
+			getDefinitions( firstType, firstUpdate, firstMigration, defs );
 		applyChanges();
 	}
 	catch( co::Exception& e )
@@ -622,9 +710,104 @@ bool Model::loadDefinitionsFor( co::INamespace* ns )
 			<< "': " << e.getMessage() );
 	}
 
+	// failing to write the cache is harmless (the CaModel file is simply loaded again)
+	if( !cacheFile.empty() )
+		ModelCache::write( cacheFile, key, defs );
+
 	return true;
 }
 
+void Model::applyDefinitions( const std::string& filePath, const ModelCache::Definitions& defs )
+{
+	// updates are declared before types, as in CaModel files
+	for( size_t i = 0; i < defs.updates.size(); ++i )
+		addUpdate( defs.updates[i] );
+	_migrations.insert( _migrations.end(), defs.migrations.begin(), defs.migrations.end() );
+
+	beginChanges();
+
+	try
+	{
+		for( size_t i = 0; i < defs.types.size(); ++i )
+		{
+			const ModelCache::TypeDef& def = defs.types[i];
+			size_t numMembers = def.members.size();
+			switch( def.type->getKind() )
+			{
+			case co::TK_ENUM:
+				addEnum( static_cast<co::IEnum*>( def.type ) );
+				break;
+			case co::TK_COMPONENT:
+				{
+					std::vector<co::IPort*> ports( numMembers );
+					for( size_t k = 0; k < numMembers; ++k )
+						ports[k] = static_cast<co::IPort*>( def.members[k] );
+					addComponent( static_cast<co::IComponent*>( def.type ), ports );
+				}
+				break;
+			default:
+				{
+					std::vector<co::IField*> fields( numMembers );
+					for( size_t k = 0; k < numMembers; ++k )
+						fields[k] = static_cast<co::IField*>( def.members[k] );
+					addRecordType( static_cast<co::IRecordType*>( def.type ), fields );
+				}
+			}
+		}
+		applyChanges();
+	}
+	catch( co::Exception& e )
+	{
+		discardChanges();
+		CORAL_THROW( ca::ModelException, "error in CaModel file '" << filePath
+			<< "': " << e.getMessage() );
+	}
+}
+
+void Model::getDefinitions( size_t firstType, size_t firstUpdate, size_t firstMigration,
+								ModelCache::Definitions& defs )
+{
+	defs.updates.assign( _updates.begin() + firstUpdate, _updates.end() );
+	defs.migrations.assign( _migrations.begin() + firstMigration, _migrations.end() );
+
+	size_t numTypes = _transaction.size();
+	defs.types.resize( numTypes - firstType );
+	for( size_t i = firstType; i < numTypes; ++i )
+	{
+		TypeRecord* typeRec = _transaction[i];
+		ModelCache::TypeDef& def = defs.types[i - firstType];
+		def.type = typeRec->type;
+		def.members.clear();
+		switch( typeRec->kind )
+		{
+		case TRK_ENUM: break;
+		case TRK_RECORD:
+			{
+				RecordRecord* rec = static_cast<RecordRecord*>( typeRec );
+				for( co::uint16 k = 0; k < rec->numFields; ++k )
+					def.members.push_back( rec->fields[k] );
+			}
+			break;
+		case TRK_INTERFACE:
+			{
+				InterfaceRecord* rec = static_cast<InterfaceRecord*>( typeRec );
+				for( co::uint16 k = 0; k < rec->numFields; ++k )
+					def.members.push_back( rec->fields[k].field );
+			}
+			break;
+		case TRK_COMPONENT:
+			{
+				ComponentRecord* rec = static_cast<ComponentRecord*>( typeRec );
+				for( co::uint8 k = 0; k < rec->numPorts; ++k )
+					def.members.push_back( rec->ports[k].port );
+			}
+			break;
+		default:
+			assert( false );
+		}
+	}
+}
+
 bool Model::loadDefinitionsFor( co::IType* type )
 {
 	assert( type );
@@ -781,6 +964,7 @@ void Model::commitTransaction()
 	}
 
 	_transaction.clear();
+	_transactionIndex.clear();
 
 	std::inplace_merge( _types.begin(), _types.begin() + numTypes, _types.end(), TypeRecordComparator() );
 
@@ -6,6 +6,7 @@
 #ifndef _CA_MODEL_H_
 #define _CA_MODEL_H_
 
+#include "ModelCache.h"
 #include "Model_Base.h"
 #include <co/IEnum.h>
 #include <co/IPort.h>
@@ -454,8 +455,11 @@ public:
 	// ca.IModel methods:
 	std::string getName();
 	void setName( const std::string& name );
+	std::string getCacheDir();
+	void setCacheDir( const std::string& cacheDir );
 	
 	co::TSlice<std::string> getUpdates();
+	co::TSlice<ca::Migration> getMigrations();
 
 	bool alreadyContains( co::IType* type );
 	bool contains( co::IType* type );
@@ -468,8 +472,10 @@ public:
 	void addRecordType( co::IRecordType* recordType, co::Slice<co::IField*> fields );
 	void addComponent( co::IComponent* component, co::Slice<co::IPort*> ports );
 	void addUpdate( const std::string& update );
+	void addMigration( const ca::Migration& migration );
 
 	bool loadDefinitionsFor( const std::string& ns );
+	void preloadDefinitions( co::Slice<std::string> namespaces );
 
 protected:
 	TypeRecord* getType( co::IType* type );
@@ -478,15 +484,25 @@ protected:
 	bool loadDefinitionsFor( co::INamespace* ns );
 	bool loadDefinitionsFor( co::IType* type );
 
+	// Adds the types of a CaModel file in a transaction (may raise a ModelException).
+	void applyDefinitions( const std::string& filePath, const ModelCache::Definitions& defs );
+
+	// Gets the definitions added by a CaModel file to the current transaction.
+	void getDefinitions( size_t firstType, size_t firstUpdate, size_t firstMigration,
+							ModelCache::Definitions& defs );
+
 	void checkCanAddType( co::IType* type );
 
 	TypeRecord* findTransactionType( co::IType* type )
 	{
-		size_t numTransactionTypes = _transaction.size();
-		for( size_t i = 0; i < numTransactionTypes; ++i )
-			if( type == _transaction[i]->type )
-				return _transaction[i];
-		return NULL;
+		TypeIndex::iterator it = _transactionIndex.find( type );
+		return it == _transactionIndex.end() ? NULL : it->second;
+	}
+
+	inline void addToTransaction( TypeRecord* rec )
+	{
+		_transactionIndex.insert( TypeIndex::value_type( rec->type, rec ) );
+		_transaction.push_back( rec );
 	}
 
 	void validateTransaction();
@@ -500,7 +516,9 @@ private:
 private:
 	// --- permanent fields --- //
 	std::string _name;
+	std::string _cacheDir;
 	std::vector<std::string> _updates;
+	std::vector<ca::Migration> _migrations;
 
 	// sorted list of types in the object model
 	TypeList _types;
@@ -513,6 +531,10 @@ private:
 	int _level;
 	bool _discarded;
 	TypeList _transaction;
+
+	// index of the types in the transaction (avoids linear searches when validating it)
+	typedef std::map<co::IType*, TypeRecord*> TypeIndex;
+	TypeIndex _transactionIndex;
 };
 
 } // namespace ca
@@ -0,0 +1,199 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#include "ModelCache.h"
+#include "persistence/ArchiveIO.h"
+
+#include <co/Coral.h>
+#include <co/IPort.h>
+#include <co/IField.h>
+#include <co/Exception.h>
+#include <co/ICompositeType.h>
+#include <cstdio>
+
+namespace ca {
+
+static const co::uint64 CACHE_MAGIC = 0x434D4143; // "CAMC"
+static const co::uint32 CACHE_VERSION = 2;
+
+// Returns the type of a field or port, or NULL for other kinds of members.
+static co::IType* getMemberType( co::IMember* member )
+{
+	switch( member->getKind() )
+	{
+	case co::MK_FIELD: return static_cast<co::IField*>( member )->getType();
+	case co::MK_PORT: return static_cast<co::IPort*>( member )->getType();
+	default: return NULL;
+	}
+}
+
+static bool isComposite( co::IType* type )
+{
+	co::TypeKind kind = type->getKind();
+	return kind == co::TK_STRUCT || kind == co::TK_NATIVECLASS ||
+		kind == co::TK_INTERFACE || kind == co::TK_COMPONENT;
+}
+
+co::uint64 ModelCache::computeKey( const std::string& filePath )
+{
+	MappedFile file( filePath );
+
+	// 64-bit FNV-1a hash of the file's contents
+	co::uint64 hash = 14695981039346656037ULL;
+	const co::uint8* data = file.getData();
+	size_t size = file.getSize();
+	for( size_t i = 0; i < size; ++i )
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash ^ static_cast<co::uint64>( size );
+}
+
+// Decodes a cache file, returning false if it does not match the current types.
+static bool readDefinitions( ByteReader& in, co::uint64 key, ModelCache::Definitions& defs )
+{
+	if( in.readFixed( 4 ) != CACHE_MAGIC || in.readVarint() != CACHE_VERSION || in.readFixed( 8 ) != key )
+		return false;
+
+	size_t numUpdates = in.readVarint();
+	defs.updates.resize( numUpdates );
+	for( size_t i = 0; i < numUpdates; ++i )
+		in.readString( defs.updates[i] );
+
+	size_t numMigrations = in.readVarint();
+	defs.migrations.resize( numMigrations );
+	for( size_t i = 0; i < numMigrations; ++i )
+	{
+		ca::Migration& m = defs.migrations[i];
+		in.readString( m.update );
+		co::uint8 kind = in.readByte();
+		if( kind > ca::MIG_DEFAULT_VALUE )
+			return false;
+		m.kind = static_cast<ca::MigrationKind>( kind );
+		in.readString( m.typeName );
+		in.readString( m.member );
+		in.readString( m.value );
+	}
+
+	std::string name;
+	std::string typeName;
+	size_t numTypes = in.readVarint();
+	defs.types.resize( numTypes );
+	for( size_t i = 0; i < numTypes; ++i )
+	{
+		ModelCache::TypeDef& def = defs.types[i];
+
+		in.readString( name );
+		def.type = co::getType( name );
+		if( def.type->getKind() != static_cast<co::TypeKind>( in.readByte() ) )
+			return false;
+
+		size_t numMembers = in.readVarint();
+		if( numMembers && !isComposite( def.type ) )
+			return false;
+
+		def.members.resize( numMembers );
+		for( size_t k = 0; k < numMembers; ++k )
+		{
+			in.readString( name );
+			in.readString( typeName );
+
+			co::IMember* member = static_cast<co::ICompositeType*>( def.type )->getMember( name );
+			co::IType* memberType = ( member ? getMemberType( member ) : NULL );
+			if( !memberType || memberType->getFullName() != typeName )
+				return false;
+
+			def.members[k] = member;
+		}
+	}
+
+	return in.getRemaining() == 0;
+}
+
+bool ModelCache::read( const std::string& cacheFile, co::uint64 key, Definitions& defs )
+{
+	bool valid = false;
+	try
+	{
+		MappedFile file( cacheFile );
+		ByteReader in( file.getData(), file.getSize() );
+		valid = readDefinitions( in, key, defs );
+	}
+	catch( co::Exception& )
+	{
+		// missing or corrupted cache files, or types that no longer exist
+	}
+
+	if( !valid )
+	{
+		defs.updates.clear();
+		defs.migrations.clear();
+		defs.types.clear();
+	}
+
+	return valid;
+}
+
+bool ModelCache::write( const std::string& cacheFile, co::uint64 key, const Definitions& defs )
+{
+	std::string out;
+	putFixed( out, CACHE_MAGIC, 4 );
+	putVarint( out, CACHE_VERSION );
+	putFixed( out, key, 8 );
+
+	putVarint( out, static_cast<co::uint32>( defs.updates.size() ) );
+	for( size_t i = 0; i < defs.updates.size(); ++i )
+		putString( out, defs.updates[i] );
+
+	putVarint( out, static_cast<co::uint32>( defs.migrations.size() ) );
+	for( size_t i = 0; i < defs.migrations.size(); ++i )
+	{
+		const ca::Migration& m = defs.migrations[i];
+		putString( out, m.update );
+		out.push_back( static_cast<char>( m.kind ) );
+		putString( out, m.typeName );
+		putString( out, m.member );
+		putString( out, m.value );
+	}
+
+	putVarint( out, static_cast<co::uint32>( defs.types.size() ) );
+	for( size_t i = 0; i < defs.types.size(); ++i )
+	{
+		const TypeDef& def = defs.types[i];
+		putString( out, def.type->getFullName() );
+		out.push_back( static_cast<char>( def.type->getKind() ) );
+
+		putVarint( out, static_cast<co::uint32>( def.members.size() ) );
+		for( size_t k = 0; k < def.members.size(); ++k )
+		{
+			co::IMember* member = def.members[k];
+			putString( out, member->getName() );
+			putString( out, getMemberType( member )->getFullName() );
+		}
+	}
+
+	// write to a temporary file first, so a partially written cache is never read
+	std::string tempFile( cacheFile + ".tmp" );
+	FILE* file = fopen( tempFile.c_str(), "wb" );
+	if( !file )
+		return false;
+
+	bool ok = ( fwrite( out.data(), 1, out.size(), file ) == out.size() );
+	ok = ( fclose( file ) == 0 ) && ok;
+	if( ok )
+	{
+		remove( cacheFile.c_str() );
+		ok = ( rename( tempFile.c_str(), cacheFile.c_str() ) == 0 );
+	}
+
+	if( !ok )
+		remove( tempFile.c_str() );
+
+	return ok;
+}
+
+} // namespace ca
@@ -0,0 +1,58 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#ifndef _CA_MODELCACHE_H_
+#define _CA_MODELCACHE_H_
+
+#include <co/IType.h>
+#include <co/IMember.h>
+#include <ca/Migration.h>
+#include <string>
+#include <vector>
+
+namespace ca {
+
+/*
+	Precompiled definitions of a CaModel file, used by the ca.Model to skip
+	running the CaModel DSL. A cache file is keyed by a hash of the CaModel
+	file's contents, and stores the types added by the file along with the
+	names and types of their members, and the updates (with their migration
+	steps) declared by the file. When read back, every type and member
+	is resolved and checked again, so a cache becomes stale whenever either
+	the CaModel file or one of its types changes.
+ */
+class ModelCache
+{
+public:
+	// A type definition, as passed to IModel::addRecordType() or addComponent().
+	struct TypeDef
+	{
+		co::IType* type;
+		std::vector<co::IMember*> members;
+	};
+
+	struct Definitions
+	{
+		std::vector<std::string> updates;
+		std::vector<ca::Migration> migrations;
+		std::vector<TypeDef> types;
+	};
+
+	// Computes the key of a CaModel file. Raises a ca::IOException on failure.
+	static co::uint64 computeKey( const std::string& filePath );
+
+	/*
+		Reads the \a defs from a cache file. Returns false if the file does not
+		exist, is corrupted, has a different \a key or no longer matches its types.
+	 */
+	static bool read( const std::string& cacheFile, co::uint64 key, Definitions& defs );
+
+	// Writes the \a defs to a cache file. Returns false if the file could not be written.
+	static bool write( const std::string& cacheFile, co::uint64 key, const Definitions& defs );
+};
+
+} // namespace ca
+
+#endif // _CA_MODELCACHE_H_
@@ -5,6 +5,7 @@
 
 #include "ServiceChanges.h"
 #include <algorithm>
+#include <iterator>
 
 namespace ca {
 
@@ -18,6 +19,33 @@ ServiceChanges::~ServiceChanges()
 	// empty
 }
 
+// Copies a list of services into a sorted list of pointers.
+static void sortedServices( const std::vector<co::IServiceRef>& services, std::vector<co::IService*>& res )
+{
+	size_t size = services.size();
+	res.resize( size );
+	for( size_t i = 0; i < size; ++i )
+		res[i] = services[i].get();
+	std::sort( res.begin(), res.end() );
+}
+
+void ServiceChanges::computeDelta( ChangedRefVecField& change )
+{
+	// multiset differences of the sorted lists (a service may appear more than once)
+	std::vector<co::IService*> previous, current, delta;
+	sortedServices( change.previous, previous );
+	sortedServices( change.current, current );
+
+	std::set_difference( current.begin(), current.end(),
+		previous.begin(), previous.end(), std::back_inserter( delta ) );
+	change.added.assign( delta.begin(), delta.end() );
+
+	delta.clear();
+	std::set_difference( previous.begin(), previous.end(),
+		current.begin(), current.end(), std::back_inserter( delta ) );
+	change.removed.assign( delta.begin(), delta.end() );
+}
+
 // ------ ca.IServiceChanges Methods ------ //
 
 co::IService* ServiceChanges::getService()
@@ -45,6 +45,9 @@ public:
 		return _changedValueFields.back();
 	}
 
+	// Fills the 'added' and 'removed' lists of a ref-vec change from its 'previous' and 'current' values.
+	static void computeDelta( ChangedRefVecField& change );
+
 	// ------ ca.IServiceChanges Methods ------ //
 
 	co::IService* getService();
@@ -0,0 +1,509 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#include "UndoLog.h"
+#include "GraphChanges.h"
+#include "persistence/ArchiveIO.h"
+#include "persistence/BlockCodec.h"
+
+#include <co/Coral.h>
+#include <co/IPort.h>
+#include <co/IField.h>
+#include <co/IMember.h>
+#include <co/IService.h>
+#include <co/IComponent.h>
+#include <co/Exception.h>
+#include <co/ICompositeType.h>
+#include <ca/IOException.h>
+#include <ca/FormatException.h>
+
+#include <algorithm>
+#include <map>
+
+namespace ca {
+
+/*
+	Encodes changesets into records. Objects are referenced by their index in
+	the entry's object list; members by their owner type and name; values are
+	encoded by the StringSerializer, preceded by their type name.
+ */
+class RecordWriter
+{
+public:
+	RecordWriter( StringSerializer& serializer, std::string& out, std::vector<co::IObjectRef>& objects )
+		: _serializer( serializer ), _out( out ), _objects( objects )
+	{;}
+
+	void writeChanges( ca::IGraphChanges* changes )
+	{
+		co::TSlice<co::IObject*> added = changes->getAddedObjects();
+		putVarint( _out, static_cast<co::uint32>( added.getSize() ) );
+		for( ; added; added.popFirst() )
+			writeObject( added.getFirst() );
+
+		co::TSlice<co::IObject*> removed = changes->getRemovedObjects();
+		putVarint( _out, static_cast<co::uint32>( removed.getSize() ) );
+		for( ; removed; removed.popFirst() )
+			writeObject( removed.getFirst() );
+
+		co::TSlice<ca::IObjectChanges*> objects = changes->getChangedObjects();
+		putVarint( _out, static_cast<co::uint32>( objects.getSize() ) );
+		for( ; objects; objects.popFirst() )
+			writeObjectChanges( objects.getFirst() );
+	}
+
+private:
+	void writeObjectChanges( ca::IObjectChanges* changes )
+	{
+		writeObject( changes->getObject() );
+
+		co::TSlice<ChangedConnection> connections = changes->getChangedConnections();
+		putVarint( _out, static_cast<co::uint32>( connections.getSize() ) );
+		for( ; connections; connections.popFirst() )
+		{
+			const ChangedConnection& c = connections.getFirst();
+			writeMember( c.receptacle.get() );
+			writeService( c.previous.get() );
+			writeService( c.current.get() );
+		}
+
+		co::TSlice<ca::IServiceChanges*> services = changes->getChangedServices();
+		putVarint( _out, static_cast<co::uint32>( services.getSize() ) );
+		for( ; services; services.popFirst() )
+			writeServiceChanges( services.getFirst() );
+	}
+
+	void writeServiceChanges( ca::IServiceChanges* changes )
+	{
+		writeMember( changes->getService()->getFacet() );
+
+		co::TSlice<ChangedRefField> refFields = changes->getChangedRefFields();
+		putVarint( _out, static_cast<co::uint32>( refFields.getSize() ) );
+		for( ; refFields; refFields.popFirst() )
+		{
+			const ChangedRefField& f = refFields.getFirst();
+			writeMember( f.field.get() );
+			writeService( f.previous.get() );
+			writeService( f.current.get() );
+		}
+
+		co::TSlice<ChangedRefVecField> refVecFields = changes->getChangedRefVecFields();
+		putVarint( _out, static_cast<co::uint32>( refVecFields.getSize() ) );
+		for( ; refVecFields; refVecFields.popFirst() )
+		{
+			const ChangedRefVecField& f = refVecFields.getFirst();
+			writeMember( f.field.get() );
+			writeServices( f.previous );
+			writeServices( f.current );
+		}
+
+		co::TSlice<ChangedValueField> valueFields = changes->getChangedValueFields();
+		putVarint( _out, static_cast<co::uint32>( valueFields.getSize() ) );
+		for( ; valueFields; valueFields.popFirst() )
+		{
+			const ChangedValueField& f = valueFields.getFirst();
+			writeMember( f.field.get() );
+			writeValue( f.previous.getAny() );
+			writeValue( f.current.getAny() );
+		}
+	}
+
+	void writeObject( co::IObject* object )
+	{
+		std::pair<ObjectMap::iterator, bool> res = _objectMap.insert(
+			ObjectMap::value_type( object, static_cast<co::uint32>( _objects.size() ) ) );
+		if( res.second )
+			_objects.push_back( object );
+		putVarint( _out, res.first->second );
+	}
+
+	void writeMember( co::IMember* member )
+	{
+		putString( _out, member->getOwner()->getFullName() );
+		putString( _out, member->getName() );
+	}
+
+	// null services are encoded as a zero
+	void writeService( co::IService* service )
+	{
+		if( !service )
+		{
+			putVarint( _out, 0 );
+			return;
+		}
+
+		putVarint( _out, 1 );
+		writeObject( service->getProvider() );
+		putString( _out, service->getFacet()->getName() );
+	}
+
+	void writeServices( const std::vector<co::IServiceRef>& services )
+	{
+		putVarint( _out, static_cast<co::uint32>( services.size() ) );
+		for( size_t i = 0; i < services.size(); ++i )
+			writeService( services[i].get() );
+	}
+
+	void writeValue( const co::Any& value )
+	{
+		co::IType* type = value.getType();
+		if( !type )
+		{
+			putString( _out, std::string() );
+			return;
+		}
+
+		putString( _out, type->getFullName() );
+		_serializer.toString( value, _str );
+		putString( _out, _str );
+	}
+
+private:
+	typedef std::map<co::IObject*, co::uint32> ObjectMap;
+
+	StringSerializer& _serializer;
+	std::string& _out;
+	std::vector<co::IObjectRef>& _objects;
+	ObjectMap _objectMap;
+	std::string _str;
+};
+
+/*
+	Decodes records produced by a RecordWriter.
+ */
+class RecordReader
+{
+public:
+	RecordReader( StringSerializer& serializer, ByteReader& in, const std::vector<co::IObjectRef>& objects )
+		: _serializer( serializer ), _in( in ), _objects( objects )
+	{;}
+
+	void readChanges( GraphChanges& changes )
+	{
+		size_t count = readCount();
+		for( size_t i = 0; i < count; ++i )
+			changes.addAddedObject( readObject() );
+
+		count = readCount();
+		for( size_t i = 0; i < count; ++i )
+			changes.addRemovedObject( readObject() );
+
+		count = readCount();
+		for( size_t i = 0; i < count; ++i )
+		{
+			ObjectChanges* objectChanges = new ObjectChanges( readObject() );
+			changes.addChangedObject( objectChanges );
+			readObjectChanges( objectChanges );
+		}
+	}
+
+private:
+	void readObjectChanges( ObjectChanges* changes )
+	{
+		size_t count = readCount();
+		for( size_t i = 0; i < count; ++i )
+		{
+			ChangedConnection& c = changes->addChangedConnection();
+			c.receptacle = static_cast<co::IPort*>( readMember( co::MK_PORT ) );
+			c.previous = readService();
+			c.current = readService();
+		}
+
+		count = readCount();
+		for( size_t i = 0; i < count; ++i )
+		{
+			co::IPort* facet = static_cast<co::IPort*>( readMember( co::MK_PORT ) );
+			ServiceChanges* serviceChanges = new ServiceChanges( changes->getObjectInl()->getServiceAt( facet ) );
+			changes->addChangedService( serviceChanges );
+			readServiceChanges( serviceChanges );
+		}
+	}
+
+	void readServiceChanges( ServiceChanges* changes )
+	{
+		size_t count = readCount();
+		for( size_t i = 0; i < count; ++i )
+		{
+			ChangedRefField& f = changes->addChangedRefField();
+			f.field = static_cast<co::IField*>( readMember( co::MK_FIELD ) );
+			f.previous = readService();
+			f.current = readService();
+		}
+
+		count = readCount();
+		for( size_t i = 0; i < count; ++i )
+		{
+			ChangedRefVecField& f = changes->addChangedRefVecField();
+			f.field = static_cast<co::IField*>( readMember( co::MK_FIELD ) );
+			readServices( f.previous );
+			readServices( f.current );
+			ServiceChanges::computeDelta( f );
+		}
+
+		count = readCount();
+		for( size_t i = 0; i < count; ++i )
+		{
+			ChangedValueField& f = changes->addChangedValueField();
+			f.field = static_cast<co::IField*>( readMember( co::MK_FIELD ) );
+			readValue( f.previous );
+			readValue( f.current );
+		}
+	}
+
+	inline size_t readCount()
+	{
+		size_t count = _in.readVarint();
+		if( count > _in.getRemaining() )
+			throw ca::FormatException( "invalid element count in undo log" );
+		return count;
+	}
+
+	co::IObject* readObject()
+	{
+		co::uint32 index = _in.readVarint();
+		if( index >= _objects.size() )
+			throw ca::FormatException( "invalid object index in undo log" );
+		return _objects[index].get();
+	}
+
+	co::IType* readType( const std::string& name )
+	{
+		try
+		{
+			return co::getType( name );
+		}
+		catch( co::Exception& e )
+		{
+			CORAL_THROW( ca::FormatException, "unknown type '" << name << "' in undo log: " << e.getMessage() );
+		}
+	}
+
+	co::IMember* readMember( co::MemberKind kind )
+	{
+		_in.readString( _str );
+		co::IType* type = readType( _str );
+
+		co::TypeKind typeKind = type->getKind();
+		if( typeKind != co::TK_COMPONENT && typeKind != co::TK_INTERFACE
+			&& typeKind != co::TK_STRUCT && typeKind != co::TK_NATIVECLASS )
+			CORAL_THROW( ca::FormatException, "unexpected type '" << _str << "' in undo log" );
+
+		_in.readString( _str );
+		co::IMember* member = static_cast<co::ICompositeType*>( type )->getMember( _str );
+		if( !member || member->getKind() != kind )
+			CORAL_THROW( ca::FormatException, "no member '" << _str << "' in type '"
+				<< type->getFullName() << "'" );
+
+		return member;
+	}
+
+	co::IService* readService()
+	{
+		if( !_in.readVarint() )
+			return NULL;
+
+		co::IObject* object = readObject();
+		_in.readString( _str );
+		co::IMember* facet = object->getComponent()->getMember( _str );
+		if( !facet || facet->getKind() != co::MK_PORT )
+			CORAL_THROW( ca::FormatException, "no facet '" << _str << "' in component '"
+				<< object->getComponent()->getFullName() << "'" );
+
+		return object->getServiceAt( static_cast<co::IPort*>( facet ) );
+	}
+
+	void readServices( std::vector<co::IServiceRef>& services )
+	{
+		size_t count = readCount();
+		services.resize( count );
+		for( size_t i = 0; i < count; ++i )
+			services[i] = readService();
+	}
+
+	void readValue( co::AnyValue& value )
+	{
+		_in.readString( _str );
+		if( _str.empty() )
+			return;
+
+		co::IType* type = readType( _str );
+		_in.readString( _str );
+		_serializer.fromString( _str, type, value );
+	}
+
+private:
+	StringSerializer& _serializer;
+	ByteReader& _in;
+	const std::vector<co::IObjectRef>& _objects;
+	std::string _str;
+};
+
+// the log is only compacted past this size, so that small logs are not rewritten often
+static const long MIN_COMPACTION_SIZE = 16 * 1024;
+
+UndoLog::UndoLog() : _file( NULL ), _size( 0 ), _liveSize( 0 )
+{
+	// empty
+}
+
+UndoLog::~UndoLog()
+{
+	close();
+}
+
+void UndoLog::open( const std::string& fileName )
+{
+	close();
+
+	_fileName = fileName;
+	reopen();
+}
+
+void UndoLog::close()
+{
+	if( !_file )
+		return;
+
+	fclose( _file );
+	_file = NULL;
+	_size = 0;
+	_liveSize = 0;
+
+	remove( _fileName.c_str() );
+	_fileName.clear();
+}
+
+void UndoLog::clear()
+{
+	if( _file && _size > 0 )
+	{
+		fclose( _file );
+		_file = NULL;
+		reopen();
+	}
+}
+
+void UndoLog::discard( const Entry& entry )
+{
+	assert( _liveSize >= static_cast<long>( entry.storedSize ) );
+	_liveSize -= entry.storedSize;
+}
+
+bool UndoLog::needsCompaction() const
+{
+	return _file && _size > MIN_COMPACTION_SIZE && _liveSize < _size / 2;
+}
+
+inline bool compareOffsets( const UndoLog::Entry* a, const UndoLog::Entry* b )
+{
+	return a->offset < b->offset;
+}
+
+void UndoLog::compact( std::vector<Entry*>& entries )
+{
+	assert( _file );
+
+	/*
+		Records are moved in order of their offsets, so a record is never written over
+		one that was not moved yet. Each entry is updated once its record is moved.
+	 */
+	std::sort( entries.begin(), entries.end(), compareOffsets );
+
+	long end = 0;
+	for( size_t i = 0; i < entries.size(); ++i )
+	{
+		Entry& entry = *entries[i];
+		if( entry.offset != end )
+		{
+			_stored.resize( entry.storedSize );
+			if( fseek( _file, entry.offset, SEEK_SET ) != 0 ||
+				( entry.storedSize && fread( &_stored[0], 1, entry.storedSize, _file ) != entry.storedSize ) ||
+				fseek( _file, end, SEEK_SET ) != 0 ||
+				fwrite( _stored.data(), 1, _stored.size(), _file ) != _stored.size() )
+				CORAL_THROW( ca::IOException, "error compacting the undo log '" << _fileName << "'" );
+
+			entry.offset = end;
+		}
+		end += entry.storedSize;
+	}
+
+	_size = end;
+	_liveSize = end;
+}
+
+void UndoLog::reopen()
+{
+	assert( !_file );
+
+	_file = fopen( _fileName.c_str(), "w+b" );
+	if( !_file )
+	{
+		std::string fileName;
+		fileName.swap( _fileName );
+		CORAL_THROW( ca::IOException, "could not open file '" << fileName << "' for writing" );
+	}
+
+	_size = 0;
+	_liveSize = 0;
+}
+
+void UndoLog::write( ca::IGraphChanges* changes, Entry& entry )
+{
+	assert( _file );
+
+	_serializer.setModel( changes->getGraph()->getModel() );
+
+	entry.objects.clear();
+	_record.clear();
+	RecordWriter writer( _serializer, _record, entry.objects );
+	writer.writeChanges( changes );
+
+	// records are stored uncompressed when compression does not pay off
+	_stored.clear();
+	BlockCodec::compress( reinterpret_cast<const co::uint8*>( _record.data() ), _record.size(), _stored );
+	const std::string& data = ( _stored.size() < _record.size() ? _stored : _record );
+
+	if( fseek( _file, _size, SEEK_SET ) != 0 || fwrite( data.data(), 1, data.size(), _file ) != data.size() )
+		CORAL_THROW( ca::IOException, "error writing to the undo log '" << _fileName << "'" );
+
+	entry.offset = _size;
+	entry.storedSize = static_cast<co::uint32>( data.size() );
+	entry.rawSize = static_cast<co::uint32>( _record.size() );
+	_size += static_cast<long>( data.size() );
+	_liveSize += static_cast<long>( data.size() );
+}
+
+ca::IGraphChanges* UndoLog::read( ca::IGraph* graph, const Entry& entry )
+{
+	assert( _file );
+
+	_stored.resize( entry.storedSize );
+	if( fseek( _file, entry.offset, SEEK_SET ) != 0 ||
+		( entry.storedSize && fread( &_stored[0], 1, entry.storedSize, _file ) != entry.storedSize ) )
+		CORAL_THROW( ca::IOException, "error reading the undo log '" << _fileName << "'" );
+
+	if( entry.storedSize < entry.rawSize )
+	{
+		_record.resize( entry.rawSize );
+		if( !BlockCodec::decompress( reinterpret_cast<const co::uint8*>( _stored.data() ), _stored.size(),
+				reinterpret_cast<co::uint8*>( &_record[0] ), _record.size() ) )
+			throw ca::FormatException( "corrupted record in undo log" );
+	}
+	else
+	{
+		_record.swap( _stored );
+	}
+
+	_serializer.setModel( graph->getModel() );
+
+	ByteReader in( reinterpret_cast<const co::uint8*>( _record.data() ), _record.size() );
+	RecordReader reader( _serializer, in, entry.objects );
+
+	GraphChanges changes;
+	reader.readChanges( changes );
+	return changes.finalize( graph );
+}
+
+} // namespace ca
@@ -0,0 +1,98 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#ifndef _CA_UNDOLOG_H_
+#define _CA_UNDOLOG_H_
+
+#include "persistence/StringSerializer.h"
+#include <co/IObject.h>
+#include <ca/IGraph.h>
+#include <ca/IGraphChanges.h>
+#include <cstdio>
+
+namespace ca {
+
+/*
+	A disk-backed log of changesets, used by the UndoManager to spill older
+	changesets out of memory. Each changeset is encoded as a compressed record
+	appended to the log file. Values are encoded with the StringSerializer,
+	while objects are kept alive by their entry and referenced by index.
+
+	Records of discarded entries are reclaimed by compact(), which moves the live
+	records to the start of the file, so new records reuse the freed space.
+ */
+class UndoLog
+{
+public:
+	// Location of a changeset in the log, and the objects it references.
+	struct Entry
+	{
+		long offset;
+		co::uint32 storedSize;	// size of the record in the file
+		co::uint32 rawSize;		// size of the uncompressed record
+		std::vector<co::IObjectRef> objects;
+	};
+
+	UndoLog();
+	~UndoLog();
+
+	inline bool isOpen() const { return _file != NULL; }
+	inline const std::string& getFileName() const { return _fileName; }
+
+	/*
+		Creates (or truncates) the log file.
+		\throw ca::IOException if the file cannot be created.
+	 */
+	void open( const std::string& fileName );
+
+	// Closes and removes the log file.
+	void close();
+
+	// Discards all records in the log.
+	void clear();
+
+	// Marks the record of an \a entry as dead (e.g. its changeset was discarded or paged in).
+	void discard( const Entry& entry );
+
+	// Whether most of the log is taken by dead records, so compact() should be called.
+	bool needsCompaction() const;
+
+	/*
+		Moves the records of all live \a entries to the start of the log, updating their
+		offsets, so that the space of dead records is reused by the next writes.
+		\throw ca::IOException if a record cannot be moved (entries remain valid).
+	 */
+	void compact( std::vector<Entry*>& entries );
+
+	/*
+		Appends a record for \a changes to the log, filling in the \a entry.
+		\throw ca::IOException if the record cannot be written.
+	 */
+	void write( ca::IGraphChanges* changes, Entry& entry );
+
+	/*
+		Reads back the changeset of an \a entry, as a new changeset of the \a graph.
+		\throw ca::IOException if the record cannot be read.
+		\throw ca::FormatException if the record is corrupted.
+	 */
+	ca::IGraphChanges* read( ca::IGraph* graph, const Entry& entry );
+
+private:
+	void reopen();
+
+private:
+	FILE* _file;
+	std::string _fileName;
+	long _size;			// end of the last record
+	long _liveSize;		// total size of the live records
+
+	StringSerializer _serializer;
+	std::string _record;	// reused encoding buffer
+	std::string _stored;	// reused compression buffer
+};
+
+} // namespace ca
+
+#endif // _CA_UNDOLOG_H_
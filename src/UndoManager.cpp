@@ -4,16 +4,103 @@
  */
 
 #include "UndoManager_Base.h"
+#include "GraphChanges.h"
+#include "UndoLog.h"
+#include "Universe.h"
 
+#include <algorithm>
+
+#include <co/IArray.h>
+#include <co/IReflector.h>
 #include <co/IllegalStateException.h>
 #include <co/IllegalArgumentException.h>
 
 #include <ca/IGraph.h>
 #include <ca/IGraphChanges.h>
+#include <ca/IObjectChanges.h>
+#include <ca/IServiceChanges.h>
 #include <ca/NoChangeException.h>
 
 namespace ca {
 
+// Estimates the heap memory retained by a value stored in a changeset.
+static size_t estimateValueSize( const co::Any& value )
+{
+	co::IType* type = value.getType();
+	if( !type )
+		return 0;
+
+	switch( type->getKind() )
+	{
+	case co::TK_STRING:
+		return value.get<const std::string&>().capacity();
+	case co::TK_ARRAY:
+		{
+			co::IType* elementType = static_cast<co::IArray*>( type )->getElementType();
+			size_t count = value.getCount();
+			size_t size = elementType->getReflector()->getSize() * count;
+			co::TypeKind elementKind = elementType->getKind();
+			if( elementKind == co::TK_STRING || elementKind == co::TK_ARRAY )
+			{
+				for( size_t i = 0; i < count; ++i )
+					size += estimateValueSize( value[i] );
+			}
+			return size;
+		}
+	case co::TK_STRUCT:
+	case co::TK_NATIVECLASS:
+		return type->getReflector()->getSize();
+	default:
+		return 0; // stored within the AnyValue
+	}
+}
+
+/*
+	Estimates the memory retained by a changeset. This is a rough account of
+	the change records and values, meant for enforcing the undo budget.
+ */
+static size_t estimateChangesSize( ca::IGraphChanges* changes )
+{
+	const size_t OBJECT_OVERHEAD = 64;	// a changes object and its vectors
+
+	size_t size = OBJECT_OVERHEAD;
+	size += sizeof(co::IObjectRef) * ( changes->getAddedObjects().getSize() + changes->getRemovedObjects().getSize() );
+
+	for( co::TSlice<ca::IObjectChanges*> objects = changes->getChangedObjects(); objects; objects.popFirst() )
+	{
+		ca::IObjectChanges* oc = objects.getFirst();
+		size += OBJECT_OVERHEAD + sizeof(ChangedConnection) * oc->getChangedConnections().getSize();
+
+		for( co::TSlice<ca::IServiceChanges*> services = oc->getChangedServices(); services; services.popFirst() )
+		{
+			ca::IServiceChanges* sc = services.getFirst();
+			size += OBJECT_OVERHEAD + sizeof(ChangedRefField) * sc->getChangedRefFields().getSize();
+
+			for( co::TSlice<ChangedRefVecField> fields = sc->getChangedRefVecFields(); fields; fields.popFirst() )
+			{
+				const ChangedRefVecField& f = fields.getFirst();
+				size += sizeof(ChangedRefVecField) + sizeof(void*) *
+					( f.previous.size() + f.current.size() + f.added.size() + f.removed.size() );
+			}
+
+			for( co::TSlice<ChangedValueField> fields = sc->getChangedValueFields(); fields; fields.popFirst() )
+			{
+				const ChangedValueField& f = fields.getFirst();
+				size += sizeof(ChangedValueField) + estimateValueSize( f.previous.getAny() )
+					+ estimateValueSize( f.current.getAny() );
+			}
+		}
+	}
+
+	return size;
+}
+
+// Estimates the memory retained by a changeset that was spilled to the undo log.
+static size_t estimateSpilledSize( const UndoLog::Entry& entry )
+{
+	return sizeof(UndoLog::Entry) + sizeof(co::IObjectRef) * entry.objects.size();
+}
+
 class UndoManager : public UndoManager_Base
 {
 public:
@@ -29,6 +116,11 @@ public:
 	{
 		_nestingLevel = 0;
 		_targetStack = Stack_Invalid;
+		_maxChangesets = 0;
+		_maxMemory = 0;
+		_memoryUsage[Stack_Undo] = 0;
+		_memoryUsage[Stack_Redo] = 0;
+		_residentChangesets = 16;
 	}
 
 	virtual ~UndoManager()
@@ -62,6 +154,80 @@ public:
 		return _descriptions[Stack_Redo];
 	}
 
+	co::uint32 getMaxChangesets()
+	{
+		return _maxChangesets;
+	}
+
+	void setMaxChangesets( co::uint32 maxChangesets )
+	{
+		_maxChangesets = maxChangesets;
+		enforceLimits();
+	}
+
+	double getMaxMemory()
+	{
+		return _maxMemory;
+	}
+
+	void setMaxMemory( double maxMemory )
+	{
+		if( maxMemory < 0 )
+			throw co::IllegalArgumentException( "illegal negative memory budget" );
+
+		_maxMemory = maxMemory;
+		enforceLimits();
+	}
+
+	double getMemoryUsage()
+	{
+		return static_cast<double>( _memoryUsage[Stack_Undo] ) + static_cast<double>( _memoryUsage[Stack_Redo] );
+	}
+
+	std::string getSpillFile()
+	{
+		return _log.getFileName();
+	}
+
+	void setSpillFile( const std::string& spillFile )
+	{
+		if( spillFile == _log.getFileName() )
+			return;
+
+		// bring back all spilled changesets before switching files
+		ChangeStack& undoStack = _changes[Stack_Undo];
+		for( size_t i = 0; i < undoStack.size() && !undoStack[i].changes.isValid(); ++i )
+			pageIn( undoStack[i] );
+
+		_log.close();
+		if( !spillFile.empty() )
+		{
+			_log.open( spillFile );
+			spillChanges();
+		}
+	}
+
+	co::uint32 getResidentChangesets()
+	{
+		return _residentChangesets;
+	}
+
+	void setResidentChangesets( co::uint32 residentChangesets )
+	{
+		_residentChangesets = std::max<co::uint32>( residentChangesets, 1 );
+		spillChanges();
+	}
+
+	std::string getMergeKey()
+	{
+		return _mergeKey;
+	}
+
+	void setMergeKey( const std::string& mergeKey )
+	{
+		_mergeKey = mergeKey;
+	}
+
 	void beginChange( const std::string& description )
 	{
 		if( _nestingLevel )
@@ -89,6 +255,7 @@ public:
 		if( --_nestingLevel > 0 )
 			return; // nested calls are ignored
 
+		_recordingKey = _mergeKey;
 		recordChanges( Stack_Undo );
 		clearStack( Stack_Redo );
 	}
@@ -139,8 +306,40 @@ public:
 		if( changes->getChangedObjects().isEmpty() )
 			throw NoChangeException( "changes contain no changed object" );
 
-		_changes[s].push_back( changes );
-		_descriptions[s].push_back( _description );
+		if( s == Stack_Undo && canMerge( changes ) )
+		{
+			// merge into the top changeset, keeping its description
+			Changeset& top = _changes[s].back();
+			_memoryUsage[s] -= top.size;
+			top.changes = GraphChanges::merge( top.changes.get(), changes );
+			if( top.changes->getChangedObjects().isEmpty() )
+			{
+				// the gesture ended where it began, so there is nothing left to undo
+				_changes[s].pop_back();
+				_descriptions[s].pop_back();
+				_topKey.clear();
+				return;
+			}
+			top.size = estimateChangesSize( top.changes.get() );
+			_memoryUsage[s] += top.size;
+		}
+		else
+		{
+			Changeset cs;
+			cs.changes = changes;
+			cs.size = estimateChangesSize( changes );
+			_changes[s].push_back( cs );
+			_descriptions[s].push_back( _description );
+			_memoryUsage[s] += cs.size;
+		}
+
+		if( s == Stack_Undo )
+		{
+			_topKey = _recordingKey;
+			spillChanges();
+		}
+
+		enforceLimits();
 	}
 
 protected:
@@ -174,10 +373,120 @@ private:
 			throw co::IllegalStateException( "operation forbidden while recording a changeset" );
 	}
 
+	inline bool isMergeable( ca::IGraphChanges* changes )
+	{
+		return changes->getAddedObjects().isEmpty() && changes->getRemovedObjects().isEmpty();
+	}
+
+	// Whether 'changes' should be merged into the top of the undo stack.
+	bool canMerge( ca::IGraphChanges* changes )
+	{
+		return !_recordingKey.empty() && _recordingKey == _topKey && !_changes[Stack_Undo].empty()
+			&& _changes[Stack_Undo].back().changes.isValid()
+			&& isMergeable( changes ) && isMergeable( _changes[Stack_Undo].back().changes.get() );
+	}
+
 	void clearStack( Stack s )
 	{
+		if( s == Stack_Undo )
+			_topKey.clear();
+
+		_memoryUsage[s] = 0;
+
+		for( size_t i = 0; i < _changes[s].size() && !_changes[s][i].changes.isValid(); ++i )
+			_log.discard( _changes[s][i].spilled );
+
 		_changes[s].clear();
 		_descriptions[s].clear();
+
+		if( s == Stack_Undo )
+			trimLog();
+	}
+
+	// Moves the undo changesets outside the resident window to the undo log.
+	void spillChanges()
+	{
+		if( !_log.isOpen() )
+			return;
+
+		// spilled changesets always form the bottom of the undo stack
+		ChangeStack& undoStack = _changes[Stack_Undo];
+		size_t end = ( undoStack.size() > _residentChangesets ? undoStack.size() - _residentChangesets : 0 );
+		for( size_t i = end; i > 0 && undoStack[i - 1].changes.isValid(); --i )
+		{
+			Changeset& cs = undoStack[i - 1];
+			_log.write( cs.changes.get(), cs.spilled );
+			cs.changes = NULL;
+			_memoryUsage[Stack_Undo] -= cs.size;
+			cs.size = estimateSpilledSize( cs.spilled );
+			_memoryUsage[Stack_Undo] += cs.size;
+		}
+	}
+
+	// Reads a spilled changeset (always in the undo stack) back into memory.
+	void pageIn( Changeset& cs )
+	{
+		assert( !cs.changes.isValid() );
+		cs.changes = _log.read( _graph.get(), cs.spilled );
+		_log.discard( cs.spilled );
+		cs.spilled.objects.clear();
+		_memoryUsage[Stack_Undo] -= cs.size;
+		cs.size = estimateChangesSize( cs.changes.get() );
+		_memoryUsage[Stack_Undo] += cs.size;
+	}
+
+	/*
+		Discards the undo log's contents once no changeset is spilled, or reclaims
+		the space of discarded changesets once most of the log is dead.
+	 */
+	void trimLog()
+	{
+		if( !_log.isOpen() )
+			return;
+
+		ChangeStack& undoStack = _changes[Stack_Undo];
+		if( undoStack.empty() || undoStack.front().changes.isValid() )
+		{
+			_log.clear();
+			return;
+		}
+
+		if( _log.needsCompaction() )
+		{
+			std::vector<UndoLog::Entry*> entries;
+			for( size_t i = 0; i < undoStack.size() && !undoStack[i].changes.isValid(); ++i )
+				entries.push_back( &undoStack[i].spilled );
+			_log.compact( entries );
+		}
+	}
+
+	/*
+		Discards the oldest undo changesets while the undo stack exceeds a limit.
+		The redo stack is not budgeted (see ca.IUndoManager), so that undoing
+		does not eat into the undo history.
+	 */
+	void enforceLimits()
+	{
+		ChangeStack& undoStack = _changes[Stack_Undo];
+		size_t numDiscarded = 0;
+		while( undoStack.size() - numDiscarded > 1 &&
+				( ( _maxChangesets && undoStack.size() - numDiscarded > _maxChangesets )
+				|| ( _maxMemory > 0 && static_cast<double>( _memoryUsage[Stack_Undo] ) > _maxMemory ) ) )
+		{
+			Changeset& cs = undoStack[numDiscarded];
+			if( !cs.changes.isValid() )
+				_log.discard( cs.spilled );
+			_memoryUsage[Stack_Undo] -= cs.size;
+			++numDiscarded;
+		}
+
+		if( numDiscarded )
+		{
+			undoStack.erase( undoStack.begin(), undoStack.begin() + numDiscarded );
+			StringStack& descriptions = _descriptions[Stack_Undo];
+			descriptions.erase( descriptions.begin(), descriptions.begin() + numDiscarded );
+			trimLog();
+		}
 	}
 
 	void recordChanges( Stack s )
@@ -204,15 +513,32 @@ private:
 		// separate pre-existing changes from the new ones
 		_graph->notifyChanges();
 
+		// reverted changesets are never merged
+		_recordingKey.clear();
+		_topKey.clear();
+
+		// changesets undone past the resident window are paged back in
+		if( !_changes[s].back().changes.isValid() )
+			pageIn( _changes[s].back() );
+
 		// revert and discard the changes
 		_description = _descriptions[s].back();
 		_descriptions[s].pop_back();
 
-		_changes[s].back()->revertChanges();
+		/*
+			The reverse changes are exactly the inverse of the changeset, so a
+			universe can post them directly, instead of detecting them again.
+		 */
+		ca::IGraphChanges* changes = _changes[s].back().changes.get();
+		if( !Universe::revertChanges( _graph.get(), changes, true ) )
+			changes->revertChanges();
 
 		//keep changes alive until the end of method
-		ca::IGraphChangesRef recentChanges = _changes[s].back();
+		ca::IGraphChangesRef recentChanges = _changes[s].back().changes;
+		_memoryUsage[s] -= _changes[s].back().size;
 		_changes[s].pop_back();
+		if( s == Stack_Undo )
+			trimLog();
 
 		// record the "reverse" changes on the "other" stack
 		recordChanges( s == Stack_Undo ? Stack_Redo : Stack_Undo );
@@ -226,12 +552,33 @@ private:
 	Stack _targetStack;
 	std::string _description;
 
+	struct Changeset
+	{
+		IGraphChangesRef changes;	// null while spilled to the undo log
+		size_t size;				// estimated memory usage
+		UndoLog::Entry spilled;
+	};
+
 	typedef std::vector<std::string> StringStack;
-	typedef std::vector<IGraphChangesRef> ChangeStack;
+	typedef std::vector<Changeset> ChangeStack;
 
 	// undo / redo stacks:
 	ChangeStack _changes[Stack_Count];
 	StringStack _descriptions[Stack_Count];
+
+	// memory budget:
+	co::uint32 _maxChangesets;
+	double _maxMemory;
+	size_t _memoryUsage[Stack_Count];	// per stack
+
+	// changesets spilled to disk:
+	UndoLog _log;
+	co::uint32 _residentChangesets;
+
+	// changeset merging:
+	std::string _mergeKey;
+	std::string _recordingKey;	// merge key of the changeset being recorded
+	std::string _topKey;		// merge key of the changeset at the top of the undo stack
 };
 
 CORAL_EXPORT_COMPONENT( UndoManager, UndoManager );
@@ -273,6 +273,8 @@ struct UpdateTraverser : public UniverseTraverser<UpdateTraverser>
 		for( size_t i = 0; i < newSize; ++i )
 			cf.current[i] = value[i];
 
+		ServiceChanges::computeDelta( cf );
+
 		// create a new RefVec
 		RefVecField newRefVec;
 		newRefVec.create( newSize );
@@ -308,6 +310,304 @@ struct UpdateTraverser : public UniverseTraverser<UpdateTraverser>
 	}
 };
 
+//------ InverseTraverser (applies a known inverse changeset) ------------------
+
+typedef std::vector<std::pair<co::int16, ca::IServiceChanges*> > FacetChanges;
+
+// An object in a changeset being reverted, with its services sorted by facet.
+struct ChangedObject
+{
+	ObjectRecord* object;
+	ca::IObjectChanges* changes;
+	FacetChanges facets;
+
+	ChangedObject( ObjectRecord* object, ca::IObjectChanges* changes )
+		: object( object ), changes( changes )
+	{;}
+
+	inline bool operator<( const ChangedObject& other ) const
+	{
+		return object < other.object;
+	}
+};
+
+struct InverseTraverser : public UniverseTraverser<InverseTraverser>
+{
+	bool updatedRefs; // whether references were updated (objects may have been destroyed)
+
+	InverseTraverser( UniverseRecord& u ) : UT( u, NULL ), updatedRefs( false )
+	{;}
+
+	RefField* findReceptacle( co::IPort* port )
+	{
+		ComponentRecord* model = source->model;
+		for( co::uint8 i = 0; i < model->numReceptacles; ++i )
+			if( model->ports[model->numFacets + i].port == port )
+				return &source->getReceptacles()[i];
+		return NULL;
+	}
+
+	// Returns the index of a \a field among fields[begin..end-1] of a facet, or -1.
+	static int findField( InterfaceRecord* itf, co::IField* field, co::uint16 begin, co::uint16 end )
+	{
+		for( co::uint16 i = begin; i < end; ++i )
+			if( itf->fields[i].field == field )
+				return i;
+		return -1;
+	}
+
+	inline RefField* getRefs( PortRecord& facet )
+	{
+		return source->get<RefField>( facet.offset );
+	}
+
+	inline RefVecField* getRefVecs( PortRecord& facet )
+	{
+		return source->get<RefVecField>( facet.offset + sizeof(RefField) * facet.typeRec->numRefs );
+	}
+
+	inline void* getValue( PortRecord& facet, co::uint16 index )
+	{
+		return source->get<void>( facet.offset + facet.typeRec->fields[index].offset );
+	}
+
+	// Returns whether the stored state of the source object matches the 'current' values in its changes.
+	bool matches( ca::IObjectChanges* changes, const FacetChanges& facets )
+	{
+		for( co::TSlice<ChangedConnection> c = changes->getChangedConnections(); c; c.popFirst() )
+		{
+			RefField* ref = findReceptacle( c.getFirst().receptacle.get() );
+			if( !ref || ref->service != c.getFirst().current.get() )
+				return false;
+		}
+
+		for( size_t i = 0; i < facets.size(); ++i )
+		{
+			PortRecord& facet = source->model->ports[facets[i].first];
+			InterfaceRecord* itf = facet.typeRec;
+			ca::IServiceChanges* sc = facets[i].second;
+
+			for( co::TSlice<ChangedRefField> f = sc->getChangedRefFields(); f; f.popFirst() )
+			{
+				int k = findField( itf, f.getFirst().field.get(), 0, itf->numRefs );
+				if( k < 0 || getRefs( facet )[k].service != f.getFirst().current.get() )
+					return false;
+			}
+
+			for( co::TSlice<ChangedRefVecField> f = sc->getChangedRefVecFields(); f; f.popFirst() )
+			{
+				int k = findField( itf, f.getFirst().field.get(), itf->numRefs, itf->firstValue );
+				if( k < 0 )
+					return false;
+
+				RefVecField& refVec = getRefVecs( facet )[k - itf->numRefs];
+				const std::vector<co::IServiceRef>& current = f.getFirst().current;
+				if( current.size() != refVec.getSize() ||
+						!std::equal( current.begin(), current.end(), refVec.services ) )
+					return false;
+			}
+
+			for( co::TSlice<ChangedValueField> f = sc->getChangedValueFields(); f; f.popFirst() )
+			{
+				int k = findField( itf, f.getFirst().field.get(), itf->firstValue, itf->numFields );
+				if( k < 0 )
+					return false;
+
+				co::Any stored( false, f.getFirst().field->getType(), getValue( facet, k ) );
+				if( !f.getFirst().current.getAny().equals( stored ) )
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	/*
+		Restores the 'previous' values of the changes into the source object's
+		stored state, and posts the inverse changes. Should only be called if matches().
+	 */
+	void apply( ca::IObjectChanges* changes, const FacetChanges& facets )
+	{
+		co::RefPtr<ObjectChanges> inverse( new ObjectChanges( source->instance ) );
+		bool changed = false;
+
+		for( co::TSlice<ChangedConnection> c = changes->getChangedConnections(); c; c.popFirst() )
+		{
+			const ChangedConnection& change = c.getFirst();
+			if( change.previous == change.current )
+				continue;
+
+			RefField* ref = findReceptacle( change.receptacle.get() );
+			updateRef( ref->service, ref->object, change.previous.get() );
+			updatedRefs = changed = true;
+
+			ChangedConnection& cc = inverse->addChangedConnection();
+			cc.receptacle = change.receptacle;
+			cc.previous = change.current;
+			cc.current = change.previous;
+		}
+
+		for( size_t i = 0; i < facets.size(); ++i )
+		{
+			co::uint8 facetId = static_cast<co::uint8>( facets[i].first );
+			if( applyService( facetId, facets[i].second, inverse.get() ) )
+				changed = true;
+		}
+
+		if( !changed )
+			return;
+
+		// add the inverse changes to each of this object's spaces
+		SpaceRefCountMap::iterator end = source->spaceRefs.end();
+		for( SpaceRefCountMap::iterator it = source->spaceRefs.begin(); it != end; ++it )
+			u.onChangedObject( it->first, inverse.get() );
+	}
+
+	bool applyService( co::uint8 facetId, ca::IServiceChanges* changes, ObjectChanges* inverse )
+	{
+		PortRecord& facet = source->model->ports[facetId];
+		InterfaceRecord* itf = facet.typeRec;
+		co::RefPtr<ServiceChanges> sc( new ServiceChanges( source->services[facetId] ) );
+		bool changed = false;
+
+		for( co::TSlice<ChangedRefField> f = changes->getChangedRefFields(); f; f.popFirst() )
+		{
+			const ChangedRefField& change = f.getFirst();
+			if( change.previous == change.current )
+				continue;
+
+			RefField& ref = getRefs( facet )[findField( itf, change.field.get(), 0, itf->numRefs )];
+			updateRef( ref.service, ref.object, change.previous.get() );
+			updatedRefs = changed = true;
+
+			ChangedRefField& cf = sc->addChangedRefField();
+			cf.field = change.field;
+			cf.previous = change.current;
+			cf.current = change.previous;
+		}
+
+		for( co::TSlice<ChangedRefVecField> f = changes->getChangedRefVecFields(); f; f.popFirst() )
+		{
+			const ChangedRefVecField& change = f.getFirst();
+			if( change.previous == change.current )
+				continue;
+
+			int k = findField( itf, change.field.get(), itf->numRefs, itf->firstValue );
+			RefVecField& refVec = getRefVecs( facet )[k - itf->numRefs];
+
+			// create a new RefVec
+			size_t newSize = change.previous.size();
+			size_t oldSize = refVec.getSize();
+			RefVecField newRefVec;
+			newRefVec.create( newSize );
+			for( size_t i = 0; i < newSize; ++i )
+				initRef( newRefVec.services[i], newRefVec.objects[i], change.previous[i].get() );
+
+			// destroy the old RefVec
+			for( size_t i = 0; i < oldSize; ++i )
+				u.removeRef( source, refVec.objects[i] );
+
+			refVec.destroy();
+			refVec = newRefVec;
+			updatedRefs = changed = true;
+
+			ChangedRefVecField& cf = sc->addChangedRefVecField();
+			cf.field = change.field;
+			cf.previous = change.current;
+			cf.current = change.previous;
+			cf.added = change.removed;
+			cf.removed = change.added;
+		}
+
+		for( co::TSlice<ChangedValueField> f = changes->getChangedValueFields(); f; f.popFirst() )
+		{
+			const ChangedValueField& change = f.getFirst();
+			if( change.previous.getAny().equals( change.current.getAny() ) )
+				continue;
+
+			int k = findField( itf, change.field.get(), itf->firstValue, itf->numFields );
+			co::Any stored( false, change.field->getType(), getValue( facet, k ) );
+			stored.put( change.previous.getAny() );
+			changed = true;
+
+			ChangedValueField& cf = sc->addChangedValueField();
+			cf.field = change.field;
+			cf.previous = change.current;
+			cf.current = change.previous;
+		}
+
+		if( changed )
+			inverse->addChangedService( sc.get() );
+
+		return changed;
+	}
+};
+
+//------ LoadRefsTraverser (stores lazily loaded references) --------------------
+
+struct LoadRefsTraverser : public InverseTraverser
+{
+	LoadRefsTraverser( UniverseRecord& u ) : InverseTraverser( u )
+	{;}
+
+	// Stores the current value of a reference \a member of the source object's facet.
+	void load( co::int16 facetId, co::IMember* member )
+	{
+		if( facetId < 0 )
+		{
+			co::IPort* port = static_cast<co::IPort*>( member );
+			RefField* ref = findReceptacle( port );
+			if( !ref )
+				throw NotInGraphException( "the receptacle is not in the object model" );
+
+			co::IService* service = source->instance->getServiceAt( port );
+			if( service != ref->service )
+				updateRef( ref->service, ref->object, service );
+			return;
+		}
+
+		PortRecord& facet = source->model->ports[facetId];
+		InterfaceRecord* itf = facet.typeRec;
+		co::IField* field = static_cast<co::IField*>( member );
+		co::IService* service = source->services[facetId];
+
+		int k = findField( itf, field, 0, itf->numRefs );
+		if( k >= 0 )
+		{
+			co::IServiceRef value;
+			itf->fields[k].getOwnerReflector()->getField( service, field, value );
+
+			RefField& ref = getRefs( facet )[k];
+			if( value != ref.service )
+				updateRef( ref.service, ref.object, value.get() );
+			return;
+		}
+
+		k = findField( itf, field, itf->numRefs, itf->firstValue );
+		if( k < 0 )
+			throw NotInGraphException( "the field is not a reference in the object model" );
+
+		std::vector<co::IServiceRef> value;
+		itf->fields[k].getOwnerReflector()->getField( service, field, value );
+
+		// create a new RefVec
+		RefVecField& refVec = getRefVecs( facet )[k - itf->numRefs];
+		size_t newSize = value.size();
+		size_t oldSize = refVec.getSize();
+		RefVecField newRefVec;
+		newRefVec.create( newSize );
+		for( size_t i = 0; i < newSize; ++i )
+			initRef( newRefVec.services[i], newRefVec.objects[i], value[i].get() );
+
+		// destroy the old RefVec
+		for( size_t i = 0; i < oldSize; ++i )
+			u.removeRef( source, refVec.objects[i] );
+
+		refVec.destroy();
+		refVec = newRefVec;
+	}
+};
+
 //------ AddRefTraverser -------------------------------------------------------
 
 struct AddRefTraverser : public UniverseTraverser<AddRefTraverser>
@@ -661,6 +961,170 @@ void Universe::spaceAddChange( co::int16 spaceId, co::IService* service )
 	_u.addChangedService( object, facet );
 }
 
+Universe* Universe::findUniverse( ca::IGraph* graph, co::int16& spaceId )
+{
+	if( !graph )
+		return NULL;
+
+	const std::string& name = graph->getProvider()->getComponent()->getFullName();
+	if( name == "ca.Universe" )
+	{
+		spaceId = -1;
+		return static_cast<Universe*>( static_cast<ca::IUniverse*>( graph ) );
+	}
+
+	if( name == "ca.Space" )
+	{
+		ca::ISpace* space = static_cast<ca::ISpace*>( graph );
+		Universe* universe = static_cast<Universe*>( space->getUniverse() );
+		spaceId = ( universe ? universe->findSpace( space ) : -1 );
+		return spaceId < 0 ? NULL : universe;
+	}
+
+	return NULL;
+}
+
+bool Universe::revertChanges( ca::IGraph* graph, ca::IGraphChanges* changes, bool applyInverse )
+{
+	co::int16 spaceId;
+	Universe* universe = findUniverse( graph, spaceId );
+	if( !universe )
+		return false;
+
+	universe->spaceRevertChanges( spaceId, changes, applyInverse );
+	return true;
+}
+
+bool Universe::loadRefs( ca::IGraph* graph, const ServiceMemberList& members )
+{
+	co::int16 spaceId;
+	Universe* universe = findUniverse( graph, spaceId );
+	if( !universe )
+		return false;
+
+	universe->spaceLoadRefs( spaceId, members );
+	return true;
+}
+
+void Universe::spaceRevertChanges( co::int16 spaceId, ca::IGraphChanges* changes, bool applyInverse )
+{
+	checkHasModel();
+
+	// resolve all object records and facets up front, in the order used by notifyChanges()
+	std::vector<ChangedObject> objects;
+
+	co::TSlice<ca::IObjectChanges*> changedObjects = changes->getChangedObjects();
+	objects.reserve( changedObjects.getSize() );
+	for( ; changedObjects; changedObjects.popFirst() )
+	{
+		ca::IObjectChanges* objectChanges = changedObjects.getFirst();
+		ObjectRecord* object = _u.getObject( objectChanges->getObject() );
+		if( spaceId >= 0 && object->spaceRefs[spaceId] < 1 )
+			throw NotInGraphException( "changed object is not in this space" );
+
+		objects.push_back( ChangedObject( object, objectChanges ) );
+
+		FacetChanges& facets = objects.back().facets;
+		co::TSlice<IServiceChanges*> services = objectChanges->getChangedServices();
+		for( ; services; services.popFirst() )
+		{
+			co::int16 facet = findFacet( object, services.getFirst()->getService() );
+			if( facet < 0 )
+				throw NotInGraphException( "the service's facet is not in the object model" );
+
+			facets.push_back( FacetChanges::value_type( facet, services.getFirst() ) );
+		}
+
+		std::sort( facets.begin(), facets.end() );
+	}
+
+	std::sort( objects.begin(), objects.end() );
+
+	_lastChangedService = NULL;
+
+	// revert the objects, one service at a time
+	size_t numObjects = objects.size();
+	for( size_t i = 0; i < numObjects; ++i )
+	{
+		ObjectRecord* object = objects[i].object;
+
+		co::TSlice<ChangedConnection> connections = objects[i].changes->getChangedConnections();
+		for( ; connections; connections.popFirst() )
+			object->instance->setServiceAt( connections.getFirst().receptacle.get(),
+											connections.getFirst().previous.get() );
+
+		FacetChanges& facets = objects[i].facets;
+		for( size_t k = 0; k < facets.size(); ++k )
+			GraphChanges::revertFields( facets[k].second );
+	}
+
+	/*
+		Either mark the reverted services as changed, or store the 'previous' values
+		directly and post the inverse changes (skipping change detection). Objects
+		whose stored state does not match the changeset are always marked as changed.
+	 */
+	InverseTraverser traverser( _u );
+	for( size_t i = 0; i < numObjects; ++i )
+	{
+		ChangedObject& entry = objects[i];
+		if( applyInverse )
+		{
+			// updating references may destroy objects, so records are resolved again
+			traverser.source = ( traverser.updatedRefs ? _u.findObject( entry.changes->getObject() ) : entry.object );
+			if( !traverser.source )
+				continue; // object was removed from the universe
+
+			if( traverser.matches( entry.changes, entry.facets ) )
+			{
+				traverser.apply( entry.changes, entry.facets );
+				continue;
+			}
+
+			entry.object = traverser.source;
+		}
+
+		if( entry.changes->getChangedConnections() )
+			_u.addChangedService( entry.object, -1 );
+
+		for( size_t k = 0; k < entry.facets.size(); ++k )
+			_u.addChangedService( entry.object, entry.facets[k].first );
+	}
+}
+
+void Universe::spaceLoadRefs( co::int16 spaceId, const ServiceMemberList& members )
+{
+	checkHasModel();
+
+	_lastChangedService = NULL;
+
+	// objects reached through the loaded references are not reported as added
+	_u.muted = true;
+	try
+	{
+		LoadRefsTraverser traverser( _u );
+		size_t numMembers = members.size();
+		for( size_t i = 0; i < numMembers; ++i )
+		{
+			co::IService* service = members[i].first;
+			traverser.source = _u.getObject( service->getProvider() );
+			if( spaceId >= 0 && traverser.source->spaceRefs[spaceId] < 1 )
+				throw NotInGraphException( "service is not provided by an object in this space" );
+
+			co::int16 facet = findFacet( traverser.source, service );
+			if( facet == -2 )
+				throw NotInGraphException( "the service's facet is not in the object model" );
+
+			traverser.load( facet, members[i].second );
+		}
+	}
+	catch( ... )
+	{
+		_u.muted = false;
+		throw;
+	}
+	_u.muted = false;
+}
+
 void Universe::spaceAddGraphObserver( co::int16 spaceId, ca::IGraphObserver* observer )
 {
 	CHECK_NULL_ARG( observer );
@@ -765,7 +1229,8 @@ void Universe::notifyChanges()
 	{
 		ChangedService* cs = &_u.changedServices.front();
 		ChangedService* lastCS = &_u.changedServices.back();
-		std::sort( cs, lastCS + 1 );
+		if( !_u.changedServicesSorted )
+			std::sort( cs, lastCS + 1 );
 
 		UpdateTraverser traverser( _u );
 		try
@@ -792,6 +1257,7 @@ void Universe::notifyChanges()
 		}
 
 		_u.changedServices.clear();
+		_u.changedServicesSorted = true;
 	}
 
 	// notify observers...
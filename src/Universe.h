@@ -35,6 +35,9 @@ inline void checkComponent( co::IService* service, const char* expectedComponent
 	
 typedef std::vector<ca::IGraphObserver*> GraphObserverList;
 
+// List of reference members (receptacles or reference fields) of services.
+typedef std::vector<std::pair<co::IService*, co::IMember*> > ServiceMemberList;
+
 // Data for a graph.
 struct GraphRecord
 {
@@ -103,9 +106,15 @@ struct UniverseRecord : GraphRecord
 	ObjectMap objectMap;
 
 	std::vector<ChangedService> changedServices;
+	bool changedServicesSorted;	// whether 'changedServices' is already sorted
 
 	ObjectObserverMap objectObservers;
 
+	bool muted;	// whether added/removed/changed objects are currently not recorded
+
+	UniverseRecord() : changedServicesSorted( true ), muted( false )
+	{;}
+
 	// Finds an object given its component instance. Returns NULL on failure.
 	ObjectRecord* findObject( co::IObject* instance )
 	{
@@ -157,6 +166,7 @@ struct UniverseRecord : GraphRecord
 	void removeRef( ObjectRecord* from, ObjectRecord* to );
 
 	#define ON_CHANGE( EVENT ) \
+		if( muted ) return; \
 		hasChanges = true; \
 		changes. EVENT ; \
 		SpaceRecord* space = spaces[spaceId]; \
@@ -184,7 +194,10 @@ struct UniverseRecord : GraphRecord
 	inline void addChangedService( ObjectRecord* object, co::int16 facet )
 	{
 		assert( facet >= -1 );
-		changedServices.push_back( ChangedService( object, facet ) );
+		ChangedService cs( object, facet );
+		if( changedServicesSorted && !changedServices.empty() && cs < changedServices.back() )
+			changedServicesSorted = false;
+		changedServices.push_back( cs );
 	}
 };
 
@@ -219,12 +232,36 @@ public:
 	 */
 	bool tryAddChange( co::IObject* object, co::IService* service );
 
+	/*!
+		Reverts a changeset of a ca.Universe or ca.Space in bulk, marking the reverted
+		services as changed. Object records and facets are resolved once per object,
+		and the changed services are queued in sorted order. Returns false, doing
+		nothing, if the \a graph is not managed by a ca.Universe.
+
+		If \a applyInverse is true, the 'previous' values are stored directly and the
+		inverse changes are posted by the next notifyChanges(), without re-reading the
+		reverted fields. Objects whose stored state no longer matches the changeset's
+		'current' values fall back to regular change detection.
+	 */
+	static bool revertChanges( ca::IGraph* graph, ca::IGraphChanges* changes, bool applyInverse );
+
+	/*!
+		Stores the current values of the given reference \a members of services in a
+		ca.Universe or ca.Space as their tracked state, without posting any changes.
+		Objects that become reachable through them join the graph silently. Used to
+		install references that were loaded lazily, which are not edits to the graph.
+		Returns false, doing nothing, if the \a graph is not managed by a ca.Universe.
+	 */
+	static bool loadRefs( ca::IGraph* graph, const ServiceMemberList& members );
+
 	// Methods called from spaces:
 	co::int16 spaceRegister( ca::ISpace* space );
 	void spaceUnregister( co::int16 spaceId );
 	co::IObject* spaceGetRootObject( co::int16 spaceId );
 	void spaceInitialize( co::int16 spaceId, co::IObject* root );
 	void spaceAddChange( co::int16 spaceId, co::IService* service );
+	void spaceRevertChanges( co::int16 spaceId, ca::IGraphChanges* changes, bool applyInverse );
+	void spaceLoadRefs( co::int16 spaceId, const ServiceMemberList& members );
 	void spaceAddGraphObserver( co::int16 spaceId, ca::IGraphObserver* observer );
 	void spaceRemoveGraphObserver( co::int16 spaceId, ca::IGraphObserver* observer );
 
@@ -244,11 +281,24 @@ protected:
 	void setModelService( ca::IModel* model );
 
 private:
+	// Returns the ca.Universe that manages a \a graph (and the graph's \a spaceId, or -1), or NULL.
+	static Universe* findUniverse( ca::IGraph* graph, co::int16& spaceId );
+
 	inline SpaceRecord* getSpace( co::uint16 spaceId )
 	{
 		return _u.spaces[spaceId];
 	}
 
+	// Returns the id of a registered \a space, or -1 if it is not registered.
+	inline co::int16 findSpace( ca::ISpace* space )
+	{
+		co::int16 numSpaces = static_cast<co::int16>( _u.spaces.size() );
+		for( co::int16 i = 0; i < numSpaces; ++i )
+			if( _u.spaces[i] && _u.spaces[i]->space == space )
+				return i;
+		return -1;
+	}
+
 	inline void checkHasModel()
 	{
 		if( !_u.model.isValid() )
@@ -0,0 +1,212 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#ifndef _CA_ARCHIVEIO_H_
+#define _CA_ARCHIVEIO_H_
+
+#include <co/Platform.h>
+#include <co/Exception.h>
+#include <ca/IOException.h>
+#include <ca/FormatException.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if !defined(CORAL_OS_WIN)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+/*
+	Low-level I/O helpers shared by the binary archive formats.
+	Varints are LEB128, and fixed-size integers are little-endian.
+ */
+
+namespace ca {
+
+inline void putVarint( std::string& out, co::uint32 value )
+{
+	while( value >= 0x80 )
+	{
+		out.push_back( static_cast<char>( value | 0x80 ) );
+		value >>= 7;
+	}
+	out.push_back( static_cast<char>( value ) );
+}
+
+inline void putSigned( std::string& out, co::int32 value )
+{
+	putVarint( out, ( static_cast<co::uint32>( value ) << 1 ) ^ static_cast<co::uint32>( value >> 31 ) );
+}
+
+inline void putString( std::string& out, const std::string& str )
+{
+	putVarint( out, static_cast<co::uint32>( str.size() ) );
+	out.append( str );
+}
+
+inline void putFixed( std::string& out, co::uint64 bits, int size )
+{
+	for( int i = 0; i < size; ++i, bits >>= 8 )
+		out.push_back( static_cast<char>( bits & 0xFF ) );
+}
+
+/*
+	Reads values from a block of memory, raising FormatExceptions on overruns.
+ */
+class ByteReader
+{
+public:
+	ByteReader( const co::uint8* data, size_t size ) : _pos( data ), _end( data + size )
+	{;}
+
+	inline size_t getRemaining() const { return _end - _pos; }
+	inline const co::uint8* getPos() const { return _pos; }
+
+	inline co::uint8 readByte()
+	{
+		if( _pos == _end )
+			truncated();
+		return *_pos++;
+	}
+
+	co::uint32 readVarint()
+	{
+		co::uint32 value = 0;
+		for( int shift = 0; shift < 35; shift += 7 )
+		{
+			co::uint8 b = readByte();
+			value |= static_cast<co::uint32>( b & 0x7F ) << shift;
+			if( !( b & 0x80 ) )
+				return value;
+		}
+		throw ca::FormatException( "malformed integer in archive" );
+	}
+
+	inline co::int32 readSigned()
+	{
+		co::uint32 v = readVarint();
+		return static_cast<co::int32>( ( v >> 1 ) ^ ( ~( v & 1 ) + 1 ) );
+	}
+
+	co::uint64 readFixed( int size )
+	{
+		const co::uint8* p = skip( size );
+		co::uint64 bits = 0;
+		for( int i = size - 1; i >= 0; --i )
+			bits = ( bits << 8 ) | p[i];
+		return bits;
+	}
+
+	void readString( std::string& str )
+	{
+		size_t size = readVarint();
+		const co::uint8* p = skip( size );
+		str.assign( reinterpret_cast<const char*>( p ), size );
+	}
+
+	const co::uint8* skip( size_t size )
+	{
+		if( getRemaining() < size )
+			truncated();
+		const co::uint8* p = _pos;
+		_pos += size;
+		return p;
+	}
+
+private:
+	void truncated()
+	{
+		throw ca::FormatException( "unexpected end of archive" );
+	}
+
+private:
+	const co::uint8* _pos;
+	const co::uint8* _end;
+};
+
+/*
+	A read-only view of a whole file. The file is memory-mapped where supported.
+ */
+class MappedFile
+{
+public:
+	MappedFile( const std::string& fileName ) : _data( NULL ), _size( 0 )
+	{
+#if defined(CORAL_OS_WIN)
+		FILE* file = fopen( fileName.c_str(), "rb" );
+		if( !file )
+			CORAL_THROW( ca::IOException, "could not open file '" << fileName << "' for reading" );
+
+		fseek( file, 0, SEEK_END );
+		long size = ftell( file );
+		fseek( file, 0, SEEK_SET );
+
+		_buffer.resize( size > 0 ? size : 0 );
+		bool failed = ( size < 0 || fread( &_buffer[0], 1, _buffer.size(), file ) != _buffer.size() );
+		fclose( file );
+		if( failed )
+			CORAL_THROW( ca::IOException, "error reading file '" << fileName << "'" );
+
+		_size = _buffer.size();
+		_data = _size ? &_buffer[0] : NULL;
+#else
+		int fd = open( fileName.c_str(), O_RDONLY );
+		if( fd < 0 )
+			CORAL_THROW( ca::IOException, "could not open file '" << fileName << "' for reading" );
+
+		struct stat st;
+		if( fstat( fd, &st ) != 0 )
+		{
+			close( fd );
+			CORAL_THROW( ca::IOException, "error reading file '" << fileName << "'" );
+		}
+
+		_size = static_cast<size_t>( st.st_size );
+		if( _size )
+		{
+			void* data = mmap( NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0 );
+			if( data == MAP_FAILED )
+			{
+				close( fd );
+				CORAL_THROW( ca::IOException, "could not map file '" << fileName << "' into memory" );
+			}
+			_data = static_cast<const co::uint8*>( data );
+		}
+
+		// the mapping remains valid after the file is closed
+		close( fd );
+#endif
+	}
+
+	~MappedFile()
+	{
+#if !defined(CORAL_OS_WIN)
+		if( _data )
+			munmap( const_cast<co::uint8*>( _data ), _size );
+#endif
+	}
+
+	inline const co::uint8* getData() const { return _data; }
+	inline size_t getSize() const { return _size; }
+
+private:
+	// forbid copies
+	MappedFile( const MappedFile& );
+	MappedFile& operator=( const MappedFile& );
+
+private:
+	const co::uint8* _data;
+	size_t _size;
+#if defined(CORAL_OS_WIN)
+	std::vector<co::uint8> _buffer;
+#endif
+};
+
+} // namespace ca
+
+#endif // _CA_ARCHIVEIO_H_
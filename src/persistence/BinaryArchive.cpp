@@ -0,0 +1,736 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#include "BinaryArchive_Base.h"
+#include "ArchiveIO.h"
+#include "BlockCodec.h"
+#include "ValueBuffer.h"
+
+#include <co/Coral.h>
+#include <co/IEnum.h>
+#include <co/IPort.h>
+#include <co/IArray.h>
+#include <co/IField.h>
+#include <co/Exception.h>
+#include <co/IComponent.h>
+#include <co/IInterface.h>
+#include <co/IRecordType.h>
+#include <ca/IModel.h>
+#include <ca/IOException.h>
+#include <ca/ModelException.h>
+#include <ca/FormatException.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <vector>
+
+/*
+	Archive layout (all integers are little-endian; varints are LEB128):
+
+		"CABA" | version: uint8 | flags: uint8 | payload
+
+	If the FLAG_COMPRESSED bit is set, the payload is stored as a varint with
+	its total size followed by blocks of [rawSize: varint][storedSize: varint][data],
+	where a block whose storedSize equals its rawSize is not compressed. Blocks hold
+	at most BLOCK_SIZE bytes of the payload, and need not be full.
+
+	The payload holds:
+		- the schema: the number of types, then for each type its full name
+		  and the names of its ports (components) or fields (other types);
+		- the number of objects, then the schema index of each object's component;
+		- each object's data: for each of its component's ports, either the
+		  fields of the facet (in schema order) or a reference.
+
+	References are a varint object id (0 for null) followed by the facet's
+	index in its component's ports. Signed integers are zigzag-encoded varints,
+	unsigned integers and enums are varints, strings and arrays are prefixed
+	with their varint size, and records are written as their fields in order.
+ */
+
+namespace ca {
+
+static const char MAGIC[4] = { 'C', 'A', 'B', 'A' };
+static const co::uint8 FORMAT_VERSION = 1;
+static const co::uint8 FLAG_COMPRESSED = 1;
+static const size_t BLOCK_SIZE = 64 * 1024;
+
+/******************************************************************************/
+/* Save                                                                       */
+/******************************************************************************/
+
+/*
+	Serializes an object graph into an archive payload.
+ */
+class BinaryWriter
+{
+public:
+	BinaryWriter( ca::IModel* model ) : _model( model )
+	{;}
+
+	/*
+		Serializes the graph of \a rootObject. The payload is the schema followed by
+		the body; they are kept apart so that neither has to be copied into the other.
+	 */
+	void write( co::IObject* rootObject )
+	{
+		// objects are numbered as they are first referenced, and written in that order
+		getId( rootObject );
+		for( size_t i = 0; i < _objects.size(); ++i )
+			writeObject( _objects[i], _types[_objectTypes[i]] );
+
+		// now that all types are known, write the schema that precedes the objects
+		_schema.clear();
+		_schema.reserve( _types.size() * 64 + _objects.size() * 2 );
+
+		putVarint( _schema, static_cast<co::uint32>( _types.size() ) );
+		for( size_t i = 0; i < _types.size(); ++i )
+		{
+			const TypeEntry& entry = _types[i];
+			putString( _schema, entry.type->getFullName() );
+			if( entry.type->getKind() == co::TK_COMPONENT )
+			{
+				putVarint( _schema, static_cast<co::uint32>( entry.ports.size() ) );
+				for( size_t k = 0; k < entry.ports.size(); ++k )
+					putString( _schema, entry.ports[k]->getName() );
+			}
+			else
+			{
+				putVarint( _schema, static_cast<co::uint32>( entry.fields.size() ) );
+				for( size_t k = 0; k < entry.fields.size(); ++k )
+					putString( _schema, entry.fields[k]->getName() );
+			}
+		}
+
+		putVarint( _schema, static_cast<co::uint32>( _objects.size() ) );
+		for( size_t i = 0; i < _objectTypes.size(); ++i )
+			putVarint( _schema, _objectTypes[i] );
+	}
+
+	inline const std::string& getSchema() const { return _schema; }
+	inline const std::string& getBody() const { return _body; }
+
+private:
+	struct TypeEntry
+	{
+		co::IType* type;
+		std::vector<co::IPortRef> ports;	// for components
+		std::vector<co::IFieldRef> fields;	// for interfaces and value types
+	};
+
+	co::uint32 getTypeIndex( co::IType* type )
+	{
+		TypeMap::iterator it = _typeMap.find( type );
+		if( it != _typeMap.end() )
+			return it->second;
+
+		_types.push_back( TypeEntry() );
+		TypeEntry& entry = _types.back();
+		entry.type = type;
+		if( type->getKind() == co::TK_COMPONENT )
+			_model->getPorts( static_cast<co::IComponent*>( type ), entry.ports );
+		else
+			_model->getFields( static_cast<co::IRecordType*>( type ), entry.fields );
+
+		co::uint32 index = static_cast<co::uint32>( _types.size() - 1 );
+		_typeMap.insert( TypeMap::value_type( type, index ) );
+		return index;
+	}
+
+	co::uint32 getId( co::IObject* object )
+	{
+		IdMap::iterator it = _ids.find( object );
+		if( it != _ids.end() )
+			return it->second;
+
+		co::uint32 typeIndex = getTypeIndex( object->getComponent() );
+
+		_objects.push_back( object );
+		_objectTypes.push_back( typeIndex );
+		co::uint32 id = static_cast<co::uint32>( _objects.size() );
+		_ids.insert( IdMap::value_type( object, id ) );
+		return id;
+	}
+
+	void writeObject( co::IObject* object, const TypeEntry& entry )
+	{
+		for( size_t i = 0; i < entry.ports.size(); ++i )
+		{
+			co::IPort* port = entry.ports[i].get();
+			co::IService* service = object->getServiceAt( port );
+			if( port->getIsFacet() )
+				writeFields( service, _types[getTypeIndex( port->getType() )] );
+			else
+				writeRef( service );
+		}
+	}
+
+	void writeFields( const co::Any& instance, const TypeEntry& entry )
+	{
+		co::IReflector* reflector = entry.type->getReflector();
+		co::AnyValue value;
+		for( size_t i = 0; i < entry.fields.size(); ++i )
+		{
+			co::IField* field = entry.fields[i].get();
+			reflector->getField( instance, field, value );
+			writeValue( value.getAny(), field->getType() );
+		}
+	}
+
+	void writeRef( co::IService* service )
+	{
+		if( !service )
+		{
+			putVarint( _body, 0 );
+			return;
+		}
+
+		co::uint32 id = getId( service->getProvider() );
+		putVarint( _body, id );
+
+		// the facet is written as its index among the component's ports
+		co::IPort* facet = service->getFacet();
+		const std::vector<co::IPortRef>& ports = _types[_objectTypes[id - 1]].ports;
+		for( size_t i = 0; i < ports.size(); ++i )
+		{
+			if( ports[i].get() == facet )
+			{
+				putVarint( _body, static_cast<co::uint32>( i ) );
+				return;
+			}
+		}
+
+		CORAL_THROW( ca::ModelException, "facet '" << facet->getName() << "' of component '"
+			<< facet->getOwner()->getFullName() << "' is not in the object model" );
+	}
+
+	void writeValue( const co::Any& value, co::IType* type )
+	{
+		switch( type->getKind() )
+		{
+		case co::TK_BOOL:	_body.push_back( value.get<bool>() ? 1 : 0 ); break;
+		case co::TK_INT8:	putSigned( _body, value.get<co::int8>() ); break;
+		case co::TK_INT16:	putSigned( _body, value.get<co::int16>() ); break;
+		case co::TK_INT32:	putSigned( _body, value.get<co::int32>() ); break;
+		case co::TK_UINT8:	putVarint( _body, value.get<co::uint8>() ); break;
+		case co::TK_UINT16:	putVarint( _body, value.get<co::uint16>() ); break;
+		case co::TK_UINT32:	putVarint( _body, value.get<co::uint32>() ); break;
+		case co::TK_ENUM:	putVarint( _body, value.get<co::int32>() ); break;
+		case co::TK_STRING:	putString( _body, value.get<const std::string&>() ); break;
+		case co::TK_FLOAT:
+			{
+				float f = value.get<float>();
+				co::uint32 bits;
+				memcpy( &bits, &f, 4 );
+				putFixed( _body, bits, 4 );
+			}
+			break;
+		case co::TK_DOUBLE:
+			{
+				double d = value.get<double>();
+				co::uint64 bits;
+				memcpy( &bits, &d, 8 );
+				putFixed( _body, bits, 8 );
+			}
+			break;
+		case co::TK_INTERFACE:
+			writeRef( value.get<co::IService*>() );
+			break;
+		case co::TK_ARRAY:
+			{
+				co::IType* elementType = static_cast<co::IArray*>( type )->getElementType();
+				size_t count = value.getCount();
+				putVarint( _body, static_cast<co::uint32>( count ) );
+				for( size_t i = 0; i < count; ++i )
+					writeValue( value[i], elementType );
+			}
+			break;
+		case co::TK_STRUCT:
+		case co::TK_NATIVECLASS:
+			writeFields( value, _types[getTypeIndex( type )] );
+			break;
+		default:
+			CORAL_THROW( ca::ModelException, "cannot archive values of type '" << type->getFullName() << "'" );
+		}
+	}
+
+private:
+	typedef std::map<co::IType*, co::uint32> TypeMap;
+	typedef std::map<co::IObject*, co::uint32> IdMap;
+
+	ca::IModel* _model;
+
+	// the deque keeps references to entries valid as new types are found
+	std::deque<TypeEntry> _types;
+	TypeMap _typeMap;
+
+	std::vector<co::IObject*> _objects;	// indexed by id - 1
+	std::vector<co::uint32> _objectTypes;	// index of each object's component in _types
+	IdMap _ids;
+
+	std::string _schema;
+	std::string _body;
+};
+
+/******************************************************************************/
+/* Restore                                                                    */
+/******************************************************************************/
+
+/*
+	Restores an object graph from an (uncompressed) archive payload.
+ */
+class BinaryReader
+{
+public:
+	BinaryReader( const co::uint8* data, size_t size ) : _in( data, size )
+	{;}
+
+	co::IObject* read()
+	{
+		readSchema();
+
+		// create all objects beforehand, so references can be resolved as they are read
+		size_t count = _in.readVarint();
+		if( count == 0 || count > _in.getRemaining() )
+			throw ca::FormatException( "invalid number of objects in archive" );
+
+		_objects.resize( count );
+		_objectTypes.resize( count );
+		for( size_t i = 0; i < count; ++i )
+		{
+			const TypeEntry& entry = getEntry( _in.readVarint() );
+			if( entry.type->getKind() != co::TK_COMPONENT )
+				throw ca::FormatException( "invalid object type in archive" );
+			_objectTypes[i] = &entry;
+			_objects[i] = co::newInstance( entry.type->getFullName() );
+		}
+
+		for( size_t i = 0; i < count; ++i )
+			readObject( _objects[i].get(), *_objectTypes[i] );
+
+		if( _in.getRemaining() )
+			throw ca::FormatException( "unexpected data at the end of the archive" );
+
+		return _objects[0].get();
+	}
+
+private:
+	struct TypeEntry
+	{
+		co::IType* type;
+		std::vector<co::IPort*> ports;		// for components
+		std::vector<co::IField*> fields;	// for interfaces and value types
+	};
+
+	void readSchema()
+	{
+		size_t count = _in.readVarint();
+		if( count > _in.getRemaining() )
+			throw ca::FormatException( "invalid number of types in archive" );
+
+		_types.resize( count );
+
+		std::string name;
+		for( size_t i = 0; i < count; ++i )
+		{
+			TypeEntry& entry = _types[i];
+
+			_in.readString( name );
+			try
+			{
+				entry.type = co::getType( name );
+			}
+			catch( co::Exception& e )
+			{
+				CORAL_THROW( ca::FormatException, "unknown type '" << name << "' in archive: " << e.getMessage() );
+			}
+
+			co::TypeKind kind = entry.type->getKind();
+			if( kind != co::TK_COMPONENT && kind != co::TK_INTERFACE
+				&& kind != co::TK_STRUCT && kind != co::TK_NATIVECLASS )
+				CORAL_THROW( ca::FormatException, "unexpected type '" << name << "' in archive schema" );
+
+			co::ICompositeType* composite = static_cast<co::ICompositeType*>( entry.type );
+			size_t memberCount = _in.readVarint();
+			for( size_t k = 0; k < memberCount; ++k )
+			{
+				_in.readString( name );
+				co::IMember* member = composite->getMember( name );
+				co::MemberKind expected = ( kind == co::TK_COMPONENT ? co::MK_PORT : co::MK_FIELD );
+				if( !member || member->getKind() != expected )
+					CORAL_THROW( ca::FormatException, "no " << ( expected == co::MK_PORT ? "port" : "field" )
+						<< " '" << name << "' in type '" << entry.type->getFullName() << "'" );
+
+				if( expected == co::MK_PORT )
+					entry.ports.push_back( static_cast<co::IPort*>( member ) );
+				else
+					entry.fields.push_back( static_cast<co::IField*>( member ) );
+			}
+
+			_typeMap.insert( TypeMap::value_type( entry.type, &entry ) );
+		}
+	}
+
+	const TypeEntry& getEntry( size_t index )
+	{
+		if( index >= _types.size() )
+			throw ca::FormatException( "invalid type index in archive" );
+		return _types[index];
+	}
+
+	const TypeEntry& getEntry( co::IType* type )
+	{
+		TypeMap::iterator it = _typeMap.find( type );
+		if( it == _typeMap.end() )
+			CORAL_THROW( ca::FormatException, "type '" << type->getFullName() << "' is missing from the archive schema" );
+		return *it->second;
+	}
+
+	void readObject( co::IObject* object, const TypeEntry& entry )
+	{
+		for( size_t i = 0; i < entry.ports.size(); ++i )
+		{
+			co::IPort* port = entry.ports[i];
+			if( port->getIsFacet() )
+				readFields( object->getServiceAt( port ), getEntry( port->getType() ) );
+			else
+				object->setServiceAt( port, readRef() );
+		}
+	}
+
+	void readFields( const co::Any& instance, const TypeEntry& entry )
+	{
+		for( size_t i = 0; i < entry.fields.size(); ++i )
+			readField( instance, entry.fields[i] );
+	}
+
+	void readField( const co::Any& instance, co::IField* field )
+	{
+		co::IType* type = field->getType();
+		co::IReflector* reflector = field->getOwner()->getReflector();
+		co::TypeKind kind = type->getKind();
+
+		if( kind == co::TK_INTERFACE )
+		{
+			reflector->setField( instance, field, readRef() );
+		}
+		else if( kind == co::TK_ARRAY )
+		{
+			co::IType* elementType = static_cast<co::IArray*>( type )->getElementType();
+			size_t count = _in.readVarint();
+
+			// every element takes at least a byte, except for records without fields
+			if( count > _in.getRemaining() && !isRecord( elementType ) )
+				throw ca::FormatException( "invalid array size in archive" );
+
+			if( elementType->getKind() == co::TK_INTERFACE )
+			{
+				std::vector<co::IService*> refs( count );
+				for( size_t i = 0; i < count; ++i )
+					refs[i] = readRef();
+
+				// force a downcast of the IService[] to its real element type
+				reflector->setField( instance, field, co::Any( true, type, count ? &refs[0] : NULL, count ) );
+			}
+			else
+			{
+				ValueBuffer buffer( elementType, count );
+				for( size_t i = 0; i < count; ++i )
+					readValue( elementType, buffer.at( i ) );
+				reflector->setField( instance, field, co::Any( true, type, buffer.getData(), count ) );
+			}
+		}
+		else
+		{
+			ValueBuffer buffer( type, 1 );
+			readValue( type, buffer.at( 0 ) );
+			reflector->setField( instance, field, co::Any( true, type, buffer.at( 0 ) ) );
+		}
+	}
+
+	// Reads a non-array, non-interface value into the memory at 'ptr'.
+	void readValue( co::IType* type, void* ptr )
+	{
+		switch( type->getKind() )
+		{
+		case co::TK_BOOL:	*reinterpret_cast<bool*>( ptr ) = ( _in.readByte() != 0 ); break;
+		case co::TK_INT8:	*reinterpret_cast<co::int8*>( ptr ) = static_cast<co::int8>( _in.readSigned() ); break;
+		case co::TK_INT16:	*reinterpret_cast<co::int16*>( ptr ) = static_cast<co::int16>( _in.readSigned() ); break;
+		case co::TK_INT32:	*reinterpret_cast<co::int32*>( ptr ) = _in.readSigned(); break;
+		case co::TK_UINT8:	*reinterpret_cast<co::uint8*>( ptr ) = static_cast<co::uint8>( _in.readVarint() ); break;
+		case co::TK_UINT16:	*reinterpret_cast<co::uint16*>( ptr ) = static_cast<co::uint16>( _in.readVarint() ); break;
+		case co::TK_UINT32:	*reinterpret_cast<co::uint32*>( ptr ) = _in.readVarint(); break;
+		case co::TK_STRING:	_in.readString( *reinterpret_cast<std::string*>( ptr ) ); break;
+		case co::TK_ENUM:
+			{
+				co::uint32 value = _in.readVarint();
+				if( value >= static_cast<co::IEnum*>( type )->getIdentifiers().getSize() )
+					CORAL_THROW( ca::FormatException, "invalid value for enum '" << type->getFullName() << "' in archive" );
+				*reinterpret_cast<co::int32*>( ptr ) = static_cast<co::int32>( value );
+			}
+			break;
+		case co::TK_FLOAT:
+			{
+				co::uint32 bits = static_cast<co::uint32>( _in.readFixed( 4 ) );
+				memcpy( ptr, &bits, 4 );
+			}
+			break;
+		case co::TK_DOUBLE:
+			{
+				co::uint64 bits = _in.readFixed( 8 );
+				memcpy( ptr, &bits, 8 );
+			}
+			break;
+		case co::TK_STRUCT:
+		case co::TK_NATIVECLASS:
+			readFields( co::Any( false, type, ptr ), getEntry( type ) );
+			break;
+		default:
+			CORAL_THROW( ca::FormatException, "cannot restore values of type '" << type->getFullName() << "'" );
+		}
+	}
+
+	co::IService* readRef()
+	{
+		size_t id = _in.readVarint();
+		if( id == 0 )
+			return NULL;
+
+		if( id > _objects.size() )
+			throw ca::FormatException( "reference to a missing object in archive" );
+
+		size_t facet = _in.readVarint();
+		const std::vector<co::IPort*>& ports = _objectTypes[id - 1]->ports;
+		if( facet >= ports.size() || !ports[facet]->getIsFacet() )
+			throw ca::FormatException( "reference to a missing facet in archive" );
+
+		return _objects[id - 1]->getServiceAt( ports[facet] );
+	}
+
+	inline bool isRecord( co::IType* type )
+	{
+		co::TypeKind kind = type->getKind();
+		return kind == co::TK_STRUCT || kind == co::TK_NATIVECLASS;
+	}
+
+private:
+	typedef std::map<co::IType*, const TypeEntry*> TypeMap;
+
+	ByteReader _in;
+
+	std::vector<TypeEntry> _types;	// sized once, so the map's pointers stay valid
+	TypeMap _typeMap;
+
+	std::vector<co::IObjectRef> _objects;	// indexed by id - 1
+	std::vector<const TypeEntry*> _objectTypes;
+};
+
+/******************************************************************************/
+/* BinaryArchive                                                              */
+/******************************************************************************/
+
+class BinaryArchive : public BinaryArchive_Base
+{
+public:
+	BinaryArchive() : _compressed( false )
+	{
+		// empty
+	}
+
+	virtual ~BinaryArchive()
+	{
+		// empty
+	}
+
+	// ------ ca.IBinaryArchive Methods ------ //
+
+	bool getCompressed()
+	{
+		return _compressed;
+	}
+
+	void setCompressed( bool compressed )
+	{
+		_compressed = compressed;
+	}
+
+	// ------ ca.IArchive Methods ------ //
+
+	void save( co::IObject* rootObject )
+	{
+		checkConfig();
+
+		BinaryWriter writer( _model.get() );
+		writer.write( rootObject );
+
+		const std::string& schema = writer.getSchema();
+		const std::string& body = writer.getBody();
+
+		std::string header( MAGIC, sizeof(MAGIC) );
+		header.push_back( FORMAT_VERSION );
+		header.push_back( _compressed ? FLAG_COMPRESSED : 0 );
+		if( _compressed )
+			putVarint( header, static_cast<co::uint32>( schema.size() + body.size() ) );
+
+		FILE* file = fopen( _fileName.c_str(), "wb" );
+		if( !file )
+			CORAL_THROW( ca::IOException, "could not open file '" << _fileName << "' for writing" );
+
+		// the payload is written straight from the writer's buffers
+		bool failed = !writeData( file, header );
+		if( _compressed )
+			failed = failed || !writeBlocks( file, schema ) || !writeBlocks( file, body );
+		else
+			failed = failed || !writeData( file, schema ) || !writeData( file, body );
+
+		failed |= ( fclose( file ) != 0 );
+		if( failed )
+			CORAL_THROW( ca::IOException, "error writing file '" << _fileName << "'" );
+
+		_restoredObject = NULL;
+	}
+
+	co::IObject* restore()
+	{
+		checkConfig();
+
+		// the previously restored graph is released before reading a new one
+		_restoredObject = NULL;
+
+		MappedFile file( _fileName );
+
+		ByteReader header( file.getData(), file.getSize() );
+		if( file.getSize() < sizeof(MAGIC) + 2 || memcmp( header.skip( sizeof(MAGIC) ), MAGIC, sizeof(MAGIC) ) != 0 )
+			CORAL_THROW( ca::FormatException, "file '" << _fileName << "' is not a binary archive" );
+
+		if( header.readByte() != FORMAT_VERSION )
+			CORAL_THROW( ca::FormatException, "unsupported version of binary archive '" << _fileName << "'" );
+
+		co::uint8 flags = header.readByte();
+		if( !( flags & FLAG_COMPRESSED ) )
+		{
+			// uncompressed archives are read straight from the mapped file
+			BinaryReader reader( header.getPos(), header.getRemaining() );
+			_restoredObject = reader.read();
+			return _restoredObject.get();
+		}
+
+		// the stored size cannot be trusted: it is checked against the data actually
+		// present, and the payload only grows as each block is validated
+		size_t payloadSize = header.readVarint();
+		if( payloadSize / BlockCodec::MAX_EXPANSION > header.getRemaining() )
+			CORAL_THROW( ca::FormatException, "invalid payload size in binary archive '" << _fileName << "'" );
+
+		std::vector<co::uint8> payload;
+		while( payload.size() < payloadSize )
+		{
+			size_t rawSize = header.readVarint();
+			size_t storedSize = header.readVarint();
+			const co::uint8* block = header.skip( storedSize );
+
+			size_t offset = payload.size();
+			bool ok = ( rawSize > 0 && rawSize <= BLOCK_SIZE && rawSize <= payloadSize - offset );
+			if( ok )
+			{
+				payload.resize( offset + rawSize );
+				if( storedSize == rawSize )
+					memcpy( &payload[offset], block, rawSize );
+				else
+					ok = BlockCodec::decompress( block, storedSize, &payload[offset], rawSize );
+			}
+
+			if( !ok )
+				CORAL_THROW( ca::FormatException, "corrupted block in binary archive '" << _fileName << "'" );
+		}
+
+		BinaryReader reader( payload.empty() ? NULL : &payload[0], payload.size() );
+		_restoredObject = reader.read();
+		return _restoredObject.get();
+	}
+
+	// ------ ca.INamed Methods ------ //
+
+	std::string getName()
+	{
+		return _fileName;
+	}
+
+	void setName( const std::string& name )
+	{
+		_fileName = name;
+	}
+
+protected:
+	// ------ Receptacle 'model' (ca.IModel) ------ //
+
+	ca::IModel* getModelService()
+	{
+		return _model.get();
+	}
+
+	void setModelService( ca::IModel* model )
+	{
+		_model = model;
+	}
+
+private:
+	static bool writeData( FILE* file, const std::string& data )
+	{
+		return fwrite( data.data(), 1, data.size(), file ) == data.size();
+	}
+
+	// Writes \a data as a sequence of compressed blocks (see the archive layout).
+	static bool writeBlocks( FILE* file, const std::string& data )
+	{
+		std::string prefix;
+		std::string block;
+		const co::uint8* raw = reinterpret_cast<const co::uint8*>( data.data() );
+		for( size_t offset = 0; offset < data.size(); offset += BLOCK_SIZE )
+		{
+			size_t rawSize = std::min( BLOCK_SIZE, data.size() - offset );
+			block.clear();
+			BlockCodec::compress( raw + offset, rawSize, block );
+
+			// incompressible blocks are stored as they are
+			bool stored = ( block.size() >= rawSize );
+			size_t storedSize = ( stored ? rawSize : block.size() );
+
+			prefix.clear();
+			putVarint( prefix, static_cast<co::uint32>( rawSize ) );
+			putVarint( prefix, static_cast<co::uint32>( storedSize ) );
+			if( !writeData( file, prefix ) ||
+					fwrite( stored ? raw + offset : reinterpret_cast<const co::uint8*>( block.data() ),
+							1, storedSize, file ) != storedSize )
+				return false;
+		}
+		return true;
+	}
+
+	void checkConfig()
+	{
+		if( !_model.isValid() )
+			throw ca::ModelException( "the ca.BinaryArchive requires a model for this operation" );
+
+		if( _fileName.empty() )
+			throw ca::IOException( "the ca.BinaryArchive requires a file name for this operation" );
+	}
+
+private:
+	ca::IModelRef _model;
+	std::string _fileName;
+	bool _compressed;
+
+	/*
+		The restored root object is returned as a raw pointer, so the archive keeps the
+		last restored graph alive until the next save() or restore() (see ca.IArchive).
+	 */
+	co::IObjectRef _restoredObject;
+};
+
+CORAL_EXPORT_COMPONENT( BinaryArchive, BinaryArchive );
+
+} // namespace ca
@@ -0,0 +1,149 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#include "BlockCodec.h"
+#include <cstring>
+#include <vector>
+
+namespace ca {
+
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_OFFSET = 0xFFFF;
+static const int HASH_BITS = 12;
+
+inline co::uint32 read32( const co::uint8* p )
+{
+	co::uint32 v;
+	memcpy( &v, p, 4 );
+	return v;
+}
+
+inline co::uint32 hash( co::uint32 v )
+{
+	return ( v * 2654435761U ) >> ( 32 - HASH_BITS );
+}
+
+inline void writeLength( size_t length, std::string& out )
+{
+	for( ; length >= 255; length -= 255 )
+		out.push_back( static_cast<char>( 255 ) );
+	out.push_back( static_cast<char>( length ) );
+}
+
+static void writeSequence( const co::uint8* literals, size_t literalCount,
+							size_t offset, size_t matchLength, std::string& out )
+{
+	size_t extraMatch = matchLength ? matchLength - MIN_MATCH : 0;
+	co::uint8 token = static_cast<co::uint8>( ( literalCount < 15 ? literalCount : 15 ) << 4 );
+	token |= static_cast<co::uint8>( extraMatch < 15 ? extraMatch : 15 );
+	out.push_back( static_cast<char>( token ) );
+
+	if( literalCount >= 15 )
+		writeLength( literalCount - 15, out );
+	out.append( reinterpret_cast<const char*>( literals ), literalCount );
+
+	// the last sequence has no match
+	if( !matchLength )
+		return;
+
+	out.push_back( static_cast<char>( offset & 0xFF ) );
+	out.push_back( static_cast<char>( offset >> 8 ) );
+	if( extraMatch >= 15 )
+		writeLength( extraMatch - 15, out );
+}
+
+void BlockCodec::compress( const co::uint8* src, size_t size, std::string& out )
+{
+	std::vector<size_t> table( 1 << HASH_BITS, size );
+
+	size_t anchor = 0;
+	size_t pos = 0;
+	while( size >= MIN_MATCH && pos <= size - MIN_MATCH )
+	{
+		co::uint32 sequence = read32( src + pos );
+		size_t& entry = table[hash( sequence )];
+		size_t candidate = entry;
+		entry = pos;
+
+		if( candidate >= pos || pos - candidate > MAX_OFFSET || read32( src + candidate ) != sequence )
+		{
+			++pos;
+			continue;
+		}
+
+		size_t length = MIN_MATCH;
+		while( pos + length < size && src[candidate + length] == src[pos + length] )
+			++length;
+
+		writeSequence( src + anchor, pos - anchor, pos - candidate, length, out );
+		pos += length;
+		anchor = pos;
+	}
+
+	writeSequence( src + anchor, size - anchor, 0, 0, out );
+}
+
+inline bool readLength( const co::uint8*& p, const co::uint8* end, size_t& length )
+{
+	co::uint8 b;
+	do
+	{
+		if( p == end )
+			return false;
+		b = *p++;
+		length += b;
+	}
+	while( b == 255 );
+	return true;
+}
+
+bool BlockCodec::decompress( const co::uint8* src, size_t srcSize, co::uint8* dst, size_t dstSize )
+{
+	const co::uint8* p = src;
+	const co::uint8* end = src + srcSize;
+	co::uint8* out = dst;
+	co::uint8* outEnd = dst + dstSize;
+
+	while( p < end )
+	{
+		co::uint8 token = *p++;
+
+		size_t literalCount = token >> 4;
+		if( literalCount == 15 && !readLength( p, end, literalCount ) )
+			return false;
+		if( static_cast<size_t>( end - p ) < literalCount || static_cast<size_t>( outEnd - out ) < literalCount )
+			return false;
+		memcpy( out, p, literalCount );
+		p += literalCount;
+		out += literalCount;
+
+		// the last sequence has no match
+		if( p == end )
+			break;
+
+		if( end - p < 2 )
+			return false;
+		size_t offset = p[0] | ( p[1] << 8 );
+		p += 2;
+
+		size_t matchLength = token & 0x0F;
+		if( matchLength == 15 && !readLength( p, end, matchLength ) )
+			return false;
+		matchLength += MIN_MATCH;
+
+		if( offset == 0 || offset > static_cast<size_t>( out - dst ) || static_cast<size_t>( outEnd - out ) < matchLength )
+			return false;
+
+		// matches may overlap their own output, so copy byte by byte
+		const co::uint8* match = out - offset;
+		for( size_t i = 0; i < matchLength; ++i )
+			out[i] = match[i];
+		out += matchLength;
+	}
+
+	return out == outEnd;
+}
+
+} // namespace ca
@@ -0,0 +1,44 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#ifndef _CA_BLOCKCODEC_H_
+#define _CA_BLOCKCODEC_H_
+
+#include <co/Platform.h>
+#include <string>
+
+namespace ca {
+
+/*
+	A small LZ77 block codec in the style of LZ4: fast to decode, and good
+	enough on the repetitive data produced by archives.
+
+	A compressed block is a sequence of [token][literals][offset][match] where
+	the token's high nibble is the literal length and its low nibble is the match
+	length minus 4 (a nibble of 15 means more length bytes follow, LZ4-style).
+	The last sequence has only literals.
+ */
+class BlockCodec
+{
+public:
+	/*
+		Upper bound of the ratio between the decompressed and compressed sizes of a block
+		(a match costs at least one byte per 255 bytes it copies).
+	 */
+	static const size_t MAX_EXPANSION = 255;
+
+	// Compresses \a size bytes from \a src, appending them to \a out.
+	static void compress( const co::uint8* src, size_t size, std::string& out );
+
+	/*
+		Decompresses \a srcSize bytes from \a src into exactly \a dstSize bytes at \a dst.
+		Returns false if the data is corrupted.
+	 */
+	static bool decompress( const co::uint8* src, size_t srcSize, co::uint8* dst, size_t dstSize );
+};
+
+} // namespace ca
+
+#endif // _CA_BLOCKCODEC_H_
@@ -0,0 +1,812 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#include "MappedArchive_Base.h"
+#include "ArchiveIO.h"
+#include "StringSerializer.h"
+#include "../Model.h"
+
+#include <co/Coral.h>
+#include <co/IPort.h>
+#include <co/IArray.h>
+#include <co/IField.h>
+#include <co/IComponent.h>
+#include <co/IInterface.h>
+#include <co/IRecordType.h>
+#include <ca/IOException.h>
+#include <ca/ModelException.h>
+#include <ca/FormatException.h>
+
+#include <cstring>
+#include <map>
+#include <vector>
+
+/*
+	Mapped archive layout (in the writer's native byte order):
+
+		[MappedHeader]
+		[Schema]		// varint-encoded layout of each component (see writeSchema())
+		[MappedObject]	// component and block offset of each object, in id order
+		[Blocks]		// one 8-byte aligned block per object
+		[Pool]			// 8-byte aligned strings, arrays and reference lists
+
+	An object's block mirrors its ObjectRecord memory, starting at the facet
+	refs (see ComponentRecord::finalize()), so every receptacle and field is at
+	its PortRecord/FieldRecord offset minus LAYOUT_BASE. Values of flat types
+	(primitives, enums and structs of those) are stored as raw bytes; any other
+	slot holds a MappedSlot: an object id and facet index for references, or a
+	pool offset and size for ref-vecs, strings, flat arrays and values
+	serialized by the StringSerializer.
+ */
+
+namespace ca {
+
+static const char MAPPED_MAGIC[4] = { 'C', 'A', 'M', 'A' };
+static const co::uint16 MAPPED_VERSION = 1;
+static const co::uint32 BYTE_ORDER_MARK = 0x01020304;
+
+// where the memory that can be mapped starts within an ObjectRecord
+static const co::uint32 LAYOUT_BASE = sizeof(ObjectRecord) - sizeof(void*);
+
+struct MappedHeader
+{
+	char magic[4];
+	co::uint32 byteOrder;
+	co::uint16 version;
+	co::uint16 pointerSize;
+	co::uint32 numObjects;
+	co::uint32 schemaOffset;
+	co::uint32 schemaSize;
+	co::uint32 objectsOffset;
+	co::uint32 poolOffset;
+	co::uint32 poolSize;
+};
+
+struct MappedObject
+{
+	co::uint32 type;	// index of the component in the schema
+	co::uint32 offset;	// offset of the object's block in the file
+};
+
+// Stands for a reference, or a pool entry, within a block.
+struct MappedSlot
+{
+	co::uint32 first;	// object id (0 for null), or pool offset
+	co::uint32 second;	// facet index, or number of elements/bytes
+};
+
+enum ValueLayout
+{
+	VL_RAW,			// raw bytes in the block
+	VL_STRING,		// characters in the pool
+	VL_RAW_ARRAY,	// raw elements in the pool
+	VL_SERIALIZED	// StringSerializer string in the pool
+};
+
+// Whether values of a type can be copied as raw bytes.
+static bool isFlat( co::IType* type )
+{
+	switch( type->getKind() )
+	{
+	case co::TK_BOOL:
+	case co::TK_INT8:
+	case co::TK_INT16:
+	case co::TK_INT32:
+	case co::TK_UINT8:
+	case co::TK_UINT16:
+	case co::TK_UINT32:
+	case co::TK_FLOAT:
+	case co::TK_DOUBLE:
+	case co::TK_ENUM:
+		return true;
+	case co::TK_STRUCT:
+		{
+			co::TSlice<co::IField*> fields = static_cast<co::IRecordType*>( type )->getFields();
+			for( size_t i = 0; i < fields.getSize(); ++i )
+				if( !isFlat( fields[i]->getType() ) )
+					return false;
+			return true;
+		}
+	default:
+		return false;
+	}
+}
+
+static ValueLayout getValueLayout( co::IType* type )
+{
+	if( isFlat( type ) )
+		return VL_RAW;
+
+	co::TypeKind kind = type->getKind();
+	if( kind == co::TK_STRING )
+		return VL_STRING;
+
+	if( kind == co::TK_ARRAY && isFlat( static_cast<co::IArray*>( type )->getElementType() ) )
+		return VL_RAW_ARRAY;
+
+	return VL_SERIALIZED;
+}
+
+inline size_t align8( size_t offset )
+{
+	return ( offset + 7 ) & ~static_cast<size_t>( 7 );
+}
+
+/******************************************************************************/
+/* Save                                                                       */
+/******************************************************************************/
+
+class MappedWriter
+{
+public:
+	MappedWriter( Model* model, StringSerializer& serializer )
+		: _model( model ), _serializer( serializer )
+	{;}
+
+	void write( co::IObject* rootObject, std::string& out )
+	{
+		getId( rootObject );
+		for( size_t i = 0; i < _objects.size(); ++i )
+			writeObject( i );
+
+		MappedHeader header;
+		memset( &header, 0, sizeof(header) );
+		memcpy( header.magic, MAPPED_MAGIC, sizeof(MAPPED_MAGIC) );
+		header.byteOrder = BYTE_ORDER_MARK;
+		header.version = MAPPED_VERSION;
+		header.pointerSize = sizeof(void*);
+		header.numObjects = static_cast<co::uint32>( _objects.size() );
+
+		out.assign( sizeof(header), '\0' );
+
+		header.schemaOffset = static_cast<co::uint32>( out.size() );
+		writeSchema( out );
+		header.schemaSize = static_cast<co::uint32>( out.size() - header.schemaOffset );
+
+		out.resize( align8( out.size() ) );
+		header.objectsOffset = static_cast<co::uint32>( out.size() );
+
+		size_t blocksOffset = align8( out.size() + sizeof(MappedObject) * _objects.size() );
+		for( size_t i = 0; i < _objects.size(); ++i )
+		{
+			MappedObject mo;
+			mo.type = _objectTypes[i];
+			mo.offset = checkOffset( blocksOffset + _blockOffsets[i] );
+			out.append( reinterpret_cast<const char*>( &mo ), sizeof(mo) );
+		}
+
+		out.resize( blocksOffset );
+		out.append( _blocks );
+
+		out.resize( align8( out.size() ) );
+		header.poolOffset = checkOffset( out.size() );
+		header.poolSize = checkOffset( _pool.size() );
+		out.append( _pool );
+
+		memcpy( &out[0], &header, sizeof(header) );
+	}
+
+private:
+	co::uint32 getTypeIndex( ComponentRecord* rec )
+	{
+		TypeMap::iterator it = _typeMap.find( rec );
+		if( it != _typeMap.end() )
+			return it->second;
+
+		co::uint32 index = static_cast<co::uint32>( _types.size() );
+		_types.push_back( rec );
+		_typeMap.insert( TypeMap::value_type( rec, index ) );
+		return index;
+	}
+
+	co::uint32 getId( co::IObject* object )
+	{
+		IdMap::iterator it = _ids.find( object );
+		if( it != _ids.end() )
+			return it->second;
+
+		// raises a ModelException if the component is not in the model
+		ComponentRecord* rec = _model->getComponentRec( object->getComponent() );
+
+		_objects.push_back( object );
+		_objectTypes.push_back( getTypeIndex( rec ) );
+		co::uint32 id = static_cast<co::uint32>( _objects.size() );
+		_ids.insert( IdMap::value_type( object, id ) );
+		return id;
+	}
+
+	/*
+		Writes, for each component: its name, block size and number of ports;
+		then for each port its name and offset; and for facets (which come first)
+		the name, offset and size (for values) of each field.
+	 */
+	void writeSchema( std::string& out )
+	{
+		putVarint( out, static_cast<co::uint32>( _types.size() ) );
+		for( size_t i = 0; i < _types.size(); ++i )
+		{
+			ComponentRecord* rec = _types[i];
+			putString( out, rec->type->getFullName() );
+			putVarint( out, rec->objectSize - LAYOUT_BASE );
+			putVarint( out, rec->numPorts );
+			for( co::uint8 p = 0; p < rec->numPorts; ++p )
+			{
+				PortRecord& port = rec->ports[p];
+				putString( out, port.port->getName() );
+				putVarint( out, port.offset - LAYOUT_BASE );
+				if( p >= rec->numFacets )
+					continue;
+
+				InterfaceRecord* itf = port.typeRec;
+				putVarint( out, itf->numFields );
+				for( co::uint16 f = 0; f < itf->numFields; ++f )
+				{
+					FieldRecord& field = itf->fields[f];
+					putString( out, field.field->getName() );
+					putVarint( out, field.offset );
+					putVarint( out, f < itf->firstValue ? 0 : field.getSize() );
+				}
+			}
+		}
+	}
+
+	void writeObject( size_t index )
+	{
+		co::IObject* object = _objects[index];
+		ComponentRecord* rec = _types[_objectTypes[index]];
+
+		size_t blockOffset = _blocks.size();
+		_blockOffsets.push_back( blockOffset );
+		_blocks.resize( blockOffset + align8( rec->objectSize - LAYOUT_BASE ), '\0' );
+
+		// receptacles
+		for( co::uint8 p = rec->numFacets; p < rec->numPorts; ++p )
+		{
+			PortRecord& port = rec->ports[p];
+			setSlot( blockOffset + port.offset - LAYOUT_BASE, makeRef( object->getServiceAt( port.port ) ) );
+		}
+
+		// facet data blocks
+		for( co::uint8 p = 0; p < rec->numFacets; ++p )
+		{
+			PortRecord& port = rec->ports[p];
+			co::IService* service = object->getServiceAt( port.port );
+			size_t dataOffset = blockOffset + port.offset - LAYOUT_BASE;
+
+			InterfaceRecord* itf = port.typeRec;
+			for( co::uint16 f = 0; f < itf->numFields; ++f )
+			{
+				FieldRecord& field = itf->fields[f];
+				size_t offset = dataOffset + field.offset;
+				if( f < itf->numRefs )
+					writeRef( service, field, offset );
+				else if( f < itf->firstValue )
+					writeRefVec( service, field, offset );
+				else
+					writeValue( service, field, offset );
+			}
+		}
+	}
+
+	void writeRef( co::IService* service, FieldRecord& field, size_t offset )
+	{
+		co::IServiceRef value;
+		field.getOwnerReflector()->getField( service, field.field, value );
+		setSlot( offset, makeRef( value.get() ) );
+	}
+
+	void writeRefVec( co::IService* service, FieldRecord& field, size_t offset )
+	{
+		std::vector<co::IServiceRef> value;
+		field.getOwnerReflector()->getField( service, field.field, value );
+
+		size_t count = value.size();
+		size_t poolOffset = allocatePool( sizeof(MappedSlot) * count );
+		for( size_t i = 0; i < count; ++i )
+		{
+			MappedSlot ref = makeRef( value[i].get() );
+			memcpy( &_pool[poolOffset + sizeof(MappedSlot) * i], &ref, sizeof(ref) );
+		}
+
+		setPoolSlot( offset, poolOffset, count );
+	}
+
+	void writeValue( co::IService* service, FieldRecord& field, size_t offset )
+	{
+		co::IType* type = field.field->getType();
+		co::IReflector* reflector = field.getOwnerReflector();
+
+		switch( getValueLayout( type ) )
+		{
+		case VL_RAW:
+			{
+				// the value is read straight into the block
+				co::Any value( false, type, &_blocks[offset] );
+				reflector->getField( service, field.field, value );
+			}
+			break;
+		case VL_STRING:
+			{
+				reflector->getField( service, field.field, _str );
+				appendPool( offset, _str );
+			}
+			break;
+		case VL_RAW_ARRAY:
+			{
+				co::AnyValue value;
+				reflector->getField( service, field.field, value );
+				const co::Any& array = value.getAny();
+
+				co::IType* elementType = static_cast<co::IArray*>( type )->getElementType();
+				size_t elementSize = elementType->getReflector()->getSize();
+				size_t count = array.getCount();
+				size_t poolOffset = allocatePool( elementSize * count );
+				for( size_t i = 0; i < count; ++i )
+					co::Any( false, elementType, &_pool[poolOffset + elementSize * i] ).put( array[i] );
+
+				setPoolSlot( offset, poolOffset, count );
+			}
+			break;
+		case VL_SERIALIZED:
+			{
+				if( field.getSize() < sizeof(MappedSlot) )
+					CORAL_THROW( ca::ModelException, "field '" << field.field->getName()
+						<< "' of type '" << type->getFullName() << "' cannot be mapped" );
+
+				co::AnyValue value;
+				reflector->getField( service, field.field, value );
+				_serializer.toString( value.getAny(), _str );
+				appendPool( offset, _str );
+			}
+			break;
+		}
+	}
+
+	MappedSlot makeRef( co::IService* service )
+	{
+		MappedSlot ref = { 0, 0 };
+		if( !service )
+			return ref;
+
+		ref.first = getId( service->getProvider() );
+
+		// the facet is stored as its index among the component's facets
+		ComponentRecord* rec = _types[_objectTypes[ref.first - 1]];
+		co::IPort* facet = service->getFacet();
+		for( co::uint8 i = 0; i < rec->numFacets; ++i )
+		{
+			if( rec->ports[i].port == facet )
+			{
+				ref.second = i;
+				return ref;
+			}
+		}
+
+		CORAL_THROW( ca::ModelException, "facet '" << facet->getName() << "' of component '"
+			<< rec->type->getFullName() << "' is not in the object model" );
+	}
+
+	inline void setSlot( size_t offset, const MappedSlot& slot )
+	{
+		memcpy( &_blocks[offset], &slot, sizeof(slot) );
+	}
+
+	inline void setPoolSlot( size_t offset, size_t poolOffset, size_t size )
+	{
+		MappedSlot slot = { checkOffset( poolOffset ), checkOffset( size ) };
+		setSlot( offset, slot );
+	}
+
+	// Reserves 8-byte aligned space in the pool, returning its offset.
+	size_t allocatePool( size_t size )
+	{
+		size_t offset = align8( _pool.size() );
+		_pool.resize( offset + size, '\0' );
+		return offset;
+	}
+
+	void appendPool( size_t slotOffset, const std::string& data )
+	{
+		size_t poolOffset = allocatePool( data.size() );
+		if( !data.empty() )
+			memcpy( &_pool[poolOffset], data.data(), data.size() );
+		setPoolSlot( slotOffset, poolOffset, data.size() );
+	}
+
+	co::uint32 checkOffset( size_t offset )
+	{
+		if( offset > 0xFFFFFFFFU )
+			throw ca::IOException( "object graph is too large for a mapped archive" );
+		return static_cast<co::uint32>( offset );
+	}
+
+private:
+	typedef std::map<ComponentRecord*, co::uint32> TypeMap;
+	typedef std::map<co::IObject*, co::uint32> IdMap;
+
+	Model* _model;
+	StringSerializer& _serializer;
+
+	std::vector<ComponentRecord*> _types;
+	TypeMap _typeMap;
+
+	std::vector<co::IObject*> _objects;		// indexed by id - 1
+	std::vector<co::uint32> _objectTypes;	// index of each object's component in _types
+	std::vector<size_t> _blockOffsets;		// offset of each object's block in _blocks
+	IdMap _ids;
+
+	std::string _blocks;
+	std::string _pool;
+	std::string _str;
+};
+
+/******************************************************************************/
+/* Restore                                                                    */
+/******************************************************************************/
+
+class MappedReader
+{
+public:
+	MappedReader( Model* model, StringSerializer& serializer, const co::uint8* data, size_t size )
+		: _model( model ), _serializer( serializer ), _data( data ), _size( size )
+	{;}
+
+	co::IObject* read()
+	{
+		MappedHeader header;
+		if( _size < sizeof(header) )
+			throw ca::FormatException( "not a mapped archive" );
+		memcpy( &header, _data, sizeof(header) );
+
+		if( memcmp( header.magic, MAPPED_MAGIC, sizeof(MAPPED_MAGIC) ) != 0 )
+			throw ca::FormatException( "not a mapped archive" );
+
+		if( header.byteOrder != BYTE_ORDER_MARK || header.version != MAPPED_VERSION
+			|| header.pointerSize != sizeof(void*) )
+			throw ca::FormatException( "mapped archive was saved in an incompatible version or platform" );
+
+		checkRange( header.schemaOffset, header.schemaSize );
+		checkRange( header.objectsOffset, sizeof(MappedObject) * static_cast<size_t>( header.numObjects ) );
+		checkRange( header.poolOffset, header.poolSize );
+		if( header.numObjects == 0 || header.poolOffset % 8 )
+			throw ca::FormatException( "corrupted mapped archive" );
+
+		_pool = _data + header.poolOffset;
+		_poolSize = header.poolSize;
+
+		readSchema( _data + header.schemaOffset, header.schemaSize );
+
+		// create all objects beforehand, so references can be resolved as they are read
+		size_t count = header.numObjects;
+		_objects.resize( count );
+		_objectTypes.resize( count );
+		_blocks.resize( count );
+
+		const co::uint8* table = _data + header.objectsOffset;
+		for( size_t i = 0; i < count; ++i )
+		{
+			MappedObject mo;
+			memcpy( &mo, table + sizeof(MappedObject) * i, sizeof(mo) );
+			if( mo.type >= _types.size() || mo.offset % 8 )
+				throw ca::FormatException( "corrupted mapped archive" );
+
+			ComponentRecord* rec = _types[mo.type];
+			checkRange( mo.offset, rec->objectSize - LAYOUT_BASE );
+
+			_objectTypes[i] = rec;
+			_blocks[i] = _data + mo.offset;
+			_objects[i] = co::newInstance( rec->type->getFullName() );
+		}
+
+		for( size_t i = 0; i < count; ++i )
+			readObject( i );
+
+		return _objects[0].get();
+	}
+
+private:
+	void readSchema( const co::uint8* data, size_t size )
+	{
+		ByteReader in( data, size );
+
+		size_t numTypes = in.readVarint();
+		if( numTypes > size )
+			throw ca::FormatException( "corrupted mapped archive" );
+
+		std::string name;
+		for( size_t i = 0; i < numTypes; ++i )
+		{
+			in.readString( name );
+
+			co::IType* type;
+			try
+			{
+				type = co::getType( name );
+			}
+			catch( co::Exception& e )
+			{
+				CORAL_THROW( ca::FormatException, "unknown type '" << name << "' in archive: " << e.getMessage() );
+			}
+
+			if( type->getKind() != co::TK_COMPONENT )
+				CORAL_THROW( ca::FormatException, "unexpected type '" << name << "' in archive schema" );
+
+			ComponentRecord* rec = _model->getComponentRec( static_cast<co::IComponent*>( type ) );
+			_types.push_back( rec );
+
+			// the layout must match the model's, field by field
+			bool matches = ( in.readVarint() == rec->objectSize - LAYOUT_BASE && in.readVarint() == rec->numPorts );
+			for( co::uint8 p = 0; matches && p < rec->numPorts; ++p )
+			{
+				PortRecord& port = rec->ports[p];
+				in.readString( name );
+				matches = ( name == port.port->getName() && in.readVarint() == port.offset - LAYOUT_BASE );
+				if( !matches || p >= rec->numFacets )
+					continue;
+
+				InterfaceRecord* itf = port.typeRec;
+				matches = ( in.readVarint() == itf->numFields );
+				for( co::uint16 f = 0; matches && f < itf->numFields; ++f )
+				{
+					FieldRecord& field = itf->fields[f];
+					in.readString( name );
+					co::uint32 offset = in.readVarint();
+					co::uint32 size = in.readVarint();
+					matches = ( name == field.field->getName() && offset == field.offset
+						&& size == ( f < itf->firstValue ? 0 : field.getSize() ) );
+				}
+			}
+
+			if( !matches )
+				CORAL_THROW( ca::FormatException, "the layout of '" << rec->type->getFullName() << "' in the mapped archive "
+					"does not match the current model; the archive must be saved again" );
+		}
+	}
+
+	void readObject( size_t index )
+	{
+		co::IObject* object = _objects[index].get();
+		ComponentRecord* rec = _objectTypes[index];
+		const co::uint8* block = _blocks[index];
+
+		// receptacles
+		for( co::uint8 p = rec->numFacets; p < rec->numPorts; ++p )
+		{
+			PortRecord& port = rec->ports[p];
+			object->setServiceAt( port.port, resolveRef( getSlot( block + port.offset - LAYOUT_BASE ) ) );
+		}
+
+		// facet data blocks
+		for( co::uint8 p = 0; p < rec->numFacets; ++p )
+		{
+			PortRecord& port = rec->ports[p];
+			co::IService* service = object->getServiceAt( port.port );
+			const co::uint8* data = block + port.offset - LAYOUT_BASE;
+
+			InterfaceRecord* itf = port.typeRec;
+			for( co::uint16 f = 0; f < itf->numFields; ++f )
+			{
+				FieldRecord& field = itf->fields[f];
+				const co::uint8* ptr = data + field.offset;
+				if( f < itf->numRefs )
+					readRef( service, field, ptr );
+				else if( f < itf->firstValue )
+					readRefVec( service, field, ptr );
+				else
+					readValue( service, field, ptr );
+			}
+		}
+	}
+
+	void readRef( co::IService* service, FieldRecord& field, const co::uint8* ptr )
+	{
+		field.getOwnerReflector()->setField( service, field.field, resolveRef( getSlot( ptr ) ) );
+	}
+
+	void readRefVec( co::IService* service, FieldRecord& field, const co::uint8* ptr )
+	{
+		MappedSlot slot = getSlot( ptr );
+		const co::uint8* refs = getPool( slot.first, sizeof(MappedSlot) * static_cast<size_t>( slot.second ) );
+
+		size_t count = slot.second;
+		std::vector<co::IService*> services( count );
+		for( size_t i = 0; i < count; ++i )
+			services[i] = resolveRef( getSlot( refs + sizeof(MappedSlot) * i ) );
+
+		// force a downcast of the IService[] to its real element type
+		field.getOwnerReflector()->setField( service, field.field,
+			co::Any( true, field.field->getType(), count ? &services[0] : NULL, count ) );
+	}
+
+	void readValue( co::IService* service, FieldRecord& field, const co::uint8* ptr )
+	{
+		co::IType* type = field.field->getType();
+		co::IReflector* reflector = field.getOwnerReflector();
+
+		switch( getValueLayout( type ) )
+		{
+		case VL_RAW:
+			// the value is passed straight from the mapped block
+			reflector->setField( service, field.field, co::Any( true, type, ptr ) );
+			break;
+		case VL_STRING:
+			{
+				MappedSlot slot = getSlot( ptr );
+				_str.assign( reinterpret_cast<const char*>( getPool( slot.first, slot.second ) ), slot.second );
+				reflector->setField( service, field.field, _str );
+			}
+			break;
+		case VL_RAW_ARRAY:
+			{
+				// the elements are passed straight from the mapped pool
+				MappedSlot slot = getSlot( ptr );
+				co::IType* elementType = static_cast<co::IArray*>( type )->getElementType();
+				size_t count = slot.second;
+				const co::uint8* elements = getPool( slot.first, elementType->getReflector()->getSize() * count );
+				reflector->setField( service, field.field, co::Any( true, type, count ? elements : NULL, count ) );
+			}
+			break;
+		case VL_SERIALIZED:
+			{
+				MappedSlot slot = getSlot( ptr );
+				_str.assign( reinterpret_cast<const char*>( getPool( slot.first, slot.second ) ), slot.second );
+				_serializer.fromString( _str, service, field.field );
+			}
+			break;
+		}
+	}
+
+	co::IService* resolveRef( const MappedSlot& ref )
+	{
+		if( ref.first == 0 )
+			return NULL;
+
+		if( ref.first > _objects.size() || ref.second >= _objectTypes[ref.first - 1]->numFacets )
+			throw ca::FormatException( "reference to a missing object in mapped archive" );
+
+		return _objects[ref.first - 1]->getServiceAt( _objectTypes[ref.first - 1]->ports[ref.second].port );
+	}
+
+	inline MappedSlot getSlot( const co::uint8* ptr )
+	{
+		MappedSlot slot;
+		memcpy( &slot, ptr, sizeof(slot) );
+		return slot;
+	}
+
+	const co::uint8* getPool( size_t offset, size_t size )
+	{
+		if( offset > _poolSize || size > _poolSize - offset )
+			throw ca::FormatException( "corrupted mapped archive" );
+		return _pool + offset;
+	}
+
+	void checkRange( size_t offset, size_t size )
+	{
+		if( offset > _size || size > _size - offset )
+			throw ca::FormatException( "corrupted mapped archive" );
+	}
+
+private:
+	Model* _model;
+	StringSerializer& _serializer;
+
+	const co::uint8* _data;
+	size_t _size;
+	const co::uint8* _pool;
+	size_t _poolSize;
+
+	std::vector<ComponentRecord*> _types;
+
+	std::vector<co::IObjectRef> _objects;		// indexed by id - 1
+	std::vector<ComponentRecord*> _objectTypes;
+	std::vector<const co::uint8*> _blocks;
+
+	std::string _str;
+};
+
+/******************************************************************************/
+/* MappedArchive                                                              */
+/******************************************************************************/
+
+class MappedArchive : public MappedArchive_Base
+{
+public:
+	MappedArchive()
+	{
+		// empty
+	}
+
+	virtual ~MappedArchive()
+	{
+		// empty
+	}
+
+	// ------ ca.IArchive Methods ------ //
+
+	void save( co::IObject* rootObject )
+	{
+		checkConfig();
+
+		std::string data;
+		MappedWriter writer( static_cast<Model*>( _model.get() ), _serializer );
+		writer.write( rootObject, data );
+
+		FILE* file = fopen( _fileName.c_str(), "wb" );
+		if( !file )
+			CORAL_THROW( ca::IOException, "could not open file '" << _fileName << "' for writing" );
+
+		bool failed = ( fwrite( data.data(), 1, data.size(), file ) != data.size() );
+		failed |= ( fclose( file ) != 0 );
+		if( failed )
+			CORAL_THROW( ca::IOException, "error writing file '" << _fileName << "'" );
+
+		_restoredObject = NULL;
+	}
+
+	co::IObject* restore()
+	{
+		checkConfig();
+
+		// the previously restored graph is released before reading a new one
+		_restoredObject = NULL;
+
+		MappedFile file( _fileName );
+		MappedReader reader( static_cast<Model*>( _model.get() ), _serializer, file.getData(), file.getSize() );
+		_restoredObject = reader.read();
+		return _restoredObject.get();
+	}
+
+	// ------ ca.INamed Methods ------ //
+
+	std::string getName()
+	{
+		return _fileName;
+	}
+
+	void setName( const std::string& name )
+	{
+		_fileName = name;
+	}
+
+protected:
+	// ------ Receptacle 'model' (ca.IModel) ------ //
+
+	ca::IModel* getModelService()
+	{
+		return _model.get();
+	}
+
+	void setModelService( ca::IModel* model )
+	{
+		_model = model;
+		_serializer.setModel( model );
+	}
+
+private:
+	void checkConfig()
+	{
+		if( !_model.isValid() )
+			throw ca::ModelException( "the ca.MappedArchive requires a model for this operation" );
+
+		if( _fileName.empty() )
+			throw ca::IOException( "the ca.MappedArchive requires a file name for this operation" );
+	}
+
+private:
+	ca::IModelRef _model;
+	std::string _fileName;
+	StringSerializer _serializer;
+
+	/*
+		The restored root object is returned as a raw pointer, so the archive keeps the
+		last restored graph alive until the next save() or restore() (see ca.IArchive).
+	 */
+	co::IObjectRef _restoredObject;
+};
+
+CORAL_EXPORT_COMPONENT( MappedArchive, MappedArchive );
+
+} // namespace ca
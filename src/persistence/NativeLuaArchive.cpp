@@ -0,0 +1,1175 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#include "NativeLuaArchive_Base.h"
+#include "ValueBuffer.h"
+
+#include <co/Coral.h>
+#include <co/IEnum.h>
+#include <co/IPort.h>
+#include <co/IArray.h>
+#include <co/IField.h>
+#include <co/IComponent.h>
+#include <co/IInterface.h>
+#include <co/IRecordType.h>
+#include <ca/IModel.h>
+#include <ca/IOException.h>
+#include <ca/ModelException.h>
+#include <ca/FormatException.h>
+
+#include <cassert>
+#include <cctype>
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <vector>
+
+namespace ca {
+
+/*
+	Sets the "C" locale while alive, as ca.LuaArchive does while saving,
+	so numbers and dates are not localized.
+ */
+class CLocaleScope
+{
+public:
+	CLocaleScope()
+	{
+		const char* original = setlocale( LC_ALL, NULL );
+		if( original )
+			_original = original;
+		setlocale( LC_ALL, "C" );
+	}
+
+	~CLocaleScope()
+	{
+		if( !_original.empty() )
+			setlocale( LC_ALL, _original.c_str() );
+	}
+
+private:
+	std::string _original;
+};
+
+/******************************************************************************/
+/* Save                                                                       */
+/******************************************************************************/
+
+/*
+	Writes an object graph in the format of ca.LuaArchive, byte by byte.
+	Output is accumulated in a buffer that is flushed to the file in large blocks.
+ */
+class ArchiveWriter
+{
+public:
+	ArchiveWriter( ca::IModel* model, FILE* file ) : _model( model ), _file( file )
+	{
+		_buffer.reserve( BUFFER_SIZE );
+	}
+
+	void write( co::IObject* rootObject )
+	{
+		char date[64];
+		time_t now = time( NULL );
+		strftime( date, sizeof(date), "%a %b %d %H:%M:%S %Y", localtime( &now ) );
+
+		put( "--------------------------------------------------------------------------------\n"
+			"-- Lua Archive File\n"
+			"-- Saved on " );
+		put( date );
+		put( ".\n"
+			"--------------------------------------------------------------------------------\n"
+			"\n"
+			"-- Metadata\n"
+			"format_version = 1\n"
+			"\n"
+			"-- Archived Objects\n" );
+
+		// objects are numbered as they are first referenced, and written in that order
+		getId( rootObject );
+		for( size_t i = 0; i < _objects.size(); ++i )
+			writeObject( _objects[i], i + 1 );
+
+		flush();
+	}
+
+private:
+	co::uint32 getId( co::IObject* object )
+	{
+		IdMap::iterator it = _ids.find( object );
+		if( it != _ids.end() )
+			return it->second;
+
+		_objects.push_back( object );
+		co::uint32 id = static_cast<co::uint32>( _objects.size() );
+		_ids.insert( IdMap::value_type( object, id ) );
+		return id;
+	}
+
+	void writeObject( co::IObject* object, size_t id )
+	{
+		co::IComponent* component = object->getComponent();
+
+		std::vector<co::IPortRef> ports;
+		_model->getPorts( component, ports );
+
+		put( "\nobjects[" );
+		putNumber( static_cast<double>( id ) );
+		put( "] = Object \"" );
+		put( component->getFullName() );
+		put( "\" {\n" );
+
+		for( size_t i = 0; i < ports.size(); ++i )
+		{
+			co::IPort* port = ports[i].get();
+			put( '\t' );
+			put( port->getName() );
+			put( " = " );
+			if( port->getIsFacet() )
+				writeService( object->getServiceAt( port ), port );
+			else
+				writeRef( object->getServiceAt( port ) );
+			put( ",\n" );
+		}
+
+		put( "}\n" );
+	}
+
+	void writeService( co::IService* service, co::IPort* port )
+	{
+		co::IInterface* type = port->getType();
+
+		std::vector<co::IFieldRef> fields;
+		_model->getFields( type, fields );
+
+		put( "Service \"" );
+		put( type->getFullName() );
+		put( "\" {\n" );
+
+		for( size_t i = 0; i < fields.size(); ++i )
+			writeField( service, fields[i].get(), 1 );
+
+		put( "\t}" );
+	}
+
+	void writeRef( co::IService* service )
+	{
+		if( !service )
+		{
+			put( "nil" );
+			return;
+		}
+
+		put( "Ref{ id = " );
+		putNumber( getId( service->getProvider() ) );
+		put( ", facet = '" );
+		put( service->getFacet()->getName() );
+		put( "' }" );
+	}
+
+	void writeField( const co::Any& instance, co::IField* field, int level )
+	{
+		++level;
+		std::string indent( level, '\t' );
+
+		co::AnyValue value;
+		field->getOwner()->getReflector()->getField( instance, field, value );
+
+		put( indent );
+		put( field->getName() );
+		put( " = " );
+
+		co::IType* type = field->getType();
+		co::TypeKind kind = type->getKind();
+		if( kind == co::TK_INTERFACE )
+			writeRef( value.get<co::IService*>() );
+		else if( kind == co::TK_ARRAY )
+			writeArray( value.getAny(), static_cast<co::IArray*>( type )->getElementType(), level, indent );
+		else
+			writeValue( value.getAny(), type, level, indent );
+
+		put( ",\n" );
+	}
+
+	void writeValue( const co::Any& value, co::IType* type, int level, const std::string& indent )
+	{
+		co::TypeKind kind = type->getKind();
+		switch( kind )
+		{
+		case co::TK_BOOL:	put( value.get<bool>() ? "true" : "false" ); break;
+		case co::TK_INT8:	putNumber( value.get<co::int8>() ); break;
+		case co::TK_INT16:	putNumber( value.get<co::int16>() ); break;
+		case co::TK_INT32:	putNumber( value.get<co::int32>() ); break;
+		case co::TK_UINT8:	putNumber( value.get<co::uint8>() ); break;
+		case co::TK_UINT16:	putNumber( value.get<co::uint16>() ); break;
+		case co::TK_UINT32:	putNumber( value.get<co::uint32>() ); break;
+		case co::TK_FLOAT:	putNumber( value.get<float>() ); break;
+		case co::TK_DOUBLE:	putNumber( value.get<double>() ); break;
+		case co::TK_STRING:	putQuoted( value.get<const std::string&>() ); break;
+		case co::TK_ENUM:
+			// enums are strings in Lua
+			putQuoted( static_cast<co::IEnum*>( type )->getIdentifiers()[value.get<co::int32>()] );
+			break;
+		case co::TK_STRUCT:
+		case co::TK_NATIVECLASS:
+			{
+				std::vector<co::IFieldRef> fields;
+				_model->getFields( static_cast<co::IRecordType*>( type ), fields );
+
+				put( "Value \"" );
+				put( type->getFullName() );
+				put( "\" {\n" );
+				for( size_t i = 0; i < fields.size(); ++i )
+					writeField( value, fields[i].get(), level );
+				put( indent );
+				put( '}' );
+			}
+			break;
+		default:
+			CORAL_THROW( ca::ModelException, "cannot archive values of type '" << type->getFullName() << "'" );
+		}
+	}
+
+	void writeArray( const co::Any& array, co::IType* elementType, int level, const std::string& indent )
+	{
+		put( "ArrayOf \"" );
+		put( elementType->getFullName() );
+		put( "\" {\n" );
+
+		bool isRef = ( elementType->getKind() == co::TK_INTERFACE );
+		size_t count = array.getCount();
+		for( size_t i = 0; i < count; ++i )
+		{
+			put( indent );
+			put( '\t' );
+			if( isRef )
+				writeRef( array[i].get<co::IService*>() );
+			else
+				writeValue( array[i], elementType, level, indent );
+			put( ",\n" );
+		}
+
+		put( indent );
+		put( '}' );
+	}
+
+	// Same output as Lua's tostring() for numbers.
+	void putNumber( double value )
+	{
+		// NaNs are written as zeros, as they could not be read back
+		if( value != value )
+			value = 0;
+
+		char str[32];
+		sprintf( str, "%.14g", value );
+		put( str );
+	}
+
+	// Same output as Lua 5.2's string.format( "%q" ).
+	void putQuoted( const std::string& str )
+	{
+		put( '"' );
+		size_t size = str.size();
+		for( size_t i = 0; i < size; ++i )
+		{
+			unsigned char c = static_cast<unsigned char>( str[i] );
+			if( c == '"' || c == '\\' || c == '\n' )
+			{
+				put( '\\' );
+				put( static_cast<char>( c ) );
+			}
+			else if( c < 0x20 || c == 0x7F )
+			{
+				bool digitFollows = ( i + 1 < size && str[i + 1] >= '0' && str[i + 1] <= '9' );
+				char code[8];
+				sprintf( code, digitFollows ? "\\%03d" : "\\%d", c );
+				put( code );
+			}
+			else
+			{
+				put( static_cast<char>( c ) );
+			}
+		}
+		put( '"' );
+	}
+
+	inline void put( char c )
+	{
+		_buffer.push_back( c );
+	}
+
+	inline void put( const char* str )
+	{
+		_buffer.append( str );
+		if( _buffer.size() >= BUFFER_SIZE )
+			flush();
+	}
+
+	inline void put( const std::string& str )
+	{
+		_buffer.append( str );
+		if( _buffer.size() >= BUFFER_SIZE )
+			flush();
+	}
+
+	void flush()
+	{
+		if( !_buffer.empty() && fwrite( _buffer.data(), 1, _buffer.size(), _file ) != _buffer.size() )
+			throw ca::IOException( "error writing the archive file" );
+		_buffer.clear();
+	}
+
+private:
+	static const size_t BUFFER_SIZE = 64 * 1024;
+
+	typedef std::map<co::IObject*, co::uint32> IdMap;
+
+	ca::IModel* _model;
+	FILE* _file;
+	std::string _buffer;
+
+	std::vector<co::IObject*> _objects;
+	IdMap _ids;
+};
+
+/******************************************************************************/
+/* Restore                                                                    */
+/******************************************************************************/
+
+/*
+	Splits an archive file into Lua tokens, reading it in blocks.
+ */
+class ArchiveTokenizer
+{
+public:
+	enum Token
+	{
+		T_EOF,
+		T_NAME,
+		T_NUMBER,
+		T_STRING,
+		T_SYMBOL	// a single punctuation character
+	};
+
+	ArchiveTokenizer( FILE* file, const std::string& fileName )
+		: _file( file ), _fileName( fileName ), _buffer( BUFFER_SIZE ), _pos( NULL ), _end( NULL ),
+		_line( 1 ), _minus( false )
+	{
+		next();
+	}
+
+	// current token
+	inline Token getToken() const { return _token; }
+	inline const std::string& getText() const { return _text; }
+	inline double getNumber() const { return _number; }
+	inline char getSymbol() const { return _text[0]; }
+
+	inline bool isSymbol( char c ) const { return _token == T_SYMBOL && _text[0] == c; }
+	inline bool isName( const char* name ) const { return _token == T_NAME && _text == name; }
+
+	// Moves to the next token.
+	void next()
+	{
+		skipSpacesAndComments();
+
+		int c = peek();
+		if( _minus )
+		{
+			_minus = false;
+			_token = T_SYMBOL;
+			_text.assign( 1, '-' );
+		}
+		else if( c == EOF )
+		{
+			_token = T_EOF;
+			_text.clear();
+		}
+		else if( isalpha( c ) || c == '_' )
+		{
+			_token = T_NAME;
+			_text.clear();
+			while( ( c = peek() ) != EOF && ( isalnum( c ) || c == '_' ) )
+				_text.push_back( static_cast<char>( get() ) );
+		}
+		else if( isdigit( c ) || c == '.' )
+		{
+			readNumber();
+		}
+		else if( c == '"' || c == '\'' )
+		{
+			readString( get() );
+		}
+		else
+		{
+			_token = T_SYMBOL;
+			_text.assign( 1, static_cast<char>( get() ) );
+		}
+	}
+
+	void expectSymbol( char c )
+	{
+		if( !isSymbol( c ) )
+			raise( std::string( "'" ) + c + "' expected" );
+		next();
+	}
+
+	void expectName( const char* name )
+	{
+		if( !isName( name ) )
+			raise( std::string( "'" ) + name + "' expected" );
+		next();
+	}
+
+	void expect( Token token, const char* what )
+	{
+		if( _token != token )
+			raise( std::string( what ) + " expected" );
+	}
+
+	void raise( const std::string& msg )
+	{
+		CORAL_THROW( ca::FormatException, "error in archive '" << _fileName << "' at line "
+			<< _line << ": " << msg << ( _token == T_EOF ? " near end of file" : " near '" + _text + "'" ) );
+	}
+
+private:
+	inline int peek()
+	{
+		if( _pos == _end && !fill() )
+			return EOF;
+		return static_cast<unsigned char>( *_pos );
+	}
+
+	inline int get()
+	{
+		int c = peek();
+		if( c != EOF )
+		{
+			++_pos;
+			if( c == '\n' )
+				++_line;
+		}
+		return c;
+	}
+
+	bool fill()
+	{
+		size_t count = fread( &_buffer[0], 1, BUFFER_SIZE, _file );
+		if( count == 0 && ferror( _file ) )
+			throw ca::IOException( "error reading archive '" + _fileName + "'" );
+		_pos = &_buffer[0];
+		_end = _pos + count;
+		return count > 0;
+	}
+
+	void skipSpacesAndComments()
+	{
+		for( ;; )
+		{
+			int c = peek();
+			if( c == ' ' || c == '\t' || c == '\r' || c == '\n' )
+			{
+				get();
+			}
+			else if( c == '-' )
+			{
+				// is it a comment? (a single '-' is a symbol)
+				get();
+				if( peek() != '-' )
+				{
+					_minus = true;
+					return;
+				}
+				while( ( c = get() ) != EOF && c != '\n' )
+					;
+			}
+			else
+			{
+				return;
+			}
+		}
+	}
+
+	void readNumber()
+	{
+		_text.clear();
+		int c;
+		while( ( c = peek() ) != EOF && ( isalnum( c ) || c == '.' ||
+				( ( c == '+' || c == '-' ) && !_text.empty() && ( *_text.rbegin() == 'e' || *_text.rbegin() == 'E' ) ) ) )
+			_text.push_back( static_cast<char>( get() ) );
+
+		char* end;
+		_number = strtod( _text.c_str(), &end );
+		if( *end != '\0' )
+			raise( "malformed number" );
+		_token = T_NUMBER;
+	}
+
+	void readString( int quote )
+	{
+		_token = T_STRING;
+		_text.clear();
+		for( ;; )
+		{
+			int c = get();
+			if( c == EOF || c == '\n' )
+				raise( "unfinished string" );
+			if( c == quote )
+				break;
+			if( c != '\\' )
+			{
+				_text.push_back( static_cast<char>( c ) );
+				continue;
+			}
+
+			c = get();
+			switch( c )
+			{
+			case 'a': _text.push_back( '\a' ); break;
+			case 'b': _text.push_back( '\b' ); break;
+			case 'f': _text.push_back( '\f' ); break;
+			case 'n': _text.push_back( '\n' ); break;
+			case 'r': _text.push_back( '\r' ); break;
+			case 't': _text.push_back( '\t' ); break;
+			case 'v': _text.push_back( '\v' ); break;
+			case '\r':
+				if( peek() == '\n' )
+					get();
+				_text.push_back( '\n' );
+				break;
+			default:
+				if( isdigit( c ) )
+				{
+					// up to three decimal digits
+					int code = c - '0';
+					for( int i = 0; i < 2 && isdigit( peek() ); ++i )
+						code = code * 10 + ( get() - '0' );
+					if( code > 255 )
+						raise( "escape sequence too large" );
+					_text.push_back( static_cast<char>( code ) );
+				}
+				else if( c == EOF )
+				{
+					raise( "unfinished string" );
+				}
+				else
+				{
+					// '\\', '"', '\'' and '\n'
+					_text.push_back( static_cast<char>( c ) );
+				}
+			}
+		}
+	}
+
+private:
+	static const size_t BUFFER_SIZE = 64 * 1024;
+
+	FILE* _file;
+	std::string _fileName;
+
+	std::vector<char> _buffer;
+	char* _pos;
+	char* _end;
+	size_t _line;
+	bool _minus;	// whether a '-' was consumed while looking for comments
+
+	Token _token;
+	std::string _text;
+	double _number;
+};
+
+/*
+	A parsed value. Values are assigned as soon as their object's record is read,
+	unless they contain references, which must wait until all objects exist.
+ */
+struct ArchiveValue
+{
+	enum Kind { AV_NIL, AV_BOOL, AV_NUMBER, AV_STRING, AV_REF, AV_RECORD, AV_ARRAY };
+
+	Kind kind;
+	bool hasRefs;
+	bool boolean;
+	double number;				// a number, or the object id of a Ref
+	std::string text;			// a string, the type name of a Value/ArrayOf, or the facet of a Ref
+	std::vector<std::string> names;			// field names of a Value
+	std::vector<ArchiveValue*> children;	// field values of a Value, or elements of an ArrayOf
+
+	ArchiveValue() : kind( AV_NIL ), hasRefs( false ), boolean( false ), number( 0 )
+	{;}
+
+	~ArchiveValue()
+	{
+		for( size_t i = 0; i < children.size(); ++i )
+			delete children[i];
+	}
+
+private:
+	// forbid copies
+	ArchiveValue( const ArchiveValue& );
+	ArchiveValue& operator=( const ArchiveValue& );
+};
+
+/*
+	Restores an object graph from a file in the format of ca.LuaArchive.
+ */
+class ArchiveReader
+{
+public:
+	ArchiveReader( FILE* file, const std::string& fileName ) : _tokens( file, fileName )
+	{;}
+
+	~ArchiveReader()
+	{
+		for( size_t i = 0; i < _pending.size(); ++i )
+			delete _pending[i].value;
+	}
+
+	co::IObject* read()
+	{
+		while( _tokens.getToken() != ArchiveTokenizer::T_EOF )
+		{
+			// statements are either "objects[id] = Object ..." or "name = value"
+			_tokens.expect( ArchiveTokenizer::T_NAME, "statement" );
+			if( _tokens.isName( "objects" ) )
+			{
+				_tokens.next();
+				_tokens.expectSymbol( '[' );
+				co::uint32 id = readId();
+				_tokens.expectSymbol( ']' );
+				_tokens.expectSymbol( '=' );
+				readObject( id );
+			}
+			else
+			{
+				_tokens.next();
+				_tokens.expectSymbol( '=' );
+				ArchiveValue ignored;
+				readValue( ignored );
+			}
+		}
+
+		// now that all objects exist, assign the values that hold references
+		for( size_t i = 0; i < _pending.size(); ++i )
+		{
+			const PendingValue& pv = _pending[i];
+			if( pv.field )
+				assign( pv.service, pv.field, *pv.value );
+			else
+				static_cast<co::IObject*>( pv.service )->setService( pv.port, resolveRef( *pv.value ) );
+		}
+
+		if( _objects.empty() || !_objects[0].isValid() )
+			_tokens.raise( "no root object" );
+
+		return _objects[0].get();
+	}
+
+private:
+	// A value that could not be assigned before all objects were created.
+	struct PendingValue
+	{
+		co::IService* service;
+		co::IField* field;			// either a field of the service...
+		std::string port;			// ...or a receptacle of the object
+		ArchiveValue* value;
+	};
+
+	co::uint32 readId()
+	{
+		_tokens.expect( ArchiveTokenizer::T_NUMBER, "object id" );
+		double number = _tokens.getNumber();
+		if( number < 1 || number != static_cast<co::uint32>( number ) )
+			_tokens.raise( "invalid object id" );
+		_tokens.next();
+		return static_cast<co::uint32>( number );
+	}
+
+	void readObject( co::uint32 id )
+	{
+		_tokens.expectName( "Object" );
+		_tokens.expect( ArchiveTokenizer::T_STRING, "type name" );
+		co::IObjectRef object = co::newInstance( _tokens.getText() );
+		_tokens.next();
+
+		if( _objects.size() < id )
+			_objects.resize( id );
+		_objects[id - 1] = object;
+
+		_tokens.expectSymbol( '{' );
+		while( !_tokens.isSymbol( '}' ) )
+		{
+			_tokens.expect( ArchiveTokenizer::T_NAME, "port name" );
+			std::string portName = _tokens.getText();
+			_tokens.next();
+			_tokens.expectSymbol( '=' );
+
+			if( _tokens.isName( "Service" ) )
+			{
+				_tokens.next();
+				_tokens.expect( ArchiveTokenizer::T_STRING, "type name" );
+				_tokens.next();
+				readFields( object->getService( portName ) );
+			}
+			else
+			{
+				ArchiveValue* value = new ArchiveValue;
+				PendingValue pv = { object.get(), NULL, portName, value };
+				_pending.push_back( pv );
+				readValue( *value );
+				if( value->kind != ArchiveValue::AV_REF && value->kind != ArchiveValue::AV_NIL )
+					_tokens.raise( "reference expected for port '" + portName + "'" );
+			}
+
+			if( !skipSeparator() )
+				break;
+		}
+		_tokens.expectSymbol( '}' );
+	}
+
+	void readFields( co::IService* service )
+	{
+		co::IInterface* type = service->getInterface();
+
+		_tokens.expectSymbol( '{' );
+		while( !_tokens.isSymbol( '}' ) )
+		{
+			co::IField* field = readFieldName( type );
+
+			ArchiveValue* value = new ArchiveValue;
+			PendingValue pv = { service, field, std::string(), value };
+			_pending.push_back( pv );
+			readValue( *value );
+
+			if( !value->hasRefs )
+			{
+				assign( service, field, *value );
+				delete value;
+				_pending.pop_back();
+			}
+
+			if( !skipSeparator() )
+				break;
+		}
+		_tokens.expectSymbol( '}' );
+	}
+
+	co::IField* readFieldName( co::ICompositeType* type )
+	{
+		_tokens.expect( ArchiveTokenizer::T_NAME, "field name" );
+		co::IMember* member = type->getMember( _tokens.getText() );
+		if( !member || member->getKind() != co::MK_FIELD )
+			_tokens.raise( "no field '" + _tokens.getText() + "' in type '" + type->getFullName() + "'" );
+		_tokens.next();
+		_tokens.expectSymbol( '=' );
+		return static_cast<co::IField*>( member );
+	}
+
+	void readValue( ArchiveValue& value )
+	{
+		switch( _tokens.getToken() )
+		{
+		case ArchiveTokenizer::T_NUMBER:
+			value.kind = ArchiveValue::AV_NUMBER;
+			value.number = _tokens.getNumber();
+			_tokens.next();
+			return;
+
+		case ArchiveTokenizer::T_STRING:
+			value.kind = ArchiveValue::AV_STRING;
+			value.text = _tokens.getText();
+			_tokens.next();
+			return;
+
+		case ArchiveTokenizer::T_SYMBOL:
+			if( _tokens.isSymbol( '-' ) )
+			{
+				_tokens.next();
+				_tokens.expect( ArchiveTokenizer::T_NUMBER, "number" );
+				value.kind = ArchiveValue::AV_NUMBER;
+				value.number = -_tokens.getNumber();
+				_tokens.next();
+				return;
+			}
+			break;
+
+		case ArchiveTokenizer::T_NAME:
+			if( _tokens.isName( "nil" ) )
+			{
+				_tokens.next();
+				return;
+			}
+			if( _tokens.isName( "true" ) || _tokens.isName( "false" ) )
+			{
+				value.kind = ArchiveValue::AV_BOOL;
+				value.boolean = _tokens.isName( "true" );
+				_tokens.next();
+				return;
+			}
+			if( _tokens.isName( "Ref" ) )
+			{
+				_tokens.next();
+				readRef( value );
+				return;
+			}
+			if( _tokens.isName( "Value" ) || _tokens.isName( "ArrayOf" ) )
+			{
+				bool isArray = _tokens.isName( "ArrayOf" );
+				_tokens.next();
+				_tokens.expect( ArchiveTokenizer::T_STRING, "type name" );
+				value.text = _tokens.getText();
+				_tokens.next();
+				if( isArray )
+					readArray( value );
+				else
+					readRecord( value );
+				return;
+			}
+			break;
+
+		default:
+			break;
+		}
+		_tokens.raise( "value expected" );
+	}
+
+	void readRef( ArchiveValue& value )
+	{
+		value.kind = ArchiveValue::AV_REF;
+		value.hasRefs = true;
+
+		bool hasId = false;
+		bool hasFacet = false;
+
+		_tokens.expectSymbol( '{' );
+		while( !_tokens.isSymbol( '}' ) )
+		{
+			if( _tokens.isName( "id" ) )
+			{
+				_tokens.next();
+				_tokens.expectSymbol( '=' );
+				value.number = readId();
+				hasId = true;
+			}
+			else
+			{
+				_tokens.expectName( "facet" );
+				_tokens.expectSymbol( '=' );
+				_tokens.expect( ArchiveTokenizer::T_STRING, "facet name" );
+				value.text = _tokens.getText();
+				_tokens.next();
+				hasFacet = true;
+			}
+
+			if( !skipSeparator() )
+				break;
+		}
+		_tokens.expectSymbol( '}' );
+
+		if( !hasId || !hasFacet )
+			_tokens.raise( "incomplete reference" );
+	}
+
+	void readRecord( ArchiveValue& value )
+	{
+		value.kind = ArchiveValue::AV_RECORD;
+
+		_tokens.expectSymbol( '{' );
+		while( !_tokens.isSymbol( '}' ) )
+		{
+			_tokens.expect( ArchiveTokenizer::T_NAME, "field name" );
+			value.names.push_back( _tokens.getText() );
+			_tokens.next();
+			_tokens.expectSymbol( '=' );
+
+			ArchiveValue* child = new ArchiveValue;
+			value.children.push_back( child );
+			readValue( *child );
+			value.hasRefs |= child->hasRefs;
+
+			if( !skipSeparator() )
+				break;
+		}
+		_tokens.expectSymbol( '}' );
+	}
+
+	void readArray( ArchiveValue& value )
+	{
+		value.kind = ArchiveValue::AV_ARRAY;
+
+		_tokens.expectSymbol( '{' );
+		while( !_tokens.isSymbol( '}' ) )
+		{
+			ArchiveValue* child = new ArchiveValue;
+			value.children.push_back( child );
+			readValue( *child );
+			value.hasRefs |= child->hasRefs;
+
+			if( !skipSeparator() )
+				break;
+		}
+		_tokens.expectSymbol( '}' );
+	}
+
+	// Skips a table separator, returning false if there is none.
+	bool skipSeparator()
+	{
+		if( _tokens.isSymbol( ',' ) || _tokens.isSymbol( ';' ) )
+		{
+			_tokens.next();
+			return true;
+		}
+		return false;
+	}
+
+	co::IService* resolveRef( const ArchiveValue& value )
+	{
+		if( value.kind == ArchiveValue::AV_NIL )
+			return NULL;
+
+		assert( value.kind == ArchiveValue::AV_REF );
+		size_t index = static_cast<size_t>( value.number ) - 1;
+		if( index >= _objects.size() || !_objects[index].isValid() )
+			CORAL_THROW( ca::FormatException, "reference to missing object " << value.number );
+
+		return _objects[index]->getService( value.text );
+	}
+
+	// Assigns a parsed value to a field of an instance.
+	void assign( const co::Any& instance, co::IField* field, const ArchiveValue& value )
+	{
+		co::IType* type = field->getType();
+		co::IReflector* reflector = field->getOwner()->getReflector();
+		co::TypeKind kind = type->getKind();
+
+		if( kind == co::TK_INTERFACE )
+		{
+			reflector->setField( instance, field, resolveRef( value ) );
+		}
+		else if( kind == co::TK_ARRAY )
+		{
+			checkKind( value, ArchiveValue::AV_ARRAY, field );
+
+			co::IType* elementType = static_cast<co::IArray*>( type )->getElementType();
+			size_t count = value.children.size();
+			if( elementType->getKind() == co::TK_INTERFACE )
+			{
+				std::vector<co::IService*> refs( count );
+				for( size_t i = 0; i < count; ++i )
+					refs[i] = resolveRef( *value.children[i] );
+
+				// force a downcast of the IService[] to its real element type
+				reflector->setField( instance, field, co::Any( true, type, count ? &refs[0] : NULL, count ) );
+			}
+			else
+			{
+				ValueBuffer buffer( elementType, count );
+				for( size_t i = 0; i < count; ++i )
+					fill( *value.children[i], elementType, buffer.at( i ), field );
+				reflector->setField( instance, field, co::Any( true, type, buffer.getData(), count ) );
+			}
+		}
+		else
+		{
+			ValueBuffer buffer( type, 1 );
+			fill( value, type, buffer.at( 0 ), field );
+			reflector->setField( instance, field, co::Any( true, type, buffer.at( 0 ) ) );
+		}
+	}
+
+	// Writes a parsed value of a non-array, non-interface type into the memory at 'ptr'.
+	void fill( const ArchiveValue& value, co::IType* type, void* ptr, co::IField* field )
+	{
+		co::TypeKind kind = type->getKind();
+		if( kind == co::TK_BOOL )
+		{
+			checkKind( value, ArchiveValue::AV_BOOL, field );
+			*reinterpret_cast<bool*>( ptr ) = value.boolean;
+		}
+		else if( kind == co::TK_STRING )
+		{
+			checkKind( value, ArchiveValue::AV_STRING, field );
+			*reinterpret_cast<std::string*>( ptr ) = value.text;
+		}
+		else if( kind == co::TK_ENUM )
+		{
+			checkKind( value, ArchiveValue::AV_STRING, field );
+			co::IEnum* enumType = static_cast<co::IEnum*>( type );
+			co::int32 enumValue = enumType->getValueOf( value.text );
+			if( enumValue < 0 )
+				CORAL_THROW( ca::FormatException, "no identifier '" << value.text << "' in enum '"
+					<< enumType->getFullName() << "'" );
+			*reinterpret_cast<co::int32*>( ptr ) = enumValue;
+		}
+		else if( kind == co::TK_STRUCT || kind == co::TK_NATIVECLASS )
+		{
+			checkKind( value, ArchiveValue::AV_RECORD, field );
+			co::IRecordType* recordType = static_cast<co::IRecordType*>( type );
+			co::Any instance( false, type, ptr );
+			for( size_t i = 0; i < value.names.size(); ++i )
+			{
+				co::IMember* member = recordType->getMember( value.names[i] );
+				if( !member || member->getKind() != co::MK_FIELD )
+					CORAL_THROW( ca::FormatException, "no field '" << value.names[i] << "' in type '"
+						<< type->getFullName() << "'" );
+				assign( instance, static_cast<co::IField*>( member ), *value.children[i] );
+			}
+		}
+		else
+		{
+			checkKind( value, ArchiveValue::AV_NUMBER, field );
+			double n = value.number;
+			switch( kind )
+			{
+			case co::TK_INT8:	*reinterpret_cast<co::int8*>( ptr ) = static_cast<co::int8>( n ); break;
+			case co::TK_INT16:	*reinterpret_cast<co::int16*>( ptr ) = static_cast<co::int16>( n ); break;
+			case co::TK_INT32:	*reinterpret_cast<co::int32*>( ptr ) = static_cast<co::int32>( n ); break;
+			case co::TK_UINT8:	*reinterpret_cast<co::uint8*>( ptr ) = static_cast<co::uint8>( n ); break;
+			case co::TK_UINT16:	*reinterpret_cast<co::uint16*>( ptr ) = static_cast<co::uint16>( n ); break;
+			case co::TK_UINT32:	*reinterpret_cast<co::uint32*>( ptr ) = static_cast<co::uint32>( n ); break;
+			case co::TK_FLOAT:	*reinterpret_cast<float*>( ptr ) = static_cast<float>( n ); break;
+			case co::TK_DOUBLE:	*reinterpret_cast<double*>( ptr ) = n; break;
+			default:
+				CORAL_THROW( ca::FormatException, "cannot restore values of type '" << type->getFullName() << "'" );
+			}
+		}
+	}
+
+	void checkKind( const ArchiveValue& value, ArchiveValue::Kind kind, co::IField* field )
+	{
+		if( value.kind != kind )
+			CORAL_THROW( ca::FormatException, "invalid value for field '" << field->getName()
+				<< "' of type '" << field->getType()->getFullName() << "'" );
+	}
+
+private:
+	ArchiveTokenizer _tokens;
+	std::vector<co::IObjectRef> _objects;	// indexed by id - 1
+	std::vector<PendingValue> _pending;
+};
+
+/******************************************************************************/
+/* NativeLuaArchive                                                           */
+/******************************************************************************/
+
+class NativeLuaArchive : public NativeLuaArchive_Base
+{
+public:
+	NativeLuaArchive()
+	{
+		// empty
+	}
+
+	virtual ~NativeLuaArchive()
+	{
+		// empty
+	}
+
+	// ------ ca.IArchive Methods ------ //
+
+	void save( co::IObject* rootObject )
+	{
+		checkConfig();
+
+		CLocaleScope localeScope;
+
+		FILE* file = fopen( _fileName.c_str(), "w" );
+		if( !file )
+			CORAL_THROW( ca::IOException, "could not open file '" << _fileName << "' for writing" );
+
+		try
+		{
+			ArchiveWriter writer( _model.get(), file );
+			writer.write( rootObject );
+		}
+		catch( ... )
+		{
+			fclose( file );
+			throw;
+		}
+
+		if( fclose( file ) != 0 )
+			CORAL_THROW( ca::IOException, "error writing file '" << _fileName << "'" );
+
+		_restoredObject = NULL;
+	}
+
+	co::IObject* restore()
+	{
+		checkConfig();
+
+		// the previously restored graph is released before reading a new one
+		_restoredObject = NULL;
+
+		FILE* file = fopen( _fileName.c_str(), "rb" );
+		if( !file )
+			CORAL_THROW( ca::IOException, "could not open file '" << _fileName << "' for reading" );
+
+		try
+		{
+			ArchiveReader reader( file, _fileName );
+			_restoredObject = reader.read();
+		}
+		catch( ... )
+		{
+			fclose( file );
+			throw;
+		}
+
+		fclose( file );
+		return _restoredObject.get();
+	}
+
+	// ------ ca.INamed Methods ------ //
+
+	std::string getName()
+	{
+		return _fileName;
+	}
+
+	void setName( const std::string& name )
+	{
+		_fileName = name;
+	}
+
+protected:
+	// ------ Receptacle 'model' (ca.IModel) ------ //
+
+	ca::IModel* getModelService()
+	{
+		return _model.get();
+	}
+
+	void setModelService( ca::IModel* model )
+	{
+		_model = model;
+	}
+
+private:
+	void checkConfig()
+	{
+		if( !_model.isValid() )
+			throw ca::ModelException( "the ca.NativeLuaArchive requires a model for this operation" );
+
+		if( _fileName.empty() )
+			throw ca::IOException( "the ca.NativeLuaArchive requires a file name for this operation" );
+	}
+
+private:
+	ca::IModelRef _model;
+	std::string _fileName;
+
+	/*
+		The restored root object is returned as a raw pointer, so the archive keeps the
+		last restored graph alive until the next save() or restore() (see ca.IArchive).
+	 */
+	co::IObjectRef _restoredObject;
+};
+
+CORAL_EXPORT_COMPONENT( NativeLuaArchive, NativeLuaArchive );
+
+} // namespace ca
@@ -0,0 +1,861 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#include "SpaceLoader.h"
+#include "../Model.h"
+
+#include <co/Coral.h>
+#include <co/IArray.h>
+#include <co/IComponent.h>
+#include <co/IInterface.h>
+#include <co/IReflector.h>
+#include <ca/IOException.h>
+#include <ca/FormatException.h>
+#include <ca/ISpaceStoreCursor.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+namespace ca {
+
+SpaceLoader::SpaceLoader( ca::IModel* model, StringSerializer& serializer, ca::ISpaceLoader* listener )
+	: _model( model ), _serializer( serializer ), _listener( listener ),
+		_rootId( 0 ), _depthLimited( false ), _numRows( 0 ), _numKnownUpdates( 0 ), _migratedType( false )
+{
+	assert( _model && _listener );
+}
+
+SpaceLoader::PendingUpdates SpaceLoader::checkUpdates( ca::ISpaceStore* store, co::uint32 revision )
+{
+	store->getUpdates( revision, _updateList );
+
+	std::vector<std::string> typeNames;
+	store->getTypeNames( revision, typeNames );
+	for( size_t i = 0; i < typeNames.size(); ++i )
+	{
+		size_t pos = typeNames[i].rfind( '.' );
+		if( pos != std::string::npos )
+			_model->loadDefinitionsFor( typeNames[i].substr( 0, pos ) );
+	}
+
+	// updates with migrations are applied natively
+	PendingUpdates res = PU_None;
+	co::TSlice<std::string> updates = _model->getUpdates();
+	co::TSlice<ca::Migration> migrations = _model->getMigrations();
+	for( ; updates; updates.popFirst() )
+	{
+		const std::string& update = updates.getFirst();
+		if( isApplied( update ) )
+			continue;
+
+		bool declarative = false;
+		for( co::TSlice<ca::Migration> m = migrations; m && !declarative; m.popFirst() )
+			declarative = ( m.getFirst().update == update );
+
+		if( !declarative )
+			return PU_Scripts;
+
+		res = PU_Migrations;
+	}
+
+	return res;
+}
+
+void SpaceLoader::readRevision( ca::ISpaceStore* store, co::uint32 revision, co::uint32 maxDepth )
+{
+	_rootId = store->getRootObject( revision );
+	store->getUpdates( revision, _updateList );
+
+	_depthLimited = ( maxDepth > 0 );
+	if( _depthLimited )
+	{
+		// first pass: collect the references among objects and select the ones to load
+		readRows( store, revision, &SpaceLoader::scanRows );
+
+		// load the CaModels of all stored types, so that their updates are known
+		for( size_t i = 0; i < _typeNames.size(); ++i )
+			_model->contains( co::getType( _typeNames[i] ) );
+
+		std::vector<co::uint32> frontier( 1, _rootId );
+		selectObjects( frontier, maxDepth, NULL );
+	}
+
+	readRows( store, revision, &SpaceLoader::processRows );
+
+	if( _records.empty() )
+		CORAL_THROW( ca::IOException, "no values stored for revision " << revision );
+
+	// the declarative updates applied while reading are now part of the revision
+	co::TSlice<std::string> updates = _model->getUpdates();
+	for( ; updates; updates.popFirst() )
+	{
+		const std::string& update = updates.getFirst();
+		if( _migratedUpdates.find( update ) != _migratedUpdates.end() )
+			_updateList.append( update ).push_back( ';' );
+	}
+}
+
+bool SpaceLoader::hasPendingScripts()
+{
+	co::TSlice<std::string> updates = _model->getUpdates();
+	for( ; updates; updates.popFirst() )
+		if( !isApplied( updates.getFirst() ) )
+			return true;
+	return false;
+}
+
+co::IObject* SpaceLoader::restoreGraph()
+{
+	co::IService* root = getService( _rootId );
+	if( !root )
+		CORAL_THROW( ca::FormatException, "missing root object (id " << _rootId << ")" );
+
+	if( !_depthLimited )
+		discardUnreachable();
+
+	finishPass( NULL );
+
+	return static_cast<co::IObject*>( root );
+}
+
+void SpaceLoader::loadSubgraph( ca::ISpaceStore* store, co::uint32 revision, co::uint32 objectId,
+								co::uint32 maxDepth, MemberList& loadedRefs )
+{
+	if( _pendingIndex.empty() || objectId >= _records.size() )
+		return;
+
+	// the object's facets are among its scanned references
+	std::vector<co::IService*> owners( 1, _records[objectId].service );
+	const Record& rec = _records[objectId];
+	for( co::uint32 e = rec.firstEdge; e < rec.firstEdge + rec.numEdges; ++e )
+		if( _edges[e] < _records.size() && _records[_edges[e]].provider == objectId )
+			owners.push_back( _records[_edges[e]].service );
+
+	// start from the pending references of the object and its services
+	std::vector<co::uint32> frontier;
+	for( size_t i = 0; i < owners.size(); ++i )
+	{
+		PendingIndex::iterator it = _pendingIndex.find( owners[i] );
+		if( it == _pendingIndex.end() )
+			continue;
+
+		for( size_t j = 0; j < it->second.size(); ++j )
+		{
+			const PendingRef& pr = _pendingRefs[it->second[j]];
+			for( co::uint32 k = pr.firstId; k < pr.firstId + pr.numIds; ++k )
+				if( isPending( _refIds[k] ) )
+					frontier.push_back( _refIds[k] );
+		}
+	}
+
+	if( frontier.empty() )
+		return;
+
+	std::vector<co::uint32> selected;
+	selectObjects( frontier, maxDepth > 0 ? maxDepth - 1 : std::numeric_limits<co::uint32>::max(), &selected );
+
+	// only the selected objects are read, each followed by its facets
+	for( size_t i = 0; i < selected.size(); ++i )
+	{
+		co::uint32 id = selected[i];
+		readValues( store, revision, id );
+
+		co::uint32 firstEdge = _records[id].firstEdge;
+		co::uint32 numEdges = _records[id].numEdges;
+		for( co::uint32 e = firstEdge; e < firstEdge + numEdges; ++e )
+			if( _edges[e] < _records.size() && _records[_edges[e]].provider == id )
+				readValues( store, revision, _edges[e] );
+	}
+
+	finishPass( &loadedRefs );
+}
+
+void SpaceLoader::discardPendingRefs( co::IService* service, co::IMember* member )
+{
+	PendingIndex::iterator it = _pendingIndex.find( service );
+	if( it == _pendingIndex.end() )
+		return;
+
+	std::vector<size_t>& indices = it->second;
+	size_t kept = 0;
+	for( size_t i = 0; i < indices.size(); ++i )
+	{
+		PendingRef& pr = _pendingRefs[indices[i]];
+		if( member == NULL || member == static_cast<co::IMember*>( pr.port )
+				|| member == static_cast<co::IMember*>( pr.field ) )
+			pr.owner = 0; // dropped by the next pass
+		else
+			indices[kept++] = indices[i];
+	}
+
+	indices.resize( kept );
+	if( indices.empty() )
+		_pendingIndex.erase( it );
+}
+
+SpaceLoader::Record& SpaceLoader::getRecord( co::uint32 id )
+{
+	if( id >= _records.size() )
+		_records.resize( id + 1 );
+	return _records[id];
+}
+
+void SpaceLoader::readRows( ca::ISpaceStore* store, co::uint32 revision, RowsProcessor processor )
+{
+	ca::ISpaceStoreCursorRef cursor = store->openCursor( revision );
+	try
+	{
+		// rows arrive grouped by id: process each group once the next one starts
+		co::uint32 currentId = 0, id;
+		bool hasRow;
+		_numRows = 0;
+		do
+		{
+			if( _numRows == _fieldNames.size() )
+			{
+				_fieldNames.push_back( std::string() );
+				_values.push_back( std::string() );
+			}
+
+			hasRow = cursor->next( id, _fieldNames[_numRows], _values[_numRows] );
+			if( _numRows > 0 && ( !hasRow || id != currentId ) )
+			{
+				migrateRows();
+				( this->*processor )( currentId );
+				if( hasRow )
+				{
+					_fieldNames[0].swap( _fieldNames[_numRows] );
+					_values[0].swap( _values[_numRows] );
+				}
+				_numRows = 0;
+			}
+
+			if( hasRow )
+			{
+				currentId = id;
+				++_numRows;
+			}
+		}
+		while( hasRow );
+	}
+	catch( ... )
+	{
+		cursor->close();
+		throw;
+	}
+}
+
+void SpaceLoader::readValues( ca::ISpaceStore* store, co::uint32 revision, co::uint32 id )
+{
+	const Record& rec = _records[id];
+	store->getValues( id, revision, _fieldNames, _values );
+	_numRows = _fieldNames.size();
+
+	// the store omits the type and provider rows, which were kept by the scan
+	addRow( "_type", _typeNames[rec.type] );
+	if( rec.provider )
+	{
+		char provider[16];
+		sprintf( provider, "%u", rec.provider );
+		addRow( "_provider", provider );
+	}
+
+	migrateRows();
+	processRows( id );
+}
+
+bool SpaceLoader::isApplied( const std::string& update )
+{
+	size_t pos = 0;
+	while( ( pos = _updateList.find( update, pos ) ) != std::string::npos )
+	{
+		size_t end = pos + update.size();
+		if( ( pos == 0 || _updateList[pos - 1] == ';' ) &&
+				( end == _updateList.size() || _updateList[end] == ';' ) )
+			return true;
+		pos = end;
+	}
+	return false;
+}
+
+size_t SpaceLoader::findRow( const std::string& name )
+{
+	size_t i = 0;
+	while( i < _numRows && _fieldNames[i] != name )
+		++i;
+	return i;
+}
+
+void SpaceLoader::addRow( const std::string& name, const std::string& value )
+{
+	// the slot past the last row holds the first row of the next id (see readRows)
+	while( _fieldNames.size() < _numRows + 2 )
+	{
+		_fieldNames.push_back( std::string() );
+		_values.push_back( std::string() );
+	}
+
+	_fieldNames[_numRows].swap( _fieldNames[_numRows + 1] );
+	_values[_numRows].swap( _values[_numRows + 1] );
+	_fieldNames[_numRows] = name;
+	_values[_numRows] = value;
+	++_numRows;
+}
+
+void SpaceLoader::collectMigrations()
+{
+	co::TSlice<std::string> updates = _model->getUpdates();
+	size_t numUpdates = updates.getSize();
+	if( numUpdates == _numKnownUpdates )
+		return;
+
+	co::TSlice<ca::Migration> migrations = _model->getMigrations();
+	for( size_t i = _numKnownUpdates; i < numUpdates; ++i )
+	{
+		const std::string& update = updates[i];
+		if( isApplied( update ) )
+			continue;
+
+		size_t first = _migrations.size();
+		bool late = false;
+		for( co::TSlice<ca::Migration> m = migrations; m; m.popFirst() )
+		{
+			if( m.getFirst().update != update )
+				continue;
+			_migrations.push_back( m.getFirst() );
+			late = late || ( _readTypes.find( m.getFirst().typeName ) != _readTypes.end() );
+		}
+
+		// update scripts, and migrations that can no longer be applied, are left pending
+		if( late )
+			_migrations.resize( first );
+		else if( _migrations.size() > first )
+			_migratedUpdates.insert( update );
+	}
+
+	_numKnownUpdates = numUpdates;
+}
+
+void SpaceLoader::migrateRows()
+{
+	_migratedType = false;
+	_migratedMembers.clear();
+
+	size_t typeRow = findRow( "_type" );
+	if( typeRow == _numRows )
+		return;
+
+	// the CaModel that declares migrations for a type is loaded before its first rows are used
+	if( _readTypes.find( _values[typeRow] ) == _readTypes.end() )
+	{
+		const std::string& typeName = _values[typeRow];
+		size_t pos = typeName.rfind( '.' );
+		if( pos != std::string::npos )
+			_model->loadDefinitionsFor( typeName.substr( 0, pos ) );
+		collectMigrations();
+	}
+
+	_readTypes.insert( _values[typeRow] );
+
+	// each step sees the type name left by the previous steps
+	for( size_t i = 0; i < _migrations.size(); ++i )
+	{
+		const ca::Migration& m = _migrations[i];
+		if( m.typeName != _values[typeRow] )
+			continue;
+
+		switch( m.kind )
+		{
+		case ca::MIG_CHANGE_TYPE:
+			_values[typeRow] = m.value;
+			_readTypes.insert( m.value );
+			_migratedType = true;
+			break;
+		case ca::MIG_RENAME_MEMBER:
+			{
+				size_t row = findRow( m.member );
+				if( row < _numRows )
+				{
+					_fieldNames[row] = m.value;
+					_migratedMembers.push_back( m.value );
+				}
+			}
+			break;
+		case ca::MIG_DEFAULT_VALUE:
+			if( findRow( m.member ) == _numRows )
+			{
+				addRow( m.member, m.value );
+				_migratedMembers.push_back( m.member );
+			}
+			break;
+		default:
+			assert( false );
+		}
+	}
+}
+
+bool SpaceLoader::isMigrated( const std::string& name )
+{
+	for( size_t i = 0; i < _migratedMembers.size(); ++i )
+		if( _migratedMembers[i] == name )
+			return true;
+	return false;
+}
+
+void SpaceLoader::scanRows( co::uint32 id )
+{
+	Record& rec = getRecord( id );
+	if( rec.state == RS_None )
+		rec.state = RS_Stored;
+
+	rec.firstEdge = static_cast<co::uint32>( _edges.size() );
+	for( size_t i = 0; i < _numRows; ++i )
+	{
+		const std::string& name = _fieldNames[i];
+		const std::string& value = _values[i];
+		if( name == "_type" )
+		{
+			if( _depthLimited )
+			{
+				std::map<std::string, co::uint32>::iterator it = _typeIds.find( value );
+				if( it == _typeIds.end() )
+				{
+					it = _typeIds.insert( std::make_pair( value, static_cast<co::uint32>( _typeNames.size() ) ) ).first;
+					_typeNames.push_back( value );
+				}
+				rec.type = it->second;
+			}
+		}
+		else if( name == "_provider" )
+		{
+			rec.provider = static_cast<co::uint32>( atol( value.c_str() ) );
+		}
+		else if( value[0] == '#' )
+		{
+			if( value[1] == '{' )
+				parseRefVec( value, _edges );
+			else
+				_edges.push_back( parseRef( value ) );
+		}
+	}
+	rec.numEdges = static_cast<co::uint32>( _edges.size() ) - rec.firstEdge;
+}
+
+void SpaceLoader::processRows( co::uint32 id )
+{
+	// in a single pass, the references are collected along with the values
+	if( !_depthLimited )
+		scanRows( id );
+
+	const std::string* typeName = NULL;
+	bool isService = false;
+	for( size_t i = 0; i < _numRows; ++i )
+	{
+		const std::string& name = _fieldNames[i];
+		if( name == "_type" )
+			typeName = &_values[i];
+		else if( name == "_provider" )
+			isService = true;
+	}
+
+	if( !typeName )
+		CORAL_THROW( ca::FormatException, "no type stored for id " << id );
+
+	// services are instantiated by their providers
+	co::uint8 state = getRecord( id ).state;
+	if( isService )
+	{
+		if( state == RS_Created )
+			processService( id, *typeName );
+	}
+	else if( !_depthLimited || state == RS_Selected )
+	{
+		processObject( id, *typeName );
+	}
+}
+
+void SpaceLoader::processObject( co::uint32 id, const std::string& typeName )
+{
+	co::IObjectRef object = co::newInstance( typeName );
+	_objects.push_back( object );
+
+	Record& rec = getRecord( id );
+	rec.service = object.get();
+	rec.state = RS_Created;
+
+	if( _migratedType )
+		addMigratedChange( id ).typeName = typeName;
+
+	std::vector<co::IPortRef> ports;
+	_model->getPorts( object->getComponent(), ports );
+
+	for( size_t i = 0; i < _numRows; ++i )
+	{
+		const std::string& name = _fieldNames[i];
+		if( name[0] == '_' )
+			continue;
+
+		co::IPort* port = NULL;
+		for( size_t k = 0; k < ports.size(); ++k )
+		{
+			if( ports[k]->getName() == name )
+			{
+				port = ports[k].get();
+				break;
+			}
+		}
+
+		// ports removed from the model are ignored
+		co::uint32 refId = parseRef( _values[i] );
+		if( !port || !refId )
+			continue;
+
+		// facets are mapped to their ids, so service rows can be applied as they arrive
+		if( port->getIsFacet() )
+		{
+			Record& serviceRec = getRecord( refId );
+			serviceRec.service = object->getServiceAt( port );
+			serviceRec.provider = id;
+			serviceRec.state = RS_Created;
+			if( isMigrated( name ) )
+			{
+				MigratedChange& change = addMigratedChange( id );
+				change.port = port;
+				change.facet = serviceRec.service;
+			}
+			continue;
+		}
+
+		PendingRef& pr = addPendingRef( id, port, NULL );
+		pr.numIds = 1;
+		pr.migrated = isMigrated( name );
+		_refIds.push_back( refId );
+	}
+}
+
+void SpaceLoader::processService( co::uint32 id, const std::string& typeName )
+{
+	co::IService* service = getService( id );
+	assert( service );
+
+	if( _migratedType )
+		addMigratedChange( id ).typeName = typeName;
+
+	std::vector<co::IFieldRef> fields;
+	_model->getFields( service->getInterface(), fields );
+
+	co::Any instance( service );
+	for( size_t i = 0; i < _numRows; ++i )
+	{
+		const std::string& name = _fieldNames[i];
+		if( name[0] == '_' )
+			continue;
+
+		co::IField* field = NULL;
+		for( size_t k = 0; k < fields.size(); ++k )
+		{
+			if( fields[k]->getName() == name )
+			{
+				field = fields[k].get();
+				break;
+			}
+		}
+
+		// fields removed from the model are ignored
+		if( !field )
+			continue;
+
+		const std::string& value = _values[i];
+		FieldKind kind = fieldKindOf( field->getType() );
+		if( kind == FK_Ref )
+		{
+			co::uint32 refId = parseRef( value );
+			if( refId )
+			{
+				PendingRef& pr = addPendingRef( id, NULL, field );
+				pr.numIds = 1;
+				pr.migrated = isMigrated( name );
+				_refIds.push_back( refId );
+			}
+		}
+		else if( kind == FK_RefVec )
+		{
+			PendingRef& pr = addPendingRef( id, NULL, field );
+			parseRefVec( value, _refIds );
+			pr.numIds = static_cast<co::uint32>( _refIds.size() ) - pr.firstId;
+			pr.migrated = isMigrated( name );
+		}
+		else
+		{
+			_serializer.fromString( value, instance, field );
+			if( isMigrated( name ) )
+			{
+				MigratedChange& change = addMigratedChange( id );
+				change.field = field;
+				field->getOwner()->getReflector()->getField( instance, field, change.value );
+			}
+		}
+	}
+}
+
+SpaceLoader::MigratedChange& SpaceLoader::addMigratedChange( co::uint32 id )
+{
+	_migratedChanges.push_back( MigratedChange( id ) );
+	return _migratedChanges.back();
+}
+
+SpaceLoader::PendingRef& SpaceLoader::addPendingRef( co::uint32 ownerId, co::IPort* port, co::IField* field )
+{
+	_pendingRefs.push_back( PendingRef( ownerId, port, field, static_cast<co::uint32>( _refIds.size() ) ) );
+	return _pendingRefs.back();
+}
+
+void SpaceLoader::selectObjects( std::vector<co::uint32>& frontier, co::uint32 maxDepth, std::vector<co::uint32>* selected )
+{
+	std::vector<co::uint32> next;
+	for( co::uint32 level = 0; !frontier.empty(); ++level )
+	{
+		next.clear();
+		for( size_t i = 0; i < frontier.size(); ++i )
+		{
+			co::uint32 id = frontier[i];
+			if( id >= _records.size() )
+				continue;
+
+			// services are loaded along with their providers
+			if( _records[id].provider )
+				id = _records[id].provider;
+
+			Record& rec = _records[id];
+			if( rec.state != RS_Stored )
+				continue;
+
+			rec.state = RS_Selected;
+			if( selected )
+				selected->push_back( id );
+
+			if( level == maxDepth )
+				continue;
+
+			// follow the references of the object and of its facets
+			for( co::uint32 e = rec.firstEdge; e < rec.firstEdge + rec.numEdges; ++e )
+			{
+				co::uint32 target = _edges[e];
+				if( target >= _records.size() || _records[target].provider != id )
+				{
+					next.push_back( target );
+					continue;
+				}
+
+				const Record& facet = _records[target];
+				next.insert( next.end(), _edges.begin() + facet.firstEdge,
+					_edges.begin() + facet.firstEdge + facet.numEdges );
+			}
+		}
+		frontier.swap( next );
+	}
+}
+
+void SpaceLoader::discardUnreachable()
+{
+	std::vector<bool> reached( _records.size(), false );
+	std::vector<co::uint32> stack( 1, _rootId );
+	while( !stack.empty() )
+	{
+		co::uint32 id = stack.back();
+		stack.pop_back();
+
+		if( id >= _records.size() || reached[id] )
+			continue;
+
+		reached[id] = true;
+
+		const Record& rec = _records[id];
+		if( rec.provider )
+			stack.push_back( rec.provider );
+
+		stack.insert( stack.end(), _edges.begin() + rec.firstEdge,
+			_edges.begin() + rec.firstEdge + rec.numEdges );
+	}
+
+	// objects no longer reachable in the revision were removed from the space
+	for( size_t id = 0; id < _records.size(); ++id )
+	{
+		Record& rec = _records[id];
+		if( !reached[id] && rec.state == RS_Created )
+		{
+			rec.service = NULL;
+			rec.state = RS_Stored;
+		}
+	}
+}
+
+void SpaceLoader::finishPass( MemberList* loadedRefs )
+{
+	// report the migrations of the records that were not discarded
+	for( size_t i = 0; i < _migratedChanges.size(); ++i )
+	{
+		const MigratedChange& change = _migratedChanges[i];
+		const Record& rec = _records[change.id];
+		if( rec.state != RS_Created && rec.state != RS_Loaded )
+			continue;
+
+		if( change.port )
+			_listener->addRefChange( rec.service, change.port, change.facet );
+		else if( change.field )
+			_listener->addChange( rec.service, change.field, change.value.getAny() );
+		else
+			_listener->addTypeChange( rec.service, change.typeName );
+	}
+	_migratedChanges.clear();
+
+	// resolve the references whose targets are all instantiated
+	std::vector<co::IService*> refs;
+	size_t kept = 0;
+	for( size_t i = 0; i < _pendingRefs.size(); ++i )
+	{
+		const PendingRef& pr = _pendingRefs[i];
+		if( !pr.owner )
+			continue;
+
+		// references from discarded objects are dropped
+		const Record& owner = _records[pr.owner];
+		if( owner.state != RS_Created && owner.state != RS_Loaded )
+			continue;
+
+		bool ready = true;
+		for( co::uint32 k = pr.firstId; ready && k < pr.firstId + pr.numIds; ++k )
+			ready = !isPending( _refIds[k] );
+
+		if( !ready )
+		{
+			_pendingRefs[kept++] = pr;
+			continue;
+		}
+
+		// members of services that were already in the space must be stored by the space
+		if( loadedRefs && owner.state == RS_Loaded )
+			loadedRefs->push_back( MemberList::value_type( owner.service,
+				pr.port ? static_cast<co::IMember*>( pr.port ) : static_cast<co::IMember*>( pr.field ) ) );
+
+		// members changed by migrations are reported once their references are resolved
+		if( pr.port )
+		{
+			co::IObject* object = static_cast<co::IObject*>( owner.service );
+			co::IService* service = getServiceFor( _refIds[pr.firstId], pr.port->getType() );
+			object->setServiceAt( pr.port, service );
+			if( pr.migrated )
+				_listener->addRefChange( object, pr.port, service );
+			continue;
+		}
+
+		co::IReflector* reflector = pr.field->getOwner()->getReflector();
+		if( fieldKindOf( pr.field->getType() ) == FK_Ref )
+		{
+			co::IService* service = getService( _refIds[pr.firstId] );
+			reflector->setField( owner.service, pr.field, service );
+			if( pr.migrated )
+				_listener->addRefChange( owner.service, pr.field, service );
+			continue;
+		}
+
+		refs.clear();
+		for( co::uint32 k = pr.firstId; k < pr.firstId + pr.numIds; ++k )
+			refs.push_back( getService( _refIds[k] ) );
+
+		// force a downcast of the IService[] to its real element type
+		co::Any refVec( true, pr.field->getType(), refs.empty() ? NULL : &refs[0], refs.size() );
+		reflector->setField( owner.service, pr.field, refVec );
+		if( pr.migrated )
+			_listener->addChange( owner.service, pr.field, refVec );
+	}
+	_pendingRefs.resize( kept, PendingRef( 0, NULL, NULL, 0 ) );
+
+	_pendingIndex.clear();
+	for( size_t i = 0; i < _pendingRefs.size(); ++i )
+		_pendingIndex[_records[_pendingRefs[i].owner].service].push_back( i );
+
+	// report all objects and services instantiated in this pass
+	for( size_t id = 0; id < _records.size(); ++id )
+	{
+		Record& rec = _records[id];
+		if( rec.state == RS_Created )
+		{
+			rec.state = RS_Loaded;
+			_listener->insertObjectCache( rec.service, static_cast<co::uint32>( id ) );
+		}
+	}
+
+	// references among objects are only needed while some are pending
+	if( _pendingRefs.empty() )
+	{
+		_edges.clear();
+		_refIds.clear();
+	}
+}
+
+co::IService* SpaceLoader::getServiceFor( co::uint32 objectId, co::IInterface* type )
+{
+	// receptacles store the id of the provider object
+	co::IObject* object = static_cast<co::IObject*>( getService( objectId ) );
+	if( !object )
+		return NULL;
+
+	if( object->getInterface()->isSubTypeOf( type ) )
+		return object;
+
+	co::TSlice<co::IPort*> facets = object->getComponent()->getFacets();
+	for( ; facets; facets.popFirst() )
+	{
+		co::IPort* facet = facets.getFirst();
+		if( facet->getType()->isSubTypeOf( type ) )
+			return object->getServiceAt( facet );
+	}
+
+	CORAL_THROW( ca::FormatException, "object " << objectId << " has no facet of type '"
+		<< type->getFullName() << "'" );
+}
+
+co::uint32 SpaceLoader::parseRef( const std::string& value )
+{
+	if( value == "nil" )
+		return 0;
+
+	char* end;
+	const char* str = value.c_str();
+	unsigned long id = strtoul( str + 1, &end, 10 );
+	if( value[0] != '#' || end == str + 1 )
+		CORAL_THROW( ca::FormatException, "invalid reference '" << value << "'" );
+
+	return static_cast<co::uint32>( id );
+}
+
+void SpaceLoader::parseRefVec( const std::string& value, std::vector<co::uint32>& ids )
+{
+	const char* str = value.c_str();
+	if( value.size() < 3 || str[0] != '#' || str[1] != '{' )
+		CORAL_THROW( ca::FormatException, "invalid reference list '" << value << "'" );
+
+	const char* pos = str + 2;
+	for( ;; )
+	{
+		while( *pos == ' ' || *pos == ',' )
+			++pos;
+
+		if( *pos == '}' )
+			break;
+
+		char* end;
+		unsigned long id = strtoul( pos, &end, 10 );
+		if( end == pos )
+			CORAL_THROW( ca::FormatException, "invalid reference list '" << value << "'" );
+
+		ids.push_back( static_cast<co::uint32>( id ) );
+		pos = end;
+	}
+}
+
+} // namespace ca
@@ -0,0 +1,287 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#ifndef _CA_SPACELOADER_H_
+#define _CA_SPACELOADER_H_
+
+#include "StringSerializer.h"
+
+#include <co/IPort.h>
+#include <co/IField.h>
+#include <co/IObject.h>
+#include <ca/IModel.h>
+#include <ca/Migration.h>
+#include <ca/ISpaceStore.h>
+#include <ca/ISpaceLoader.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace ca {
+
+/*
+	Restores the object graph of a space revision directly from a ca.ISpaceStore.
+
+	This is the native counterpart of the 'ca.SpaceLoaderFast' Lua module, and is
+	used whenever the stored revision has no update scripts to apply. Declarative
+	updates (see ca.Migration) are applied to the rows of each object as they are
+	read, and the migrated values are reported to the listener as changes (only for
+	objects that turn out to be reachable, at the end of each pass). Revisions
+	with pending update scripts must still be restored through the Lua loader, which
+	implements the update environment.
+
+	Rows are streamed from a ca.ISpaceStoreCursor and objects are built as soon as
+	their rows arrive; only references (as compact ids) are kept until the end of
+	the revision, when they can finally be resolved.
+
+	When a maximum depth is given, a first pass over the revision collects only the
+	references among objects (and the type of each object), so that just the objects
+	within the given depth from the root are instantiated. References to objects
+	beyond that depth are left pending (null) until loadSubgraph() is called for their
+	owner, which then reads the values of the newly selected objects one by one. The
+	loader keeps all objects it instantiated alive while there are pending references.
+ */
+class SpaceLoader
+{
+public:
+	typedef std::vector<std::pair<co::IService*, co::IMember*> > MemberList;
+
+	// Kinds of updates that a stored revision may be missing.
+	enum PendingUpdates
+	{
+		PU_None,		// the revision is up to date
+		PU_Migrations,	// only declarative updates are pending
+		PU_Scripts		// some update scripts are pending
+	};
+
+	SpaceLoader( ca::IModel* model, StringSerializer& serializer, ca::ISpaceLoader* listener );
+
+	/*
+		Loads the model definitions for all types stored in a \a revision of an open
+		\a store, and tells which updates the revision is missing, without reading values.
+		This decides how the revision must be restored before any object is instantiated.
+	 */
+	PendingUpdates checkUpdates( ca::ISpaceStore* store, co::uint32 revision );
+
+	/*
+		Reads all values stored for a \a revision of an open \a store, instantiating
+		objects and restoring their value fields along the way. Model definitions
+		for all stored types are loaded in the process, and the migrations of
+		pending declarative updates are applied to the rows as they are read.
+		If \a maxDepth is non-zero, only objects up to \a maxDepth references away
+		from the root object are instantiated.
+		\throw ca::IOException if the revision has no values.
+		\throw ca::FormatException if a stored value is malformed.
+	 */
+	void readRevision( ca::ISpaceStore* store, co::uint32 revision, co::uint32 maxDepth );
+
+	/*
+		Whether the read revision has pending updates that must be run by the Lua loader:
+		update scripts, or declarative updates that were only found after rows of the
+		types they migrate had been read.
+	 */
+	bool hasPendingScripts();
+
+	// Whether declarative updates were applied to the read revision.
+	inline bool hasMigrations() const { return !_migratedUpdates.empty(); }
+
+	// The ';'-terminated list of updates applied to the read revision (including migrations).
+	inline const std::string& getUpdateList() const { return _updateList; }
+
+	/*
+		Restores connections and references among the objects instantiated by
+		readRevision(), and reports them to the listener. Returns the root object.
+		Objects that are no longer reachable in the revision are discarded.
+	 */
+	co::IObject* restoreGraph();
+
+	// Whether some references were left pending by a depth-limited restore.
+	inline bool hasPendingRefs() const { return !_pendingIndex.empty(); }
+
+	/*
+		Instantiates the objects referenced by pending references of the object with
+		the given id (or of its services), up to \a maxDepth levels deeper (zero means
+		no limit), reading only their values from a \a revision of an open \a store.
+		The resolved members (ports or fields) of previously loaded services are
+		appended to \a loadedRefs.
+	 */
+	void loadSubgraph( ca::ISpaceStore* store, co::uint32 revision, co::uint32 objectId,
+						co::uint32 maxDepth, MemberList& loadedRefs );
+
+	/*
+		Forgets the pending references of a \a service's \a member (a port or field),
+		e.g. because it was assigned a new value. A NULL \a member means all members.
+	 */
+	void discardPendingRefs( co::IService* service, co::IMember* member );
+
+private:
+	enum RecordState
+	{
+		RS_None,		// no rows read for the id
+		RS_Stored,		// stored but not instantiated
+		RS_Selected,	// selected to be instantiated in the next pass
+		RS_Created,		// instantiated in the current pass
+		RS_Loaded		// instantiated and reported to the listener
+	};
+
+	// Stored object or service.
+	struct Record
+	{
+		co::IService* service;		// restored instance (NULL if not loaded)
+		co::uint32 provider;		// provider's id (services only)
+		co::uint32 firstEdge;		// index of the record's first referenced id in _edges
+		co::uint32 numEdges;		// number of referenced ids
+		co::uint32 type;			// index of the stored type name in _typeNames
+		co::uint8 state;			// a RecordState
+
+		Record() : service( NULL ), provider( 0 ), firstEdge( 0 ), numEdges( 0 ), type( 0 ), state( RS_None )
+		{;}
+	};
+
+	// A port or field whose value is a list of ids, resolved once all ids are loaded.
+	struct PendingRef
+	{
+		co::uint32 owner;		// id of the object or service that owns the member (0 if discarded)
+		co::IPort* port;		// either a port...
+		co::IField* field;		// ...or a field
+		co::uint32 firstId;		// index of the first id in _refIds
+		co::uint32 numIds;
+		bool migrated;			// whether the member was changed by a migration
+
+		PendingRef( co::uint32 owner, co::IPort* port, co::IField* field, co::uint32 firstId )
+			: owner( owner ), port( port ), field( field ), firstId( firstId ), numIds( 0 ), migrated( false )
+		{;}
+	};
+
+	// A change made by a migration, reported only if its record is still reachable.
+	struct MigratedChange
+	{
+		co::uint32 id;			// id of the changed object or service
+		co::IPort* port;		// a migrated facet...
+		co::IField* field;		// ...or value field (neither for a type change)
+		co::IService* facet;	// the service of a migrated facet
+		co::AnyValue value;		// the value of a migrated field
+		std::string typeName;	// the migrated type name
+
+		MigratedChange( co::uint32 id ) : id( id ), port( NULL ), field( NULL ), facet( NULL )
+		{;}
+	};
+
+	typedef void (SpaceLoader::*RowsProcessor)( co::uint32 id );
+
+	// Gets the record for an id, growing the list of records if needed.
+	Record& getRecord( co::uint32 id );
+
+	// Returns the instance restored for an id, or NULL.
+	inline co::IService* getService( co::uint32 id )
+	{
+		return id < _records.size() ? _records[id].service : NULL;
+	}
+
+	// Whether an id is stored but not instantiated.
+	inline bool isPending( co::uint32 id )
+	{
+		return id < _records.size() && _records[id].state == RS_Stored;
+	}
+
+	// Streams the rows of a revision, calling 'processor' for each object or service.
+	void readRows( ca::ISpaceStore* store, co::uint32 revision, RowsProcessor processor );
+
+	// Reads and processes the rows of a single scanned object or service.
+	void readValues( ca::ISpaceStore* store, co::uint32 revision, co::uint32 id );
+
+	// Whether an update is in the list of updates applied to the read revision.
+	bool isApplied( const std::string& update );
+
+	// Returns the index of the row for a field name, or _numRows if there is none.
+	size_t findRow( const std::string& name );
+
+	// Adds a row to the object being read.
+	void addRow( const std::string& name, const std::string& value );
+
+	// Gathers the migrations of pending declarative updates added to the model.
+	void collectMigrations();
+
+	// Applies the pending migrations to the rows of the object being read.
+	void migrateRows();
+
+	// Whether a member of the object being read was changed by a migration.
+	bool isMigrated( const std::string& name );
+
+	// Queues a migration change of the record with the given id.
+	MigratedChange& addMigratedChange( co::uint32 id );
+
+	void scanRows( co::uint32 id );
+	void processRows( co::uint32 id );
+	void processObject( co::uint32 id, const std::string& typeName );
+	void processService( co::uint32 id, const std::string& typeName );
+	PendingRef& addPendingRef( co::uint32 ownerId, co::IPort* port, co::IField* field );
+
+	// Selects the stored objects within \a maxDepth of the \a frontier, appending them to \a selected.
+	void selectObjects( std::vector<co::uint32>& frontier, co::uint32 maxDepth, std::vector<co::uint32>* selected );
+	void discardUnreachable();
+	void finishPass( MemberList* loadedRefs );
+
+	co::IService* getServiceFor( co::uint32 objectId, co::IInterface* type );
+
+	// Parses a "#id" reference; returns 0 for "nil".
+	co::uint32 parseRef( const std::string& value );
+
+	// Parses a "#{id,...}" reference list, appending the ids to 'ids'.
+	void parseRefVec( const std::string& value, std::vector<co::uint32>& ids );
+
+private:
+	ca::IModel* _model;
+	StringSerializer& _serializer;
+	ca::ISpaceLoader* _listener;
+
+	co::uint32 _rootId;
+	std::string _updateList;
+	bool _depthLimited;
+
+	// rows of the object being read
+	size_t _numRows;
+	std::vector<std::string> _fieldNames;
+	std::vector<std::string> _values;
+
+	// type names found while scanning, and their indices
+	std::vector<std::string> _typeNames;
+	std::map<std::string, co::uint32> _typeIds;
+
+	// migration steps of the pending declarative updates, in order
+	size_t _numKnownUpdates;
+	std::vector<ca::Migration> _migrations;
+	std::set<std::string> _migratedUpdates;
+
+	// stored (and migrated) type names whose rows were read
+	std::set<std::string> _readTypes;
+
+	// changes made by migrations to the object being read
+	bool _migratedType;
+	std::vector<std::string> _migratedMembers;
+
+	// changes made by migrations in the current pass, reported by finishPass()
+	std::vector<MigratedChange> _migratedChanges;
+
+	// records indexed by id
+	std::vector<Record> _records;
+	std::vector<co::uint32> _edges;
+
+	std::vector<PendingRef> _pendingRefs;
+	std::vector<co::uint32> _refIds;
+
+	// indices of the pending references in _pendingRefs, by owner service
+	typedef std::map<co::IService*, std::vector<size_t> > PendingIndex;
+	PendingIndex _pendingIndex;
+
+	// keeps all instantiated objects alive
+	std::vector<co::IObjectRef> _objects;
+};
+
+} // namespace ca
+
+#endif // _CA_SPACELOADER_H_
@@ -27,7 +27,9 @@
 #include <set>
 #include <deque>
 
+#include "SpaceLoader.h"
 #include "StringSerializer.h"
+#include "../Universe.h"
 
 namespace ca {
 
@@ -35,10 +37,11 @@ class SpacePersister : public SpacePersister_Base
 {
 	
 public:
-	SpacePersister()
+	SpacePersister() : _loader( NULL )
 	{
 		_trackedRevision = 0;
-		// empty
+		_restoreDepth = 0;
+		_hasMigrations = false;
 	}
 
 	virtual ~SpacePersister()
@@ -48,6 +51,8 @@ public:
 
 		if( _space != NULL && _space->getRootObject() != NULL )
 			_space->removeGraphObserver( this );
+
+		delete _loader;
 	}
 
 	// ------ ca.ISpaceObserver Methods ------ //
@@ -56,7 +61,7 @@ public:
 	{
 		co::TSlice<co::IObject*> addedObjects = changes->getAddedObjects();
 		for( ; addedObjects; addedObjects.popFirst() )
-			_addedObjects.insert( addedObjects.getFirst() );
+			insertNewObject( addedObjects.getFirst() );
 
 		co::TSlice<ca::IObjectChanges*> changedObjects = changes->getChangedObjects();
 		for( ; changedObjects; changedObjects.popFirst() )
@@ -66,7 +71,7 @@ public:
 			// if changes have been made on an added object, there's no need
 			// to register these changes (updating the object is enough)
 			co::IObject* object = objectChanges->getObject();
-			ObjectSet::iterator it = _addedObjects.find( object );
+			AddedObjectMap::iterator it = _addedObjects.find( object );
 			if( it != _addedObjects.end() )
 				continue;
 
@@ -78,6 +83,8 @@ public:
 				{
 					const ca::ChangedConnection& cc = changedConnections.getFirst();
 					cs[cc.receptacle.get()] = cc.current.get();
+					if( _loader )
+						_loader->discardPendingRefs( object, cc.receptacle.get() );
 				}
 			}
 
@@ -94,11 +101,19 @@ public:
 
 				co::TSlice<ca::ChangedRefField> changedRefs = changes->getChangedRefFields();
 				for( ; changedRefs; changedRefs.popFirst() )
+				{
 					cs[changedRefs.getFirst().field.get()] = changedRefs.getFirst().current;
+					if( _loader )
+						_loader->discardPendingRefs( service, changedRefs.getFirst().field.get() );
+				}
 
 				co::TSlice<ca::ChangedRefVecField> changedRefVecs = changes->getChangedRefVecFields();
 				for( ; changedRefVecs; changedRefVecs.popFirst() )
+				{
 					cs[changedRefVecs.getFirst().field.get()] = changedRefVecs.getFirst().current;
+					if( _loader )
+						_loader->discardPendingRefs( service, changedRefVecs.getFirst().field.get() );
+				}
 			}
 
 			co::TSlice<co::IObject*> removedObjects = changes->getRemovedObjects();
@@ -106,13 +121,22 @@ public:
 			{
 				co::IObject* removedObj = removedObjects.getFirst();
 
-				// ignore changes for objects removed from the graph
+				// ignore changes for objects removed from the graph; objects added by
+				// queued saves are kept, as they are still part of those revisions
 				_addedObjects.erase( removedObj );
-				_changeCache.erase( removedObj );
+				eraseChanges( removedObj );
+
+				if( _loader )
+					_loader->discardPendingRefs( removedObj, NULL );
 
 				co::TSlice<co::IPort*> ports = removedObj->getComponent()->getPorts();
 				for( ; ports; ports.popFirst() )
-					_changeCache.erase( removedObj->getServiceAt( ports.getFirst() ) );
+				{
+					co::IService* removedService = removedObj->getServiceAt( ports.getFirst() );
+					eraseChanges( removedService );
+					if( _loader )
+						_loader->discardPendingRefs( removedService, NULL );
+				}
 			}
 		}
 	}
@@ -131,7 +155,7 @@ public:
 
 	void insertNewObject( co::IService* obj )
 	{
-		_addedObjects.insert( obj );
+		_addedObjects.insert( AddedObjectMap::value_type( obj, obj ) );
 	}
 
 	void addChange( co::IService* service, co::IMember* member, const co::Any& newValue )
@@ -177,20 +201,21 @@ public:
 		try
 		{
 			_spaceStore->beginChanges();
-			saveObject( rootObject );
+			saveObject( rootObject, NULL );
+			flushValues();
 			_spaceStore->setRootObject( getObjectId(rootObject) );
 
 			co::TSlice<std::string> updates = _model->getUpdates();
-			std::stringstream updateList;
+			_updateList.clear();
 
 			for( int i = 0; i < updates.getSize(); ++i )
-				updateList << updates[i] << ";";
+				_updateList.append( updates[i] ).push_back( ';' );
 
-			_updateList = updateList.str();
 			_spaceStore->commitChanges( _updateList );
 		}
 		catch( ... )
 		{
+			clearBatch();
 			_spaceStore->discardChanges();
 			_spaceStore->close();
 			throw;
@@ -234,78 +259,146 @@ public:
 			throw co::IllegalArgumentException( "empty space store" );
 		}
 
-		_spaceStore->close();
-
 		try
 		{
 			clear();
 			_trackedRevision = revision;
-			restoreLua( _trackedRevision );
+
+			// restore natively unless there are update scripts to apply
+			_loader = new SpaceLoader( _model.get(), _serializer, this );
+			SpaceLoader::PendingUpdates pending = _loader->checkUpdates( _spaceStore.get(), revision );
+
+			// migrated references can only be saved once loaded, so the depth is ignored
+			if( pending != SpaceLoader::PU_Scripts )
+				_loader->readRevision( _spaceStore.get(), revision,
+					pending == SpaceLoader::PU_Migrations ? 0 : _restoreDepth );
+			_spaceStore->close();
+
+			// scripts can still be found late, in the CaModels of migrated types
+			if( pending == SpaceLoader::PU_Scripts || _loader->hasPendingScripts() )
+			{
+				// also drops the changes reported by migrations, which the Lua loader redoes
+				clear();
+				restoreLua( _trackedRevision );
+				_hasMigrations = true;
+			}
+			else
+			{
+				_hasMigrations = _loader->hasMigrations();
+				restoreNative();
+			}
 		}
 		catch( ... )
 		{
+			releaseLoader();
 			_spaceStore->close();
 			throw;
 		}
 	}
 
-	void save()
+	void loadSubgraph( co::IObject* object )
 	{
-		if( _trackedRevision != _spaceStore->getLatestRevision() )
-			CORAL_THROW( ca::IOException, "attempt to save changes in an intermediary revision" );
+		if( !object )
+			throw co::IllegalArgumentException( "illegal null object" );
 
-		std::vector<std::string> fieldNames;
-		std::vector<std::string> values;
-		_spaceStore->open();
+		if( _space == NULL )
+			throw co::IllegalStateException( "space was not restored" );
+
+		// objects added after the restore have no pending references
+		co::uint32 objectId = getObjectId( object );
+		if( !_loader || objectId == 0 )
+			return;
 
+		SpaceLoader::MemberList loadedRefs;
+		_spaceStore->open();
 		try
 		{
-			_spaceStore->beginChanges();
-			ChangeSet newChangeSet;
-			for( ObjectSet::iterator it = _addedObjects.begin(); it != _addedObjects.end(); it++ )
-			{
-				co::IService* service = *it;
-				IObject* object = service->getProvider();
+			_loader->loadSubgraph( _spaceStore.get(), _trackedRevision, objectId, _restoreDepth, loadedRefs );
+		}
+		catch( ... )
+		{
+			_spaceStore->close();
+			throw;
+		}
+		_spaceStore->close();
 
-				if( static_cast<IObject*>( service ) == object )
-				{
-					saveObject( object );
-					if( object == _space->getRootObject() )
-						_spaceStore->setRootObject( getObjectId( object ) );
-				}
-				else
-				{
-					co::IPort* facet = service->getFacet();
-					co::uint32 providerId = getObjectId( service->getProvider() );
-					saveService( service, facet, providerId );
+		// resolved references are stored by the space without being notified as changes
+		if( !Universe::loadRefs( _space.get(), loadedRefs ) )
+			throw co::IllegalStateException( "space is not managed by a ca.Universe" );
 
-					addRefChange( service->getProvider(), facet, service );
-				}
-			}
+		if( !_loader->hasPendingRefs() )
+			releaseLoader();
+	}
 
-			for( ChangeSetCache::iterator it = _changeCache.begin(); it != _changeCache.end(); ++it )
-			{
-				co::uint32 objectId = getObjectId( it->first );
-				for( ChangeSet::iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2 )
-					saveChange( it2->first, it2->second.getAny().asIn(), fieldNames, values );
+	void save()
+	{
+		queueSave();
+		flushSaves();
+	}
 
-				_spaceStore->addValues( objectId, fieldNames, values );
-				fieldNames.clear();
-				values.clear();
+	bool migrate()
+	{
+		// offline use: the latest revision is restored just to be migrated
+		if( _space == NULL )
+			restore();
+
+		if( !_hasMigrations )
+			return false;
+
+		save();
+		return true;
+	}
+
+	void queueSave()
+	{
+		// swap the change caches out, leaving them empty for the next save
+		_pendingSaves.push_back( PendingSave() );
+		PendingSave& pending = _pendingSaves.back();
+		pending.addedObjects.swap( _addedObjects );
+		pending.changes.swap( _changeCache );
+
+		// added objects are written from their state at this point, not when flushed
+		for( AddedObjectMap::iterator it = pending.addedObjects.begin(); it != pending.addedObjects.end(); ++it )
+			captureValues( it->first, pending.addedValues );
+	}
+
+	co::uint32 getPendingSaves()
+	{
+		return static_cast<co::uint32>( _pendingSaves.size() );
+	}
+
+	void flushSaves()
+	{
+		if( _pendingSaves.empty() )
+			return;
+
+		_spaceStore->open();
+
+		try
+		{
+			while( !_pendingSaves.empty() )
+			{
+				writeSave();
+				_pendingSaves.pop_front();
 			}
-			_spaceStore->commitChanges( _updateList );
-			_spaceStore->close();
-			_trackedRevision++;
 		}
 		catch( ... )
 		{
-			_spaceStore->discardChanges();
 			_spaceStore->close();
 			throw;
 		}
 
-		_addedObjects.clear();
-		_changeCache.clear();
+		_spaceStore->close();
+	}
+
+	co::uint32 getRestoreDepth()
+	{
+		return _restoreDepth;
+	}
+
+	void setRestoreDepth( co::uint32 restoreDepth )
+	{
+		_restoreDepth = restoreDepth;
 	}
 
 protected:
@@ -367,14 +460,202 @@ private:
 		_space->notifyChanges();
 	}
 
+	void restoreNative()
+	{
+		co::IObjectRef spaceObj = co::newInstance( "ca.Space" );
+		spaceObj->setService( "universe", _universe.get() );
+		_space = spaceObj->getService<ca::ISpace>();
+
+		_space->initialize( _loader->restoreGraph() );
+		_space->notifyChanges();
+
+		_updateList = _loader->getUpdateList();
+
+		_space->addGraphObserver( this );
+
+		// the loader is only kept while there are references to load
+		if( !_loader->hasPendingRefs() )
+			releaseLoader();
+	}
+
+	void releaseLoader()
+	{
+		delete _loader;
+		_loader = NULL;
+	}
+
+	// Drops the changes to a service from the current and the queued saves.
+	void eraseChanges( co::IService* service )
+	{
+		_changeCache.erase( service );
+		for( PendingSaveQueue::iterator it = _pendingSaves.begin(); it != _pendingSaves.end(); ++it )
+			it->changes.erase( service );
+	}
+
 	// Save functions
 
+	// Writes the first queued save as a new revision of the open store.
+	void writeSave()
+	{
+		PendingSave& pending = _pendingSaves.front();
+
+		if( _trackedRevision != _spaceStore->getLatestRevision() )
+			CORAL_THROW( ca::IOException, "attempt to save changes in an intermediary revision" );
+
+		try
+		{
+			_spaceStore->beginChanges();
+			for( AddedObjectMap::iterator it = pending.addedObjects.begin(); it != pending.addedObjects.end(); it++ )
+			{
+				co::IService* service = it->first;
+				IObject* object = service->getProvider();
+
+				if( static_cast<IObject*>( service ) == object )
+				{
+					saveObject( object, &pending.addedValues );
+					if( object == _space->getRootObject() )
+						_spaceStore->setRootObject( getObjectId( object ) );
+				}
+				else
+				{
+					co::IPort* facet = service->getFacet();
+					co::uint32 providerId = getObjectId( service->getProvider() );
+					saveService( service, facet, providerId, &pending.addedValues );
+
+					pending.changes[service->getProvider()][facet] = service;
+				}
+			}
+
+			for( ChangeSetCache::iterator it = pending.changes.begin(); it != pending.changes.end(); ++it )
+			{
+				co::uint32 objectId = getObjectId( it->first );
+				for( ChangeSet::iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2 )
+					saveChange( objectId, it2->first, it2->second.getAny().asIn() );
+			}
+			flushValues();
+			_spaceStore->commitChanges( _updateList );
+			_trackedRevision++;
+
+			// the updates applied by the restore are now part of the stored revisions
+			_hasMigrations = false;
+		}
+		catch( ... )
+		{
+			clearBatch();
+			_spaceStore->discardChanges();
+			throw;
+		}
+	}
+
+
+	// Appends the decimal representation of an id to a string.
+	static void appendId( std::string& str, co::uint32 id )
+	{
+		char buffer[16];
+		char* end = buffer + sizeof(buffer);
+		char* pos = end;
+		do
+		{
+			*--pos = '0' + static_cast<char>( id % 10 );
+			id /= 10;
+		}
+		while( id );
+		str.append( pos, end );
+	}
 
-	#define TO_STR( strVar, ostreamStuff ) \
-		{ std::stringstream ss; ss << ostreamStuff; \
-			ss.str().swap( strVar ); }
+	// Formats a reference to a service as "#id", or "nil".
+	void formatRef( co::IService* service, std::string& result )
+	{
+		if( service == NULL )
+		{
+			result = "nil";
+			return;
+		}
+		result = "#";
+		appendId( result, getObjectId( service ) );
+	}
+
+	// Formats a list of references as "#{id1,id2,...}".
+	void formatRefVec( co::Slice<co::IService*> refs, std::string& result )
+	{
+		result = "#{";
+		for( bool first = true; refs; refs.popFirst(), first = false )
+		{
+			if( !first )
+				result.push_back( ',' );
+			appendId( result, getObjectId( refs.getFirst() ) );
+		}
+		result.push_back( '}' );
+	}
+
+	// Queues a value to be written by the next flushValues().
+	inline void addValue( co::uint32 id, const std::string& fieldName, const std::string& value )
+	{
+		_batchIds.push_back( id );
+		_batchNames.push_back( fieldName );
+		_batchValues.push_back( value );
+	}
 
-	co::uint32 saveService( co::IService* service, co::IPort* port, co::uint32 providerId )
+	// Writes all queued values with a single store call.
+	void flushValues()
+	{
+		if( !_batchIds.empty() )
+			_spaceStore->addValuesBatch( _batchIds, _batchNames, _batchValues );
+		clearBatch();
+	}
+
+	void clearBatch()
+	{
+		_batchIds.clear();
+		_batchNames.clear();
+		_batchValues.clear();
+	}
+
+	// Copies the values of an added object (or service) into \a values, to be written later.
+	void captureValues( co::IService* service, ChangeSetCache& values )
+	{
+		co::IObject* object = service->getProvider();
+		if( static_cast<IObject*>( service ) != object )
+		{
+			captureFields( service, service->getFacet()->getType(), values[service] );
+			return;
+		}
+
+		std::vector<co::IPortRef> ports;
+		_model->getPorts( object->getComponent(), ports );
+
+		ChangeSet& cs = values[object];
+		for( size_t i = 0; i < ports.size(); ++i )
+		{
+			co::IPort* port = ports[i].get();
+			co::IService* portService = object->getServiceAt( port );
+			cs[port] = portService;
+			if( port->getIsFacet() )
+				captureFields( portService, port->getType(), values[portService] );
+		}
+	}
+
+	void captureFields( co::IService* service, co::IInterface* type, ChangeSet& cs )
+	{
+		std::vector<co::IFieldRef> fields;
+		_model->getFields( type, fields );
+		for( size_t i = 0; i < fields.size(); ++i )
+		{
+			co::IField* field = fields[i].get();
+			field->getOwner()->getReflector()->getField( service, field, cs[field] );
+		}
+	}
+
+	// Returns the values captured for a service, or NULL if they must be read from the service.
+	static ChangeSet* findCaptured( ChangeSetCache* captured, co::IService* service )
+	{
+		if( !captured )
+			return NULL;
+		ChangeSetCache::iterator it = captured->find( service );
+		return it == captured->end() ? NULL : &it->second;
+	}
+
+	co::uint32 saveService( co::IService* service, co::IPort* port, co::uint32 providerId, ChangeSetCache* captured )
 	{
 		co::uint32 id = getObjectId( service );
 		if( id != 0 )
@@ -388,60 +669,52 @@ private:
 		std::vector<co::IFieldRef> fields;
 		_model->getFields(type, fields);
 
-		std::vector<std::string> fieldNames;
-		std::vector<std::string> values;
-
 		std::string valueStr;
+		ChangeSet* capturedValues = findCaptured( captured, service );
 
 		for( size_t i = 0; i < fields.size(); ++i )
 		{
 			co::IField* field = fields[i].get();
 
 			co::AnyValue value;
-			co::IReflector* reflector = field->getOwner()->getReflector();
-			reflector->getField( service, field, value );
+			if( capturedValues )
+			{
+				value = (*capturedValues)[field];
+			}
+			else
+			{
+				co::IReflector* reflector = field->getOwner()->getReflector();
+				reflector->getField( service, field, value );
+			}
 
 			co::TypeKind kind = value.getKind();
 			if ( kind == co::TK_INTERFACE )
 			{
 				co::IService* service = value.get<co::IService*>();
-				if( service == NULL )
-				{
-					valueStr = "nil";
-				}
-				else
-				{
-					saveObject( service->getProvider() );
-					TO_STR( valueStr, "#" << getObjectId( service ) );
-				}
+				if( service != NULL )
+					saveObject( service->getProvider(), captured );
+				formatRef( service, valueStr );
 			}
 			else if( kind == co::TK_ARRAY &&
 				static_cast<co::IArray*>( value.getType() )->
 					getElementType()->getKind() == co::TK_INTERFACE  )
 			{
-				std::vector<co::uint32> refIds;
 				co::Slice<co::IService*> refs = value.get<co::Slice<co::IService*> >();
-				for( ; refs; refs.popFirst() )
-				{
-					co::IService* s = refs.getFirst();
-					saveObject( s->getProvider() );
-					refIds.push_back( getObjectId( s ) );
-				}
-				TO_STR( valueStr, "#" << refIds );
+				for( co::Slice<co::IService*> it = refs; it; it.popFirst() )
+					saveObject( it.getFirst()->getProvider(), captured );
+				formatRefVec( refs, valueStr );
 			}
 			else
 			{
 				_serializer.toString( value.getAny(), valueStr );
 			}
-			fieldNames.push_back( field->getName() );
-			values.push_back( valueStr );
+			addValue( id, field->getName(), valueStr );
 		}
 
-		_spaceStore->addValues( id, fieldNames, values );
 		return id;
 	}
 
-	co::uint32 saveObject( co::IObject* object )
+	co::uint32 saveObject( co::IObject* object, ChangeSetCache* captured )
 	{
 		co::uint32 id = getObjectId( object );
 		if( id != 0 )
@@ -451,31 +724,29 @@ private:
 		id = _spaceStore->addObject( component->getFullName() );
 		insertObjectCache( object, id );
 
-		std::vector<std::string> values;
-		std::vector<std::string> fieldNames;
-
 		std::vector<co::IPortRef> ports;
+		std::string valueStr;
 
 		_model->getPorts( component, ports );
+		ChangeSet* capturedValues = findCaptured( captured, object );
 
 		for( size_t i = 0; i < ports.size(); ++i )
 		{
 			co::IPort* port = ports[i].get();
-			co::IService* service = object->getServiceAt( port );
+			co::IService* service = capturedValues ?
+				(*capturedValues)[port].get<co::IService*>() : object->getServiceAt( port );
 
 			co::uint32 refId;
 			if( port->getIsFacet() )
-				refId = saveService( service, port, id );
+				refId = saveService( service, port, id, captured );
 			else
-				refId = saveObject( service->getProvider() );
+				refId = saveObject( service->getProvider(), captured );
 
-			std::stringstream ss;
-			ss << "#" << refId;
-			values.push_back( ss.str() );
-			fieldNames.push_back( port->getName() );
+			valueStr = "#";
+			appendId( valueStr, refId );
+			addValue( id, port->getName(), valueStr );
 		}
 
-		_spaceStore->addValues( id, fieldNames, values );
 		return id;
 	}
 
@@ -489,18 +760,18 @@ private:
 	{
 		_changeCache.clear();
 		_addedObjects.clear();
+		_pendingSaves.clear();
 		_objectIdCache.clear();
+		_hasMigrations = false;
+		releaseLoader();
 	}
 
-	void saveChange( co::IMember* member, const co::Any& value,
-		std::vector<std::string>& fieldNames,
-		std::vector<std::string>& values )
+	void saveChange( co::uint32 objectId, co::IMember* member, const co::Any& value )
 	{
 		// a NULL member signals an object type change
 		if( member == NULL )
 		{
-			fieldNames.push_back( "_type" );
-			values.push_back( value.get<const std::string&>() );
+			addValue( objectId, "_type", value.get<const std::string&>() );
 			return;
 		}
 
@@ -510,36 +781,38 @@ private:
 		std::string valueStr;
 		if( kind == co::TK_INTERFACE )
 		{
-			co::IService* service = value.get<co::IService*>();
-			if( service == NULL )
-				valueStr = "nil";
-			else
-				TO_STR( valueStr, "#" << getObjectId( service ) );
+			formatRef( value.get<co::IService*>(), valueStr );
 		}
 		else if( kind == co::TK_ARRAY && static_cast<co::IArray*>( value.getType() )->getElementType()->getKind() == co::TK_INTERFACE )
 		{
-			std::vector<co::uint32> refIds;
-			co::Slice<co::IService*> refs = value.get<co::Slice<co::IService*> >();
-			for( ; refs; refs.popFirst() )
-				refIds.push_back( getObjectId( refs.getFirst() ) );
-			TO_STR( valueStr, "#" << refIds );
+			formatRefVec( value.get<co::Slice<co::IService*> >(), valueStr );
 		}
 		else 
 		{
 			_serializer.toString( value, valueStr );
 		}
-		fieldNames.push_back( member->getName() );
-		values.push_back( valueStr );
+		addValue( objectId, member->getName(), valueStr );
 	}
 
 private:
 	typedef std::map<const std::string, std::string> FieldValueMap;
 	typedef std::map<co::IService*, co::uint32> ObjectIdMap;
 
-	typedef std::set<co::IService*> ObjectSet;
+	// added objects are kept alive until saved, even if removed from the graph
+	typedef std::map<co::IService*, co::IServiceRef> AddedObjectMap;
 	typedef std::map<co::IMember*, co::AnyValue> ChangeSet;
 	typedef std::map<co::IService*, ChangeSet> ChangeSetCache;
 
+	// changes captured by queueSave(), waiting to be written
+	struct PendingSave
+	{
+		AddedObjectMap addedObjects;
+		ChangeSetCache changes;
+		ChangeSetCache addedValues;	// values of the added objects and their facets when queued
+	};
+
+	typedef std::deque<PendingSave> PendingSaveQueue;
+
 private:
 	ca::ISpaceRef _space;
 	ca::IUniverseRef _universe;
@@ -551,10 +824,23 @@ private:
 	co::uint32 _trackedRevision;
 	std::string _updateList;
 
+	// whether the restore applied updates that were not saved yet
+	bool _hasMigrations;
+
+	// loader kept while a depth-limited restore has pending references
+	SpaceLoader* _loader;
+	co::uint32 _restoreDepth;
+
 	ObjectIdMap _objectIdCache;
 
 	ChangeSetCache _changeCache;
-	ObjectSet _addedObjects;
+	AddedObjectMap _addedObjects;
+	PendingSaveQueue _pendingSaves;
+
+	// values queued for a single addValuesBatch() call
+	std::vector<co::uint32> _batchIds;
+	std::vector<std::string> _batchNames;
+	std::vector<std::string> _batchValues;
 };
 
 CORAL_EXPORT_COMPONENT( SpacePersister, SpacePersister );
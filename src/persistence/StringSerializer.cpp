@@ -1,13 +1,71 @@
 #include "StringSerializer.h"
+#include "ValueBuffer.h"
 
+#include <co/Platform.h>
+#include <co/IEnum.h>
+#include <co/IArray.h>
 #include <co/IField.h>
 #include <co/IReflector.h>
 #include <co/IllegalArgumentException.h>
-#include <sstream>
-#include <locale>
+#include <ca/FormatException.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <clocale>
+
+#if defined(__APPLE__)
+	#include <xlocale.h>
+#endif
 
 namespace ca {
 
+/*
+	Reals are converted with the "C" locale, so a '.' is always the decimal point,
+	whatever the locale of the process (and without switching it for other threads).
+ */
+#if defined(CORAL_OS_WIN)
+
+static _locale_t getCLocale()
+{
+	static _locale_t s_locale = _create_locale( LC_NUMERIC, "C" );
+	return s_locale;
+}
+
+static double parseReal( const char* str, char** end )
+{
+	return _strtod_l( str, end, getCLocale() );
+}
+
+static int formatReal( char* buffer, size_t size, int precision, double value )
+{
+	return _snprintf_l( buffer, size, "%.*g", getCLocale(), precision, value );
+}
+
+#else
+
+static locale_t getCLocale()
+{
+	static locale_t s_locale = newlocale( LC_NUMERIC_MASK, "C", static_cast<locale_t>( 0 ) );
+	return s_locale;
+}
+
+static double parseReal( const char* str, char** end )
+{
+	return strtod_l( str, end, getCLocale() );
+}
+
+static int formatReal( char* buffer, size_t size, int precision, double value )
+{
+	// the locale is only switched for the calling thread
+	locale_t previous = uselocale( getCLocale() );
+	int len = snprintf( buffer, size, "%.*g", precision, value );
+	uselocale( previous );
+	return len;
+}
+
+#endif
+
 StringSerializer::StringSerializer()
 {
 	_model = NULL;
@@ -16,88 +74,540 @@ StringSerializer::StringSerializer()
 void StringSerializer::setModel( ca::IModel* model )
 {
 	_model = model;
+	_fieldCache.clear();
 }
 
 void StringSerializer::toString( co::Any value, std::string& result )
 {
-	std::stringstream ss;
-	streamOut( ss, value );
-	ss.str().swap( result );
+	// the result's storage is reused as the output buffer
+	result.clear();
+	write( result, value );
 }
 
-void StringSerializer::streamOut( std::stringstream& ss, co::Any var )
+void StringSerializer::write( std::string& out, co::Any var )
 {
 	var = var.asIn();
 	co::TypeKind kind = var.getKind();
-	if( co::isScalar( kind ) )
-		ss << var;
-	else if( kind == co::TK_STRING )
-		writeString( ss, var.get<const std::string&>() );
-	else if( co::isComplexValue( kind ) )
-		writeRecord( ss, var );
-	else if( kind == co::TK_ARRAY )
-		writeArray( ss, var );
-	else
+	switch( kind )
+	{
+	case co::TK_BOOL:		out.append( var.get<bool>() ? "true" : "false" ); break;
+	case co::TK_INT8:		writeInteger( out, var.get<co::int8>() ); break;
+	case co::TK_INT16:		writeInteger( out, var.get<co::int16>() ); break;
+	case co::TK_INT32:		writeInteger( out, var.get<co::int32>() ); break;
+	case co::TK_UINT8:		writeInteger( out, var.get<co::uint8>() ); break;
+	case co::TK_UINT16:		writeInteger( out, var.get<co::uint16>() ); break;
+	case co::TK_UINT32:		writeInteger( out, var.get<co::uint32>() ); break;
+	case co::TK_FLOAT:		writeFloat( out, var.get<float>() ); break;
+	case co::TK_DOUBLE:		writeDouble( out, var.get<double>() ); break;
+	case co::TK_ENUM:		writeEnum( out, static_cast<co::IEnum*>( var.getType() ), var.get<co::int32>() ); break;
+	case co::TK_STRING:		writeString( out, var.get<const std::string&>() ); break;
+	case co::TK_STRUCT:
+	case co::TK_NATIVECLASS:
+		writeRecord( out, var );
+		break;
+	case co::TK_ARRAY:		writeArray( out, var ); break;
+	default:
 		CORAL_THROW( co::IllegalArgumentException, "cannot serialize " << kind << " variables" );
+	}
+}
+
+void StringSerializer::writeInteger( std::string& out, co::int32 value )
+{
+	if( value < 0 )
+	{
+		out.push_back( '-' );
+		// negate in unsigned arithmetic, which is defined for MIN_INT32
+		writeInteger( out, static_cast<co::uint32>( 0 ) - static_cast<co::uint32>( value ) );
+	}
+	else
+	{
+		writeInteger( out, static_cast<co::uint32>( value ) );
+	}
 }
 
-inline bool mustBeEscaped( const std::string& str )
+void StringSerializer::writeInteger( std::string& out, co::uint32 value )
 {
-	size_t size = str.size();
-	for( size_t i = 0; i < size; ++i )
+	char buffer[16];
+	char* end = buffer + sizeof(buffer);
+	char* pos = end;
+	do
 	{
-		char c = str[i];
-		std::locale loc( "Portuguese_Brazil" );
-		if( c == '\'' || std::iscntrl( c, loc ) || c == '\\' )
+		*--pos = '0' + static_cast<char>( value % 10 );
+		value /= 10;
+	}
+	while( value );
+	out.append( pos, end );
+}
+
+// Floats are written with the fewest digits that read back as the same float.
+void StringSerializer::writeFloat( std::string& out, float value )
+{
+	char buffer[32];
+	int len = 0;
+	for( int precision = 6; precision <= 9; ++precision )
+	{
+		len = formatReal( buffer, sizeof(buffer), precision, value );
+		if( static_cast<float>( parseReal( buffer, NULL ) ) == value )
+			break;
+	}
+	out.append( buffer, len );
+}
+
+// Doubles are written with the fewest digits (from 15 up) that read back as the same double.
+void StringSerializer::writeDouble( std::string& out, double value )
+{
+	char buffer[32];
+	int len = 0;
+	for( int precision = 15; precision <= 17; ++precision )
+	{
+		len = formatReal( buffer, sizeof(buffer), precision, value );
+		if( parseReal( buffer, NULL ) == value )
+			break;
+	}
+	out.append( buffer, len );
+}
+
+void StringSerializer::writeEnum( std::string& out, co::IEnum* type, co::int32 value )
+{
+	co::TSlice<std::string> ids = type->getIdentifiers();
+	if( value < 0 || static_cast<size_t>( value ) >= ids.getSize() )
+		CORAL_THROW( co::IllegalArgumentException, "invalid value " << value << " for enum '" << type->getFullName() << "'" );
+	out.append( ids[value] );
+}
+
+/*
+	Whether a string needs a long-bracket literal, i.e. it has a quote, a backslash or
+	a control character. Long strings are scanned 8 bytes at a time.
+ */
+static bool mustBeEscaped( const std::string& str )
+{
+	const co::uint64 ONES = 0x0101010101010101ULL;
+	const co::uint64 HIGHS = 0x8080808080808080ULL;
+
+	const char* pos = str.data();
+	const char* end = pos + str.size();
+
+	for( ; end - pos >= 8; pos += 8 )
+	{
+		co::uint64 word;
+		memcpy( &word, pos, 8 );
+
+		// sets the high bit of each byte that is below 0x20, or equal to '\'', '\\' or DEL
+		co::uint64 quote = word ^ ( ONES * '\'' );
+		co::uint64 backslash = word ^ ( ONES * '\\' );
+		co::uint64 del = word ^ ( ONES * 0x7F );
+		co::uint64 found = ( ( word - ONES * 0x20 ) & ~word )
+			| ( ( quote - ONES ) & ~quote )
+			| ( ( backslash - ONES ) & ~backslash )
+			| ( ( del - ONES ) & ~del );
+
+		if( found & HIGHS )
+			return true;
+	}
+
+	for( ; pos < end; ++pos )
+	{
+		unsigned char c = static_cast<unsigned char>( *pos );
+		if( c < 0x20 || c == '\'' || c == '\\' || c == 0x7F )
 			return true;
 	}
+
 	return false;
 }
 
-void StringSerializer::writeString( std::stringstream& ss, const std::string& str )
+void StringSerializer::writeString( std::string& out, const std::string& str )
 {
 	if( mustBeEscaped( str ) )
-		ss << "[=[" << str << "]=]";
+		out.append( "[=[" ).append( str ).append( "]=]" );
 	else
-		ss << "'" << str << "'";
+		out.append( 1, '\'' ).append( str ).append( 1, '\'' );
 }
 
-void StringSerializer::writeRecord( std::stringstream& ss, const co::Any& var )
+const std::vector<co::IFieldRef>& StringSerializer::getFields( co::IRecordType* type )
 {
 	assert( _model != NULL );
 
-	std::vector<co::IFieldRef> fields;
-	_model->getFields( static_cast<co::IRecordType*>( var.getType() ), fields );
+	FieldCache::iterator it = _fieldCache.find( type );
+	if( it == _fieldCache.end() )
+	{
+		it = _fieldCache.insert( FieldCache::value_type( type, std::vector<co::IFieldRef>() ) ).first;
+		_model->getFields( type, it->second );
+	}
+	return it->second;
+}
+
+void StringSerializer::writeRecord( std::string& out, const co::Any& var )
+{
+	const std::vector<co::IFieldRef>& fields = getFields( static_cast<co::IRecordType*>( var.getType() ) );
 
 	co::IReflector* reflector = var.getType()->getReflector();
 	co::AnyValue value;
 
-	ss << "{";
+	out.push_back( '{' );
 	for( size_t i = 0; i < fields.size(); ++i )
 	{
 		if( i > 0 )
-			ss << ",";
+			out.push_back( ',' );
 
 		co::IField* field = fields[i].get();
-		ss << field->getName() << "=";
+		out.append( field->getName() ).push_back( '=' );
 
 		reflector->getField( var, field, value );
-		streamOut( ss, value.getAny() );
+		write( out, value.getAny() );
 	}
-	ss << "}";
+	out.push_back( '}' );
 }
 
-void StringSerializer::writeArray( std::stringstream& ss, const co::Any& array )
+void StringSerializer::writeArray( std::string& out, const co::Any& array )
 {
-	ss << "{";
+	out.push_back( '{' );
 	size_t count = array.getCount();
 	for( size_t i = 0; i < count; ++i )
 	{
 		if( i > 0 )
-			ss << ",";
-		streamOut( ss, array[i] );
+			out.push_back( ',' );
+		write( out, array[i] );
+	}
+	out.push_back( '}' );
+}
+
+/******************************************************************************/
+/* Deserialization                                                            */
+/******************************************************************************/
+
+/*
+	Recursive-descent parser for the Lua-like strings produced by StringSerializer.
+	Values are written straight into the memory of default-constructed instances.
+ */
+class ValueReader
+{
+public:
+	ValueReader( ca::IModel* model, const std::string& str ) : _model( model ), _str( str )
+	{
+		_pos = _str.c_str();
+		_end = _pos + _str.size();
 	}
-	ss << "}";
+
+	// Reads a value of any type into 'result'.
+	void read( co::IType* type, co::AnyValue& result )
+	{
+		if( type->getKind() == co::TK_ARRAY )
+		{
+			co::IType* elementType = static_cast<co::IArray*>( type )->getElementType();
+			size_t count = countElements();
+			ValueBuffer buffer( elementType, count );
+			readElements( elementType, buffer, count );
+			result = co::Any( true, type, buffer.getData(), count );
+		}
+		else
+		{
+			ValueBuffer buffer( type, 1 );
+			readValue( type, buffer.at( 0 ) );
+			result = co::Any( true, type, buffer.at( 0 ) );
+		}
+	}
+
+	// Reads a value and assigns it to a field of 'instance'.
+	void readField( const co::Any& instance, co::IField* field )
+	{
+		co::IType* type = field->getType();
+		co::IReflector* reflector = field->getOwner()->getReflector();
+		if( type->getKind() == co::TK_ARRAY )
+		{
+			co::IType* elementType = static_cast<co::IArray*>( type )->getElementType();
+			size_t count = countElements();
+			ValueBuffer buffer( elementType, count );
+			readElements( elementType, buffer, count );
+			reflector->setField( instance, field, co::Any( true, type, buffer.getData(), count ) );
+		}
+		else
+		{
+			ValueBuffer buffer( type, 1 );
+			readValue( type, buffer.at( 0 ) );
+			reflector->setField( instance, field, co::Any( true, type, buffer.at( 0 ) ) );
+		}
+	}
+
+	// Checks that the whole string has been consumed.
+	void finish()
+	{
+		skipSpaces();
+		if( _pos != _end )
+			raise( "unexpected trailing characters" );
+	}
+
+private:
+	// Reads a single value of a non-array type into the memory at 'ptr'.
+	void readValue( co::IType* type, void* ptr )
+	{
+		co::TypeKind kind = type->getKind();
+		switch( kind )
+		{
+		case co::TK_BOOL:		*reinterpret_cast<bool*>( ptr ) = readBool(); break;
+		case co::TK_INT8:		readNumber<co::int8>( ptr ); break;
+		case co::TK_INT16:		readNumber<co::int16>( ptr ); break;
+		case co::TK_INT32:		readNumber<co::int32>( ptr ); break;
+		case co::TK_UINT8:		readNumber<co::uint8>( ptr ); break;
+		case co::TK_UINT16:		readNumber<co::uint16>( ptr ); break;
+		case co::TK_UINT32:		readNumber<co::uint32>( ptr ); break;
+		case co::TK_FLOAT:		readNumber<float>( ptr ); break;
+		case co::TK_DOUBLE:		readNumber<double>( ptr ); break;
+		case co::TK_ENUM:		*reinterpret_cast<co::int32*>( ptr ) = readEnum( static_cast<co::IEnum*>( type ) ); break;
+		case co::TK_STRING:		readString( reinterpret_cast<std::string*>( ptr ) ); break;
+		case co::TK_STRUCT:
+		case co::TK_NATIVECLASS:
+			readRecord( static_cast<co::IRecordType*>( type ), ptr );
+			break;
+		default:
+			CORAL_THROW( co::IllegalArgumentException, "cannot deserialize " << kind << " variables" );
+		}
+	}
+
+	void readElements( co::IType* elementType, ValueBuffer& buffer, size_t count )
+	{
+		expect( '{' );
+		for( size_t i = 0; i < count; ++i )
+		{
+			if( i > 0 )
+				expect( ',' );
+			readValue( elementType, buffer.at( i ) );
+		}
+		skipSpaces();
+		if( count > 0 && *_pos == ',' )
+			++_pos;
+		expect( '}' );
+	}
+
+	void readRecord( co::IRecordType* type, void* ptr )
+	{
+		assert( _model != NULL );
+
+		std::vector<co::IFieldRef> fields;
+		_model->getFields( type, fields );
+
+		co::Any instance( false, type, ptr );
+
+		expect( '{' );
+		std::string name;
+		size_t next = 0;
+		while( !tryConsume( '}' ) )
+		{
+			readIdentifier( name );
+			expect( '=' );
+
+			// fields are usually written in the same order the model lists them
+			co::IField* field = NULL;
+			size_t numFields = fields.size();
+			for( size_t i = 0; i < numFields; ++i )
+			{
+				size_t k = ( next + i ) % numFields;
+				if( fields[k]->getName() == name )
+				{
+					field = fields[k].get();
+					next = k + 1;
+					break;
+				}
+			}
+
+			if( !field )
+				raise( "unknown field '" + name + "' in type '" + type->getFullName() + "'" );
+
+			readField( instance, field );
+
+			if( !tryConsume( ',' ) )
+			{
+				expect( '}' );
+				break;
+			}
+		}
+	}
+
+	template<typename T>
+	void readNumber( void* ptr )
+	{
+		skipSpaces();
+		char* end;
+		double v = parseReal( _pos, &end );
+		if( end == _pos )
+			raise( "number expected" );
+		_pos = end;
+		*reinterpret_cast<T*>( ptr ) = static_cast<T>( v );
+	}
+
+	bool readBool()
+	{
+		std::string id;
+		readIdentifier( id );
+		if( id == "true" )
+			return true;
+		if( id != "false" )
+			raise( "boolean expected" );
+		return false;
+	}
+
+	co::int32 readEnum( co::IEnum* type )
+	{
+		std::string id;
+		readIdentifier( id );
+		co::int32 value = type->getValueOf( id );
+		if( value < 0 )
+			raise( "no identifier '" + id + "' in enum '" + type->getFullName() + "'" );
+		return value;
+	}
+
+	// Reads a quoted or long-bracket string; if 'str' is NULL the string is skipped.
+	void readString( std::string* str )
+	{
+		static const char OPEN[] = "[=[";
+		static const char CLOSE[] = "]=]";
+
+		skipSpaces();
+		const char* first;
+		const char* last;
+		if( *_pos == '\'' )
+		{
+			first = _pos + 1;
+			last = std::find( first, _end, '\'' );
+			if( last == _end )
+				raise( "unfinished string" );
+			_pos = last + 1;
+		}
+		else if( _end - _pos >= 3 && std::equal( OPEN, OPEN + 3, _pos ) )
+		{
+			first = _pos + 3;
+			last = std::search( first, _end, CLOSE, CLOSE + 3 );
+			if( last == _end )
+				raise( "unfinished long string" );
+			_pos = last + 3;
+		}
+		else
+		{
+			raise( "string expected" );
+		}
+
+		if( str )
+			str->assign( first, last );
+	}
+
+	void readIdentifier( std::string& id )
+	{
+		skipSpaces();
+		const char* start = _pos;
+		while( _pos < _end && ( isalnum( static_cast<unsigned char>( *_pos ) ) || *_pos == '_' ) )
+			++_pos;
+		if( start == _pos )
+			raise( "identifier expected" );
+		id.assign( start, _pos );
+	}
+
+	// Counts the elements of the array at the current position, without consuming it.
+	size_t countElements()
+	{
+		const char* start = _pos;
+		expect( '{' );
+		size_t count = 0;
+		while( !tryConsume( '}' ) )
+		{
+			skipValue();
+			++count;
+			if( !tryConsume( ',' ) )
+			{
+				expect( '}' );
+				break;
+			}
+		}
+		_pos = start;
+		return count;
+	}
+
+	void skipValue()
+	{
+		skipSpaces();
+		if( *_pos == '{' )
+		{
+			++_pos;
+			int depth = 1;
+			while( depth > 0 )
+			{
+				if( _pos == _end )
+					raise( "unbalanced braces" );
+				if( atString() )
+				{
+					readString( NULL );
+					continue;
+				}
+				char c = *_pos;
+				if( c == '{' )
+					++depth;
+				else if( c == '}' )
+					--depth;
+				++_pos;
+			}
+		}
+		else if( atString() )
+		{
+			readString( NULL );
+		}
+		else
+		{
+			while( _pos < _end && *_pos != ',' && *_pos != '}' )
+				++_pos;
+		}
+	}
+
+	inline bool atString()
+	{
+		return *_pos == '\'' || ( _end - _pos >= 3 && _pos[0] == '[' && _pos[1] == '=' && _pos[2] == '[' );
+	}
+
+	inline void skipSpaces()
+	{
+		while( _pos < _end && isspace( static_cast<unsigned char>( *_pos ) ) )
+			++_pos;
+	}
+
+	inline bool tryConsume( char c )
+	{
+		skipSpaces();
+		if( _pos < _end && *_pos == c )
+		{
+			++_pos;
+			return true;
+		}
+		return false;
+	}
+
+	inline void expect( char c )
+	{
+		if( !tryConsume( c ) )
+			raise( std::string( "'" ) + c + "' expected" );
+	}
+
+	void raise( const std::string& msg )
+	{
+		CORAL_THROW( ca::FormatException, "error parsing value \"" << _str << "\" at position "
+			<< ( _pos - _str.c_str() ) << ": " << msg );
+	}
+
+private:
+	ca::IModel* _model;
+	const std::string& _str;
+	const char* _pos;
+	const char* _end;
+};
+
+void StringSerializer::fromString( const std::string& str, co::IType* type, co::AnyValue& result )
+{
+	ValueReader reader( _model, str );
+	reader.read( type, result );
+	reader.finish();
+}
+
+void StringSerializer::fromString( const std::string& str, const co::Any& instance, co::IField* field )
+{
+	ValueReader reader( _model, str );
+	reader.readField( instance, field );
+	reader.finish();
 }
 
 }; // namespace ca
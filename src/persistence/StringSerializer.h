@@ -7,9 +7,13 @@
 #define _CA_STRINGSERIALIZER_H_
 
 #include <co/Any.h>
-#include <sstream>
-#include <string>
+#include <co/IEnum.h>
+#include <co/IField.h>
+#include <co/IRecordType.h>
 #include <ca/IModel.h>
+#include <map>
+#include <string>
+#include <vector>
 
 namespace ca {
 
@@ -20,17 +24,45 @@ public:
 
 	void setModel( ca::IModel* model );
 
+	/*
+		Serializes a value into a Lua-like string. The storage of \a result is reused,
+		so serializing many values into the same string avoids reallocations.
+	 */
 	void toString( co::Any value, std::string& result );
 
+	/*
+		Parses a string produced by toString() into a value of the given \a type.
+		\throw ca::FormatException if the string is not a valid value of the \a type.
+	 */
+	void fromString( const std::string& str, co::IType* type, co::AnyValue& result );
+
+	/*
+		Parses a string produced by toString() and assigns it to a \a field of \a instance.
+		Only value fields are supported (references are handled by the space loaders).
+		\throw ca::FormatException if the string is not a valid value for the \a field.
+	 */
+	void fromString( const std::string& str, const co::Any& instance, co::IField* field );
+
 private:
-	// serialization functions
-	void streamOut( std::stringstream& ss, co::Any var );
-	void writeString( std::stringstream& ss, const std::string& str );
-	void writeRecord(std::stringstream& ss, const co::Any& var );
-	void writeArray( std::stringstream& ss, const co::Any& array );
+	// serialization functions (append to 'out')
+	void write( std::string& out, co::Any var );
+	void writeInteger( std::string& out, co::int32 value );
+	void writeInteger( std::string& out, co::uint32 value );
+	void writeFloat( std::string& out, float value );
+	void writeDouble( std::string& out, double value );
+	void writeEnum( std::string& out, co::IEnum* type, co::int32 value );
+	void writeString( std::string& out, const std::string& str );
+	void writeRecord( std::string& out, const co::Any& var );
+	void writeArray( std::string& out, const co::Any& array );
+
+	// Returns the model fields of a record type, cached per type.
+	const std::vector<co::IFieldRef>& getFields( co::IRecordType* type );
 
 private:
+	typedef std::map<co::IRecordType*, std::vector<co::IFieldRef> > FieldCache;
+
 	ca::IModel* _model;
+	FieldCache _fieldCache;
 };
 
 } // namespace ca
@@ -0,0 +1,57 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#ifndef _CA_VALUEBUFFER_H_
+#define _CA_VALUEBUFFER_H_
+
+#include <co/IType.h>
+#include <co/IReflector.h>
+#include <cstdlib>
+
+namespace ca {
+
+/*
+	Temporary storage for a contiguous block of values of a given type.
+	Values are default-constructed by the type's reflector.
+ */
+class ValueBuffer
+{
+public:
+	ValueBuffer( co::IType* type, size_t count ) : _count( count )
+	{
+		_reflector = type->getReflector();
+		_size = _reflector->getSize();
+		_data = reinterpret_cast<co::uint8*>( malloc( _size * ( count ? count : 1 ) ) );
+		if( count )
+			_reflector->createValues( _data, count );
+	}
+
+	~ValueBuffer()
+	{
+		if( _count )
+			_reflector->destroyValues( _data, _count );
+		free( _data );
+	}
+
+	inline void* at( size_t i ) { return _data + _size * i; }
+
+	// Returns NULL for empty buffers (as expected by array co::Anys).
+	inline void* getData() { return _count ? _data : NULL; }
+
+private:
+	// forbid copies
+	ValueBuffer( const ValueBuffer& );
+	ValueBuffer& operator=( const ValueBuffer& );
+
+private:
+	co::IReflector* _reflector;
+	co::uint32 _size;
+	size_t _count;
+	co::uint8* _data;
+};
+
+} // namespace ca
+
+#endif // _CA_VALUEBUFFER_H_
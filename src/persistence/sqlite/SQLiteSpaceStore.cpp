@@ -4,16 +4,70 @@
  */
 
 #include "SQLiteSpaceStore_Base.h"
+#include "SQLiteSpaceStoreCursor_Base.h"
 #include "SQLite.h"
 #include <ca/IOException.h>
+#include <cstdio>
 
 namespace ca {
 
+class SQLiteSpaceStoreCursor : public SQLiteSpaceStoreCursor_Base
+{
+public:
+	SQLiteSpaceStoreCursor() : _stmt( NULL )
+	{
+		// empty
+	}
+
+	virtual ~SQLiteSpaceStoreCursor()
+	{
+		close();
+	}
+
+	// Takes ownership of a statement with (OBJECT_ID, FIELD_NAME, VALUE) results.
+	void setStatement( const ca::SQLiteStatement& stmt )
+	{
+		close();
+		_stmt = new ca::SQLiteStatement( stmt );
+	}
+
+	bool next( co::uint32& objectId, std::string& fieldName, std::string& value )
+	{
+		if( !_stmt )
+			throw ca::IOException( "attempt to read from a closed cursor" );
+
+		ca::SQLiteResult rs = _stmt->query();
+		if( !rs.next() )
+		{
+			close();
+			return false;
+		}
+
+		objectId = rs.getUint32( 0 );
+		fieldName = rs.getString( 1 );
+		value = rs.getString( 2 );
+		return true;
+	}
+
+	void close()
+	{
+		delete _stmt;
+		_stmt = NULL;
+	}
+
+private:
+	ca::SQLiteStatement* _stmt;
+};
+
+CORAL_EXPORT_COMPONENT( SQLiteSpaceStoreCursor, SQLiteSpaceStoreCursor );
+
 class SQLiteSpaceStore : public SQLiteSpaceStore_Base
 {
 public:
-	SQLiteSpaceStore()
+	SQLiteSpaceStore() : _insertStmt( NULL )
 	{
+		_nextObjectId = 0;
+		_checkpointInterval = 0;
 		_inTransaction = false;
 		_firstObject = false;
 		_startedRevision = false;
@@ -33,12 +87,19 @@ public:
 
 		if( checkEmptyValidDatabase() )
 			createTables();
+		else
+			createSnapshotTable(); // files created before snapshots were supported
 
 		fillLatestRevision();
 	}
 
 	void close()
 	{
+		// the cached statement would prevent the connection from closing
+		delete _insertStmt;
+		_insertStmt = NULL;
+		_nextObjectId = 0;
+
 		_db.close();
 	}
 
@@ -60,6 +121,9 @@ public:
 			stmt.bind( 3, updates );
 			stmt.execute();
 			_startedRevision = false;
+
+			if( _checkpointInterval > 0 && _latestRevision % _checkpointInterval == 0 )
+				writeSnapshot( _latestRevision );
 		}
 
 		_db.prepare( "COMMIT TRANSACTION" ).execute(); 
@@ -73,6 +137,7 @@ public:
 		
 		_db.prepare( "ROLLBACK TRANSACTION" ).execute();
 		_inTransaction = false;
+		_nextObjectId = 0;
 		if( _startedRevision )
 		{
 			_latestRevision--;
@@ -114,29 +179,27 @@ public:
 		checkBeginTransaction();
 		checkGenerateRevision();
 
-		ca::SQLiteStatement stmtMaxObj = _db.prepare( "SELECT MAX(OBJECT_ID) FROM FIELD_VALUE" );
-		ca::SQLiteResult rs = stmtMaxObj.query();
+		if( _nextObjectId == 0 )
+		{
+			ca::SQLiteStatement stmtMaxObj = _db.prepare( "SELECT MAX(OBJECT_ID) FROM FIELD_VALUE" );
+			ca::SQLiteResult rs = stmtMaxObj.query();
 
-		co::uint32 newObjectId( 1 );
-		if( rs.next() )
-			newObjectId += rs.getUint32( 0 );
+			_nextObjectId = 1;
+			if( rs.next() )
+				_nextObjectId += rs.getUint32( 0 );
+		}
 
-		std::vector<std::string> fieldNames;
-		std::vector<std::string> values;
+		co::uint32 newObjectId = _nextObjectId++;
 
+		ca::SQLiteStatement& stmt = getInsertStatement();
 		if( providerId > 0 )
 		{
-			std::stringstream ss;
-			ss << providerId;
-
-			fieldNames.push_back( "_provider" );
-			values.push_back( ss.str() );
+			char providerStr[16];
+			sprintf( providerStr, "%u", providerId );
+			insertValue( stmt, newObjectId, "_provider", providerStr );
 		}
 
-		fieldNames.push_back( "_type" );
-		values.push_back( typeName );
-
-		addValues( newObjectId, fieldNames, values );
+		insertValue( stmt, newObjectId, "_type", typeName.c_str() );
 
 		if( _firstObject )
 		{
@@ -155,28 +218,34 @@ public:
 		checkBeginTransaction();
 		checkGenerateRevision();
 
-		ca::SQLiteStatement stmt = _db.prepare( "INSERT INTO FIELD_VALUE (FIELD_NAME, OBJECT_ID, REVISION, VALUE)\
-												VALUES (?, ?, ?, ?)" );
-
+		ca::SQLiteStatement& stmt = getInsertStatement();
 		for( ; values; fieldNames.popFirst(), values.popFirst() )
-		{
-			stmt.reset();
-			stmt.bind( 1, fieldNames.getFirst() );
-			stmt.bind( 2, objId );
-			stmt.bind( 3, _latestRevision );
-			stmt.bind( 4, values.getFirst() );
-			stmt.execute();
-		}
+			insertValue( stmt, objId, fieldNames.getFirst().c_str(), values.getFirst().c_str() );
+	}
+
+	void addValuesBatch( co::Slice<co::uint32> objIds, co::Slice<std::string> fieldNames, co::Slice<std::string> values )
+	{
+		if( objIds.getSize() != fieldNames.getSize() || fieldNames.getSize() != values.getSize() )
+			CORAL_THROW( ca::IOException, "mismatched batch sizes: " << objIds.getSize() << " ids, "
+				<< fieldNames.getSize() << " field names and " << values.getSize() << " values" );
+
+		checkBeginTransaction();
+		checkGenerateRevision();
+
+		ca::SQLiteStatement& stmt = getInsertStatement();
+		for( ; values; objIds.popFirst(), fieldNames.popFirst(), values.popFirst() )
+			insertValue( stmt, objIds.getFirst(), fieldNames.getFirst().c_str(), values.getFirst().c_str() );
 	}
 
 	void getObjectType( co::uint32 objectId, co::uint32 revision, std::string& typeName )
 	{
 		ca::SQLiteStatement stmt = _db.prepare( "SELECT FV.VALUE FROM (SELECT OBJECT_ID, MAX(REVISION) AS LATEST_REVISION, FIELD_NAME, \
-												VALUE FROM FIELD_VALUE WHERE REVISION <= ? GROUP BY OBJECT_ID, FIELD_NAME ) FV\
+												VALUE FROM FIELD_VALUE WHERE REVISION <= ? AND REVISION >= ? GROUP BY OBJECT_ID, FIELD_NAME ) FV\
 												WHERE FV.FIELD_NAME = '_type' AND OBJECT_ID = ? GROUP BY FV.FIELD_NAME, FV.OBJECT_ID \
 												ORDER BY FV.OBJECT_ID" );
 		stmt.bind( 1, revision );
-		stmt.bind( 2, objectId );
+		stmt.bind( 2, getSnapshotRevision( revision ) );
+		stmt.bind( 3, objectId );
 		ca::SQLiteResult rs = stmt.query();
 		rs.fetchRow();
 		typeName = rs.getString( 0 );
@@ -187,12 +256,14 @@ public:
 		fieldNames.clear();
 		values.clear();
 		
+		// the object is filtered before grouping, so only its own rows are visited
 		ca::SQLiteStatement stmt = _db.prepare( "SELECT FV.FIELD_NAME, FV.VALUE FROM (SELECT OBJECT_ID, MAX(REVISION) AS LATEST_REVISION, FIELD_NAME, \
-												VALUE FROM FIELD_VALUE WHERE REVISION <= ? GROUP BY OBJECT_ID, FIELD_NAME ) FV\
-												WHERE FV.FIELD_NAME <> '_type' AND FV.FIELD_NAME <> '_provider' AND OBJECT_ID = ? GROUP BY FV.FIELD_NAME, FV.OBJECT_ID \
+												VALUE FROM FIELD_VALUE WHERE OBJECT_ID = ? AND REVISION <= ? AND REVISION >= ? GROUP BY OBJECT_ID, FIELD_NAME ) FV\
+												WHERE FV.FIELD_NAME <> '_type' AND FV.FIELD_NAME <> '_provider' GROUP BY FV.FIELD_NAME, FV.OBJECT_ID \
 												ORDER BY FV.OBJECT_ID" );
-		stmt.bind( 1, revision );
-		stmt.bind( 2, objectId );
+		stmt.bind( 1, objectId );
+		stmt.bind( 2, revision );
+		stmt.bind( 3, getSnapshotRevision( revision ) );
 		ca::SQLiteResult rs = stmt.query();
 		while( rs.next() )
 		{
@@ -208,9 +279,10 @@ public:
 		ids.clear();
 		
 		ca::SQLiteStatement stmt = _db.prepare( "SELECT FV.OBJECT_ID, FV.FIELD_NAME, FV.VALUE FROM (SELECT OBJECT_ID, MAX(REVISION) AS LATEST_REVISION, FIELD_NAME,\
-													VALUE FROM FIELD_VALUE WHERE REVISION <= ? GROUP BY OBJECT_ID, FIELD_NAME ) FV\
+													VALUE FROM FIELD_VALUE WHERE REVISION <= ? AND REVISION >= ? GROUP BY OBJECT_ID, FIELD_NAME ) FV\
 													ORDER BY FV.OBJECT_ID, FV.FIELD_NAME" );
 		stmt.bind( 1, revision );
+		stmt.bind( 2, getSnapshotRevision( revision ) );
 		ca::SQLiteResult rs = stmt.query();
 		while( rs.next() )
 		{
@@ -220,6 +292,73 @@ public:
 		}
 	}
 
+	ca::ISpaceStoreCursor* openCursor( co::uint32 revision )
+	{
+		ca::SQLiteStatement stmt = _db.prepare( "SELECT FV.OBJECT_ID, FV.FIELD_NAME, FV.VALUE FROM (SELECT OBJECT_ID, MAX(REVISION) AS LATEST_REVISION, FIELD_NAME,\
+													VALUE FROM FIELD_VALUE WHERE REVISION <= ? AND REVISION >= ? GROUP BY OBJECT_ID, FIELD_NAME ) FV\
+													ORDER BY FV.OBJECT_ID, FV.FIELD_NAME" );
+		stmt.bind( 1, revision );
+		stmt.bind( 2, getSnapshotRevision( revision ) );
+
+		SQLiteSpaceStoreCursor* cursor = new SQLiteSpaceStoreCursor;
+		cursor->setStatement( stmt );
+		return cursor->getService<ca::ISpaceStoreCursor>();
+	}
+
+	void compact( co::uint32 keepRevisions )
+	{
+		if( _inTransaction )
+			CORAL_THROW( ca::IOException, "cannot compact the store while changes are being added" );
+
+		if( keepRevisions == 0 )
+			keepRevisions = 1;
+
+		if( _latestRevision <= keepRevisions )
+			return;
+
+		// the oldest revision kept becomes a snapshot of all values up to it
+		co::uint32 base = _latestRevision - keepRevisions + 1;
+
+		_db.prepare( "BEGIN TRANSACTION" ).execute();
+		try
+		{
+			writeSnapshot( base );
+
+			const char* tables[] = { "FIELD_VALUE", "SPACE", "SNAPSHOT" };
+			for( int i = 0; i < 3; ++i )
+			{
+				std::string sql( "DELETE FROM " );
+				sql.append( tables[i] ).append( " WHERE REVISION < ?" );
+
+				ca::SQLiteStatement stmt = _db.prepare( sql.c_str() );
+				stmt.bind( 1, base );
+				stmt.execute();
+			}
+
+			_db.prepare( "COMMIT TRANSACTION" ).execute();
+		}
+		catch( ... )
+		{
+			_db.prepare( "ROLLBACK TRANSACTION" ).execute();
+			throw;
+		}
+
+		// give the pruned pages back to the file system
+		delete _insertStmt;
+		_insertStmt = NULL;
+		_db.prepare( "VACUUM" ).execute();
+	}
+
+	co::uint32 getCheckpointInterval()
+	{
+		return _checkpointInterval;
+	}
+
+	void setCheckpointInterval( co::uint32 checkpointInterval )
+	{
+		_checkpointInterval = checkpointInterval;
+	}
+
 	std::string getName() 
 	{
 		return _fileName;
@@ -238,16 +377,80 @@ public:
 	co::uint32 getServiceProvider( co::uint32 serviceId, co::uint32 revision )
 	{
 		ca::SQLiteStatement stmt = _db.prepare( "SELECT FV.VALUE FROM (SELECT OBJECT_ID, MAX(REVISION) AS LATEST_REVISION, FIELD_NAME, \
-												VALUE FROM FIELD_VALUE WHERE REVISION <= ? GROUP BY OBJECT_ID, FIELD_NAME ) FV\
+												VALUE FROM FIELD_VALUE WHERE REVISION <= ? AND REVISION >= ? GROUP BY OBJECT_ID, FIELD_NAME ) FV\
 												WHERE FV.FIELD_NAME = '_provider' AND OBJECT_ID = ? GROUP BY FV.FIELD_NAME, FV.OBJECT_ID \
 												ORDER BY FV.OBJECT_ID" );
 		stmt.bind( 1, revision );
-		stmt.bind( 2, serviceId );
+		stmt.bind( 2, getSnapshotRevision( revision ) );
+		stmt.bind( 3, serviceId );
 		ca::SQLiteResult rs = stmt.query();
 		return rs.next() ? rs.getUint32( 0 ) : 0;
 	}
 
+	void getTypeNames( co::uint32 revision, std::vector<std::string>& typeNames )
+	{
+		typeNames.clear();
+
+		ca::SQLiteStatement stmt = _db.prepare( "SELECT DISTINCT VALUE FROM FIELD_VALUE WHERE FIELD_NAME = '_type' \
+												AND REVISION <= ? AND REVISION >= ? ORDER BY VALUE" );
+		stmt.bind( 1, revision );
+		stmt.bind( 2, getSnapshotRevision( revision ) );
+		ca::SQLiteResult rs = stmt.query();
+		while( rs.next() )
+			typeNames.push_back( rs.getString( 0 ) );
+	}
+
 private:
+	// Returns the INSERT statement for field values, kept prepared until the store is closed.
+	ca::SQLiteStatement& getInsertStatement()
+	{
+		if( !_insertStmt )
+			_insertStmt = new ca::SQLiteStatement( _db.prepare( "INSERT INTO FIELD_VALUE (FIELD_NAME, OBJECT_ID, REVISION, VALUE)\
+																VALUES (?, ?, ?, ?)" ) );
+		return *_insertStmt;
+	}
+
+	void insertValue( ca::SQLiteStatement& stmt, co::uint32 objId, const char* fieldName, const char* value )
+	{
+		stmt.reset();
+		stmt.bind( 1, fieldName );
+		stmt.bind( 2, objId );
+		stmt.bind( 3, _latestRevision );
+		stmt.bind( 4, value );
+		stmt.execute();
+		stmt.reset(); // so the statement does not hold the transaction
+	}
+
+	// Returns the most recent snapshot revision up to \a revision, or 0 if there is none.
+	co::uint32 getSnapshotRevision( co::uint32 revision )
+	{
+		ca::SQLiteStatement stmt = _db.prepare( "SELECT IFNULL( MAX(REVISION), 0 ) FROM SNAPSHOT WHERE REVISION <= ?" );
+		stmt.bind( 1, revision );
+		ca::SQLiteResult rs = stmt.query();
+		rs.fetchRow();
+		return rs.getUint32( 0 );
+	}
+
+	/*
+		Turns \a revision into a snapshot, copying into it the latest values of all fields
+		it does not change. Reads of the revision and later ones no longer need older rows.
+	 */
+	void writeSnapshot( co::uint32 revision )
+	{
+		ca::SQLiteStatement stmt = _db.prepare( "INSERT INTO FIELD_VALUE (FIELD_NAME, OBJECT_ID, REVISION, VALUE)\
+												SELECT FV.FIELD_NAME, FV.OBJECT_ID, ?1, FV.VALUE FROM (SELECT OBJECT_ID, MAX(REVISION) AS LATEST_REVISION, FIELD_NAME,\
+												VALUE FROM FIELD_VALUE WHERE REVISION < ?1 AND REVISION >= ?2 GROUP BY OBJECT_ID, FIELD_NAME ) FV\
+												WHERE NOT EXISTS (SELECT 1 FROM FIELD_VALUE CUR WHERE CUR.REVISION = ?1 AND\
+												CUR.OBJECT_ID = FV.OBJECT_ID AND CUR.FIELD_NAME = FV.FIELD_NAME)" );
+		stmt.bind( 1, revision );
+		stmt.bind( 2, getSnapshotRevision( revision - 1 ) );
+		stmt.execute();
+
+		ca::SQLiteStatement stmtSnapshot = _db.prepare( "INSERT OR IGNORE INTO SNAPSHOT (REVISION) VALUES (?)" );
+		stmtSnapshot.bind( 1, revision );
+		stmtSnapshot.execute();
+	}
+
 	void checkGenerateRevision()
 	{
 		if( !_startedRevision )
@@ -291,6 +494,8 @@ private:
 						 [UPDATES_APPLIED] TEXT, \
 						 UNIQUE( REVISION ));" ).execute();
 
+			createSnapshotTable();
+
 			_db.prepare( "COMMIT TRANSACTION" ).execute();
 		}
 		catch( ... )
@@ -300,6 +505,14 @@ private:
 		}
 	}
 
+	// Revisions that hold the full state of the space, so older rows are not needed to read them.
+	void createSnapshotTable()
+	{
+		_db.prepare( "CREATE TABLE if not exists [SNAPSHOT] (\
+					 [REVISION] INTEGER NOT NULL,\
+					 UNIQUE( REVISION ));" ).execute();
+	}
+
 	void fillLatestRevision()
 	{
 		ca::SQLiteStatement stmt = _db.prepare( "SELECT MAX(REVISION), ROOT_OBJECT_ID FROM SPACE GROUP BY ROOT_OBJECT_ID" );
@@ -319,6 +532,10 @@ private:
 	ca::SQLiteConnection _db;
 	std::string _fileName;
 
+	ca::SQLiteStatement* _insertStmt;
+	co::uint32 _nextObjectId; // zero until read from the database
+	co::uint32 _checkpointInterval;
+
 	co::uint32 _latestRevision;
 
 	co::uint32 _rootObjectId;
@@ -24,6 +24,8 @@
 #include <ca/ISpaceStore.h>
 #include <ca/IOException.h>
 
+#include <fstream>
+
 
 class EvolutionVersion2Tests : public ::testing::Test
 {
@@ -157,6 +159,105 @@ TEST_F( EvolutionVersion2Tests, restoreV2SpaceFromV1FilePreviousRevision )
 // i'll put some effort to keep both tests working, for this, it'll be needed two different version 1 databases. 
 // For now, the most complicated one will be run
 
+static void copyFile( const std::string& from, const std::string& to )
+{
+	std::ifstream in( from.c_str(), std::ios::binary );
+	std::ofstream out( to.c_str(), std::ios::binary );
+	out << in.rdbuf();
+}
+
+static void checkMigratedCompany( dom::ICompany* company )
+{
+	ASSERT_TRUE( company != NULL );
+	EXPECT_EQ( 0, company->getServices().getSize() );
+
+	co::TSlice<dom::IProduct*> products = company->getProducts();
+	ASSERT_EQ( 2, products.getSize() );
+
+	EXPECT_EQ( "Software2.0", products[0]->getName() );
+	EXPECT_EQ( 1000000, products[0]->getValue() );
+	EXPECT_EQ( "Software1.0 \\ Maintennce", products[1]->getName() );
+	EXPECT_EQ( 50000, products[1]->getValue() );
+
+	co::TSlice<dom::IEmployee*> devs = products[0]->getDevelopers();
+	ASSERT_EQ( 2, devs.getSize() );
+	EXPECT_EQ( "Joseph Java Newbie", devs[0]->getName() );
+	EXPECT_EQ( 1000, devs[0]->getSalary() );
+	EXPECT_EQ( "Developer", devs[0]->getRole() );
+	EXPECT_EQ( "Michael CSharp Snior", devs[1]->getName() );
+	EXPECT_EQ( 5000, devs[1]->getSalary() );
+	EXPECT_EQ( "Developer", devs[1]->getRole() );
+
+	dom::IEmployee* leader = products[0]->getLeader();
+	ASSERT_TRUE( leader != NULL );
+	EXPECT_EQ( "Richard Scrum Master", leader->getName() );
+	EXPECT_EQ( 10000, leader->getSalary() );
+	EXPECT_EQ( "Manager", leader->getRole() );
+
+	leader = products[1]->getLeader();
+	ASSERT_TRUE( leader != NULL );
+	EXPECT_EQ( "Wiliam Kanban Expert", leader->getName() );
+	EXPECT_EQ( "Manager", leader->getRole() );
+}
+
+// runs before the tests that evolve 'CompanyV1.db' with the update script
+TEST_F( EvolutionVersion2Tests, restoreV2SpaceFromV1FileWithMigrations )
+{
+	std::string fileName = "CompanyV1Migrated.db";
+	copyFile( "CompanyV1.db", fileName );
+
+	ca::ISpacePersisterRef persister = createPersister( fileName, "migrate" );
+	ASSERT_NO_THROW( persister->restore() );
+
+	co::IObject* root = persister->getSpace()->getRootObject();
+	checkMigratedCompany( root->getService<dom::ICompany>() );
+
+	// the migrated values are saved along with the update
+	ASSERT_NO_THROW( persister->save() );
+
+	ca::ISpacePersisterRef persisterToRestore = createPersister( fileName, "migrate" );
+	ASSERT_NO_THROW( persisterToRestore->restore() );
+
+	root = persisterToRestore->getSpace()->getRootObject();
+	checkMigratedCompany( root->getService<dom::ICompany>() );
+}
+
+// runs before the tests that evolve 'CompanyV1.db' with the update script
+TEST_F( EvolutionVersion2Tests, migrateV1File )
+{
+	std::string fileName = "CompanyV1Migrate.db";
+	copyFile( "CompanyV1.db", fileName );
+
+	// the space is restored (applying the update script) and saved as a new revision
+	ca::ISpacePersisterRef persister = createPersister( fileName, "dom" );
+	ASSERT_TRUE( persister->migrate() );
+	EXPECT_FALSE( persister->migrate() );
+
+	co::IObjectRef storeObj = co::newInstance( "ca.SQLiteSpaceStore" );
+	storeObj->getService<ca::INamed>()->setName( fileName );
+	ca::ISpaceStore* store = storeObj->getService<ca::ISpaceStore>();
+
+	std::string updates;
+	store->open();
+	store->getUpdates( store->getLatestRevision(), updates );
+	store->close();
+	EXPECT_EQ( "dom.company_v1_v2_update;", updates );
+
+	// the migrated revision is restored without updates
+	ca::ISpacePersisterRef persisterToRestore = createPersister( fileName, "dom" );
+	ASSERT_NO_THROW( persisterToRestore->restore() );
+	EXPECT_FALSE( persisterToRestore->migrate() );
+
+	co::IObject* root = persisterToRestore->getSpace()->getRootObject();
+	dom::ICompany* company = root->getService<dom::ICompany>();
+	ASSERT_TRUE( company != NULL );
+	ASSERT_EQ( 1, company->getProducts().getSize() );
+	EXPECT_EQ( "Software2.0", company->getProducts()[0]->getName() );
+	ASSERT_EQ( 1, company->getServices().getSize() );
+	EXPECT_EQ( 2, company->getServices()[0]->getMantainers().getSize() );
+	EXPECT_EQ( "Developer", company->getServices()[0]->getMantainers()[0]->getRole() );
+}
+
 TEST_F( EvolutionVersion2Tests, restoreV2SpaceFromV1FileLastRevision )
 {
 	std::string fileName = "CompanyV1.db";
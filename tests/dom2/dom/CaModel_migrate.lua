@@ -0,0 +1,71 @@
+Type "dom.Company"
+{
+	company = "dom.ICompany",
+}
+
+Type "dom.Employee"
+{
+	employee = "dom.IEmployee",
+}
+
+Type "dom.Product"
+{
+	product = "dom.IProduct",
+}
+
+Type "dom.Service"
+{
+	service = "dom.IService",
+}
+
+Type "dom.IProject"
+{
+	name = "string"
+}
+
+Type "dom.ICompany"
+{
+	products = "dom.IProduct[]",
+	services = "dom.IService[]",
+}
+
+Type "dom.IEmployee"
+{
+	name = "string",
+	salary = "int32",
+	role = "string",
+}
+
+Type "dom.IProduct"
+{
+	name = "string",
+	value = "double",
+	leader = "dom.IEmployee",
+	developers = "dom.IEmployee[]",
+}
+
+Type "dom.IService"
+{
+	name = "string",
+	monthlyIncome = "double",
+	mantainers = "dom.IEmployee[]",
+}
+
+-- a declarative version of the update script: all projects become products
+Update "dom.company_v1_v2_migration"
+{
+	DefaultValue( "dom.IDeveloper", "role", "Developer" ),
+	DefaultValue( "dom.IManager", "role", "Manager" ),
+	ChangeType( "dom.IDeveloper", "dom.IEmployee" ),
+	ChangeType( "dom.IManager", "dom.IEmployee" ),
+	ChangeType( "dom.Developer", "dom.Employee" ),
+	ChangeType( "dom.Manager", "dom.Employee" ),
+	RenameMember( "dom.Employee", "developer", "employee" ),
+	RenameMember( "dom.Employee", "manager", "employee" ),
+	ChangeType( "dom.Project", "dom.Product" ),
+	ChangeType( "dom.IProject", "dom.IProduct" ),
+	RenameMember( "dom.Product", "project", "product" ),
+	RenameMember( "dom.IProduct", "earnings", "value" ),
+	RenameMember( "dom.IProduct", "manager", "leader" ),
+	RenameMember( "dom.ICompany", "projects", "products" ),
+}
@@ -44,6 +44,28 @@ function universeObserver()
 	ca.stopObserving( erm.universe, universeObserver )
 end
 
+function graphTypeObserver()
+	local universeChanges
+	local function universeObserver( changes )
+		universeChanges = changes
+	end
+
+	-- graphs can also be observed through their type
+	ca.observe( "ca.IUniverse", universeObserver )
+	erm:spaceWithSimpleERM()
+
+	ASSERT_TRUE( universeChanges )
+	EXPECT_EQ( erm.universe, universeChanges.graph )
+	EXPECT_EQ( 4, #universeChanges.addedObjects )
+
+	ca.stopObserving( "ca.IUniverse", universeObserver )
+
+	universeChanges = nil
+	erm.entityA.name = "A"
+	erm.universe:notifyChanges()
+	EXPECT_EQ( nil, universeChanges )
+end
+
 function spaceObserver()
 	local spaceChanges
 	local function spaceObserver( changes )
@@ -153,6 +175,33 @@ function serviceObserver()
 	EXPECT_EQ( "A", changedField.current )
 end
 
+function unobservedChanges()
+	local events = {}
+	local function entityObserver( changes )
+		events[#events + 1] = changes
+	end
+
+	erm:spaceWithSimpleERM()
+	ca.observe( erm.entityA, entityObserver )
+
+	-- changes to services no one observes are filtered out before reaching Lua
+	erm.entityB.name = "B"
+	erm.space:notifyChanges()
+	EXPECT_EQ( 0, #events )
+
+	erm.entityA.name = "A"
+	erm.entityB.name = "BB"
+	erm.space:notifyChanges()
+	EXPECT_EQ( 1, #events )
+	EXPECT_EQ( erm.entityA, events[1].service )
+
+	ca.stopObserving( erm.entityA, entityObserver )
+
+	erm.entityA.name = "AA"
+	erm.space:notifyChanges()
+	EXPECT_EQ( 1, #events )
+end
+
 function componentObserver()
 	local objectChanges = {}
 	local function objectObserver( changes )
@@ -222,6 +271,35 @@ function interfaceObserver()
 	ca.stopObserving( "erm.IEntity", observeIEntities )
 end
 
+function memberObserver()
+	local parentChanges = {}
+	local observeIEntities = ca.observe( "erm.IEntity" )
+	function observeIEntities.parent( change )
+		parentChanges[#parentChanges + 1] = change
+	end
+
+	erm:spaceWithExtendedERM()
+
+	-- events only reach table observers if one of their members changed
+	erm.entityA.name = "AA"
+	erm.entityB.name = "BB"
+	erm.space:notifyChanges()
+	EXPECT_EQ( 0, #parentChanges )
+
+	erm.entityA.parent = erm.entityB
+	erm.entityC.name = "CC"
+	erm.space:notifyChanges()
+	ASSERT_EQ( 1, #parentChanges )
+	EXPECT_EQ( erm.entityA, parentChanges[1].service )
+	EXPECT_EQ( erm.entityB, parentChanges[1].current )
+
+	ca.stopObserving( "erm.IEntity", observeIEntities )
+
+	erm.entityA.parent = erm.entityC
+	erm.space:notifyChanges()
+	EXPECT_EQ( 1, #parentChanges )
+end
+
 function arraySpecialFields()
 	local fieldChanges = {}
 	local observeIModel = ca.observe "erm.IModel"
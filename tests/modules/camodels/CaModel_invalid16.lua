@@ -0,0 +1,5 @@
+-- declarative update without steps
+
+Type "camodels.SomeEnum"
+
+Update "camodels.noSteps" {}
@@ -0,0 +1,17 @@
+-- model with declarative updates
+
+Update "script1.lua"
+
+Update "camodels.renameFields"
+{
+	RenameMember( "camodels.SomeInterface", "oldStr", "str1" ),
+	DefaultValue( "camodels.SomeStruct", "int1", 42 ),
+}
+
+Update "camodels.changeType"
+{
+	ChangeType( "camodels.OldInterface", "camodels.SomeInterface" ),
+	DefaultValue( "camodels.SomeInterface", "str1", "none" ),
+}
+
+Type "camodels.SomeEnum"
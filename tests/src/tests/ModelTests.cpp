@@ -12,9 +12,13 @@
 #include <co/IObject.h>
 #include <co/IStruct.h>
 #include <co/IComponent.h>
+#include <co/IRecordType.h>
 #include <co/IInterface.h>
 #include <co/IllegalArgumentException.h>
 #include <ca/IModel.h>
+#include <ca/Migration.h>
+#include <ca/ModelException.h>
+#include <sstream>
 
 ca::IModel* loadModel( const std::string& name )
 {
@@ -125,6 +129,56 @@ TEST( ModelTests, testValidModelsWithUpdate )
 
 }
 
+TEST( ModelTests, testValidModelsWithMigrations )
+{
+	ca::IModelRef model = loadModel( "valid6" );
+	ASSERT_NO_THROW( model->contains( co::getType( "camodels.SomeEnum" ) ) );
+
+	// declarative updates are listed along with the update scripts
+	ASSERT_EQ( 3, model->getUpdates().getSize() );
+	EXPECT_EQ( "script1.lua", model->getUpdates()[0] );
+	EXPECT_EQ( "camodels.renameFields", model->getUpdates()[1] );
+	EXPECT_EQ( "camodels.changeType", model->getUpdates()[2] );
+
+	co::TSlice<ca::Migration> migrations = model->getMigrations();
+	ASSERT_EQ( 4, migrations.getSize() );
+
+	EXPECT_EQ( "camodels.renameFields", migrations[0].update );
+	EXPECT_EQ( ca::MIG_RENAME_MEMBER, migrations[0].kind );
+	EXPECT_EQ( "camodels.SomeInterface", migrations[0].typeName );
+	EXPECT_EQ( "oldStr", migrations[0].member );
+	EXPECT_EQ( "str1", migrations[0].value );
+
+	EXPECT_EQ( ca::MIG_DEFAULT_VALUE, migrations[1].kind );
+	EXPECT_EQ( "int1", migrations[1].member );
+	EXPECT_EQ( "42", migrations[1].value );
+
+	EXPECT_EQ( "camodels.changeType", migrations[2].update );
+	EXPECT_EQ( ca::MIG_CHANGE_TYPE, migrations[2].kind );
+	EXPECT_EQ( "camodels.OldInterface", migrations[2].typeName );
+	EXPECT_EQ( "camodels.SomeInterface", migrations[2].value );
+
+	EXPECT_EQ( "[=[none]=]", migrations[3].value );
+
+	ca::Migration orphan;
+	orphan.update = "noSuchUpdate";
+	EXPECT_THROW( model->addMigration( orphan ), co::IllegalArgumentException );
+
+	// migrations are kept in cached definitions (the second load reads the cache)
+	const char* cacheFile = "./CaModel_valid6.camodels.cache";
+	remove( cacheFile );
+	for( int i = 0; i < 2; ++i )
+	{
+		model = loadModel( "valid6" );
+		model->setCacheDir( "." );
+		ASSERT_NO_THROW( model->contains( co::getType( "camodels.SomeEnum" ) ) );
+		ASSERT_EQ( 4, model->getMigrations().getSize() );
+		EXPECT_EQ( ca::MIG_CHANGE_TYPE, model->getMigrations()[2].kind );
+		EXPECT_EQ( "[=[none]=]", model->getMigrations()[3].value );
+	}
+	remove( cacheFile );
+}
+
 TEST( ModelTests, simpleInvalidModels )
 {
 	co::IType* someEnum = co::getType( "camodels.SomeEnum" );
@@ -165,6 +219,8 @@ TEST( ModelTests, simpleInvalidModels )
 
 	ASSERT_MODEL_ERROR( "invalid15", someEnum, "illegal script name" );
 
+	ASSERT_MODEL_ERROR( "invalid16", someEnum, "update 'camodels.noSteps' should have a list of migration steps" );
+
 }
 
 TEST( ModelTests, extraModuleDefinitions )
@@ -213,3 +269,167 @@ TEST( ModelTests, interModuleDefinitions )
 	ASSERT_TRUE( model->contains( co::getType( "erm.Entity" ) ) );
 	ASSERT_FALSE( model->contains( co::getType( "co.System" ) ) );
 }
+
+TEST( ModelTests, cachedDefinitions )
+{
+	co::IInterface* ermIEntity = co::cast<co::IInterface>( co::getType( "erm.IEntity" ) );
+	co::IComponent* ermEntity = co::cast<co::IComponent>( co::getType( "erm.Entity" ) );
+
+	const char* cacheFile = "./CaModel_erm.erm.cache";
+	remove( cacheFile );
+
+	// the first load runs the CaModel file and saves its definitions
+	ca::IModelRef model = loadModel( "erm" );
+	model->setCacheDir( "." );
+	ASSERT_TRUE( model->contains( ermEntity ) );
+
+	std::vector<co::IFieldRef> fields;
+	std::vector<co::IPortRef> ports;
+	model->getFields( ermIEntity, fields );
+	model->getPorts( ermEntity, ports );
+
+	FILE* file = fopen( cacheFile, "rb" );
+	ASSERT_TRUE( file != NULL );
+	fclose( file );
+
+	// the second load uses the cached definitions
+	model = loadModel( "erm" );
+	model->setCacheDir( "." );
+	ASSERT_TRUE( model->contains( ermEntity ) );
+
+	std::vector<co::IFieldRef> cachedFields;
+	std::vector<co::IPortRef> cachedPorts;
+	model->getFields( ermIEntity, cachedFields );
+	model->getPorts( ermEntity, cachedPorts );
+	EXPECT_TRUE( fields == cachedFields );
+	EXPECT_TRUE( ports == cachedPorts );
+
+	// corrupted caches are ignored (and rewritten)
+	file = fopen( cacheFile, "wb" );
+	fputs( "garbage", file );
+	fclose( file );
+
+	model = loadModel( "erm" );
+	model->setCacheDir( "." );
+	ASSERT_TRUE( model->contains( ermEntity ) );
+	model->getFields( ermIEntity, cachedFields );
+	EXPECT_TRUE( fields == cachedFields );
+
+	remove( cacheFile );
+	remove( "./CaModel_erm.camodels.cache" );
+}
+
+TEST( ModelTests, preloadDefinitions )
+{
+	std::vector<std::string> namespaces;
+	namespaces.push_back( "erm" );
+	namespaces.push_back( "camodels" );
+
+	ca::IModelRef model = loadModel( "erm" );
+	model->preloadDefinitions( namespaces );
+	EXPECT_TRUE( model->alreadyContains( co::getType( "erm.Entity" ) ) );
+	EXPECT_TRUE( model->alreadyContains( co::getType( "erm.IEntity" ) ) );
+	EXPECT_TRUE( model->alreadyContains( co::getType( "camodels.SomeStruct" ) ) );
+
+	namespaces.push_back( "nonExistingNamespace" );
+	model = loadModel( "erm" );
+	ASSERT_EXCEPTION( model->preloadDefinitions( namespaces ), "no such namespace 'nonExistingNamespace'" );
+	EXPECT_FALSE( model->alreadyContains( co::getType( "erm.Entity" ) ) );
+	EXPECT_TRUE( model->contains( co::getType( "erm.Entity" ) ) );
+
+	// errors are reported as in lazy loading
+	namespaces.clear();
+	namespaces.push_back( "camodels" );
+	model = loadModel( "invalid1" );
+	EXPECT_THROW( model->preloadDefinitions( namespaces ), ca::ModelException );
+
+	// updates declared by the discarded namespaces are discarded too...
+	namespaces.push_back( "nonExistingNamespace" );
+	model = loadModel( "valid6" );
+	EXPECT_THROW( model->preloadDefinitions( namespaces ), co::IllegalArgumentException );
+	EXPECT_EQ( 0, model->getUpdates().getSize() );
+	EXPECT_EQ( 0, model->getMigrations().getSize() );
+
+	// ...so they are listed only once when the namespace is lazily loaded
+	EXPECT_TRUE( model->contains( co::getType( "camodels.SomeEnum" ) ) );
+	EXPECT_EQ( 3, model->getUpdates().getSize() );
+	EXPECT_EQ( 4, model->getMigrations().getSize() );
+}
+
+// Adds a type with the given (space-separated) members to the model's current transaction.
+void addType( ca::IModel* model, const std::string& typeName, const std::string& memberNames = std::string() )
+{
+	co::IType* type = co::getType( typeName );
+	std::vector<co::IField*> fields;
+	std::vector<co::IPort*> ports;
+	std::istringstream names( memberNames );
+	std::string name;
+	while( names >> name )
+	{
+		co::IMember* member = co::cast<co::ICompositeType>( type )->getMember( name );
+		ASSERT_TRUE( member != NULL );
+		if( type->getKind() == co::TK_COMPONENT )
+			ports.push_back( co::cast<co::IPort>( member ) );
+		else
+			fields.push_back( co::cast<co::IField>( member ) );
+	}
+
+	switch( type->getKind() )
+	{
+	case co::TK_ENUM: model->addEnum( co::cast<co::IEnum>( type ) ); break;
+	case co::TK_COMPONENT: model->addComponent( co::cast<co::IComponent>( type ), ports ); break;
+	default: model->addRecordType( co::cast<co::IRecordType>( type ), fields ); break;
+	}
+}
+
+// Adds all types of module 'erm', optionally skipping one of them.
+void addErmTypes( ca::IModel* model, const std::string& skippedType = std::string() )
+{
+	static const char* const TYPES[][2] = {
+		{ "erm.Entity", "entity" },
+		{ "erm.Model", "model" },
+		{ "erm.Relationship", "relationship entityA entityB" },
+		{ "erm.Multiplicity", "min max" },
+		{ "erm.IEntity", "name parent" },
+		{ "erm.IModel", "entities relationships" },
+		{ "erm.IRelationship", "entityA entityB multiplicityA multiplicityB relation" },
+		{ "camodels.SomeEnum", "" }
+	};
+
+	for( size_t i = 0; i < sizeof(TYPES) / sizeof(TYPES[0]); ++i )
+		if( skippedType != TYPES[i][0] )
+			addType( model, TYPES[i][0], TYPES[i][1] );
+}
+
+TEST( ModelTests, transactionIndex )
+{
+	// a model without CaModel files, so all types come from the transactions below
+	ca::IModelRef model = loadModel( "transactionIndex" );
+
+	// duplicates are detected within a transaction
+	model->beginChanges();
+	addErmTypes( model.get() );
+	ASSERT_EXCEPTION( addType( model.get(), "erm.IEntity", "name" ), "type 'erm.IEntity' is already in the model's transaction" );
+	ASSERT_EXCEPTION( addType( model.get(), "camodels.SomeEnum" ), "type 'camodels.SomeEnum' is already in the model's transaction" );
+	model->discardChanges();
+
+	// missing dependencies fail the transaction, which must then be discarded
+	model->beginChanges();
+	addErmTypes( model.get(), "erm.Multiplicity" );
+	ASSERT_EXCEPTION( model->applyChanges(), "type 'erm.Multiplicity' is not in the object model" );
+	model->discardChanges();
+	EXPECT_FALSE( model->alreadyContains( co::getType( "erm.IRelationship" ) ) );
+
+	// the discarded transactions left nothing behind in the index
+	model->beginChanges();
+	addErmTypes( model.get() );
+	model->applyChanges();
+	EXPECT_TRUE( model->alreadyContains( co::getType( "erm.Multiplicity" ) ) );
+	EXPECT_TRUE( model->alreadyContains( co::getType( "camodels.SomeEnum" ) ) );
+
+	// and neither did the committed one: duplicates are now found in the object model
+	model->beginChanges();
+	ASSERT_EXCEPTION( addType( model.get(), "erm.IEntity", "name" ), "type 'erm.IEntity' is already in the object model" );
+	model->discardChanges();
+	EXPECT_TRUE( model->contains( co::getType( "erm.IEntity" ) ) );
+}
@@ -290,6 +290,11 @@ TEST_F( SpaceTests, changedRefVecFields )
 		EXPECT_EQ( _entityA.get(), changedRefVecFields[0].current[2].get() );
 		EXPECT_EQ( _entityC.get(), changedRefVecFields[0].current[3].get() );
 
+		// multiset deltas (in no particular order)
+		EXPECT_EQ( 3, changedRefVecFields[0].added.size() );
+		ASSERT_EQ( 1, changedRefVecFields[0].removed.size() );
+		EXPECT_EQ( _entityB.get(), changedRefVecFields[0].removed[0].get() );
+
 		EXPECT_EQ( "relationships", changedRefVecFields[1].field->getName() );
 		ASSERT_EQ( 1, changedRefVecFields[1].previous.size() );
 		EXPECT_EQ( _relAB.get(), changedRefVecFields[1].previous[0].get() );
@@ -298,6 +303,8 @@ TEST_F( SpaceTests, changedRefVecFields )
 		EXPECT_EQ( _relAB.get(), changedRefVecFields[1].current[1].get() );
 		EXPECT_EQ( _relBC.get(), changedRefVecFields[1].current[2].get() );
 		EXPECT_EQ( _relAB.get(), changedRefVecFields[1].current[3].get() );
+		EXPECT_EQ( 3, changedRefVecFields[1].added.size() );
+		EXPECT_TRUE( changedRefVecFields[1].removed.empty() );
 	}
 
 	// remove relAB's ref to entityB; entityB should be removed from the space
@@ -452,6 +459,52 @@ TEST_F( SpaceTests, changedValueFields )
 	}
 }
 
+TEST_F( SpaceTests, revertChanges )
+{
+	startWithSimpleERM();
+
+	// change fields and connections across multiple objects
+	_entityA->setName( "New Name" );
+	_space->addChange( _entityA.get() );
+
+	_relAB->setRelation( "New Relation" );
+	_relAB->setEntityB( _entityA.get() );
+	_space->addChange( _relAB.get() );
+	_space->addChange( _relAB->getProvider() );
+
+	_space->notifyChanges();
+	ASSERT_TRUE( _changes.isValid() );
+	ca::IGraphChangesRef changes = _changes;
+	ASSERT_EQ( 2, changes->getChangedObjects().getSize() );
+
+	// reverting restores the previous state, which is detected as a new changeset
+	changes->revertChanges();
+	EXPECT_EQ( "Entity A", _entityA->getName() );
+	EXPECT_EQ( "relation A-B", _relAB->getRelation() );
+	EXPECT_EQ( _entityB.get(), _relAB->getEntityB() );
+
+	_changes = NULL;
+	_space->notifyChanges();
+	ASSERT_TRUE( _changes.isValid() );
+	ASSERT_EQ( 2, _changes->getChangedObjects().getSize() );
+
+	co::int32 indexOfEntityA = _changes->findChangedObject( _entityA->getProvider() );
+	ASSERT_TRUE( indexOfEntityA >= 0 );
+	co::TSlice<ca::IServiceChanges*> services = _changes->getChangedObjects()[indexOfEntityA]->getChangedServices();
+	ASSERT_EQ( 1, services.getSize() );
+	co::TSlice<ca::ChangedValueField> valueFields = services[0]->getChangedValueFields();
+	ASSERT_EQ( 1, valueFields.getSize() );
+	EXPECT_EQ( "New Name", valueFields[0].previous.get<const std::string&>() );
+	EXPECT_EQ( "Entity A", valueFields[0].current.get<const std::string&>() );
+
+	co::int32 indexOfRelAB = _changes->findChangedObject( _relAB->getProvider() );
+	ASSERT_TRUE( indexOfRelAB >= 0 );
+	ca::IObjectChanges* relABChanges = _changes->getChangedObjects()[indexOfRelAB];
+	ASSERT_EQ( 1, relABChanges->getChangedConnections().getSize() );
+	EXPECT_EQ( _entityA.get(), relABChanges->getChangedConnections()[0].previous.get() );
+	EXPECT_EQ( _entityB.get(), relABChanges->getChangedConnections()[0].current.get() );
+}
+
 TEST_F( SpaceTestsFaulty, unexpectedExceptions )
 {
 	createSimpleERM();
@@ -11,6 +11,9 @@
 #include <ca/IUndoManager.h>
 #include <ca/NoChangeException.h>
 
+#include <algorithm>
+#include <cstdio>
+
 class UndoRedoTests : public ERMSpace
 {
 public:
@@ -309,3 +312,383 @@ TEST_F( UndoRedoTests, arrayTest )
 	EXPECT_NO_THROW( _undoManager->redo() );
 	EXPECT_NO_THROW( _undoManager->undo() );
 }
+
+TEST_F( UndoRedoTests, refVecDeltas )
+{
+	startWithSimpleERM();
+
+	_undoManager->beginChange( "Add Entity C" );
+	_erm->addEntity( _entityC.get() );
+	_space->addChange( _erm.get() );
+	_undoManager->endChange();
+
+	// the undo notification reports the inverse delta
+	_changes = NULL;
+	_undoManager->undo();
+	ASSERT_TRUE( _changes.isValid() );
+	{
+		co::int32 index = _changes->findChangedObject( _erm->getProvider() );
+		ASSERT_TRUE( index >= 0 );
+		co::TSlice<ca::IServiceChanges*> changedServices = _changes->getChangedObjects()[index]->getChangedServices();
+		ASSERT_EQ( 1, changedServices.getSize() );
+
+		co::TSlice<ca::ChangedRefVecField> changedRefVecFields = changedServices[0]->getChangedRefVecFields();
+		ASSERT_EQ( 1, changedRefVecFields.getSize() );
+		EXPECT_EQ( "entities", changedRefVecFields[0].field->getName() );
+		EXPECT_EQ( 3, changedRefVecFields[0].previous.size() );
+		EXPECT_EQ( 2, changedRefVecFields[0].current.size() );
+		EXPECT_TRUE( changedRefVecFields[0].added.empty() );
+		ASSERT_EQ( 1, changedRefVecFields[0].removed.size() );
+		EXPECT_EQ( _entityC.get(), changedRefVecFields[0].removed[0].get() );
+	}
+
+	// and so does the redo notification, built from the recorded inverse
+	_changes = NULL;
+	_undoManager->redo();
+	ASSERT_TRUE( _changes.isValid() );
+	{
+		co::int32 index = _changes->findChangedObject( _erm->getProvider() );
+		ASSERT_TRUE( index >= 0 );
+		co::TSlice<ca::IServiceChanges*> changedServices = _changes->getChangedObjects()[index]->getChangedServices();
+		ASSERT_EQ( 1, changedServices.getSize() );
+
+		co::TSlice<ca::ChangedRefVecField> changedRefVecFields = changedServices[0]->getChangedRefVecFields();
+		ASSERT_EQ( 1, changedRefVecFields.getSize() );
+		ASSERT_EQ( 1, changedRefVecFields[0].added.size() );
+		EXPECT_EQ( _entityC.get(), changedRefVecFields[0].added[0].get() );
+		EXPECT_TRUE( changedRefVecFields[0].removed.empty() );
+	}
+}
+
+TEST_F( UndoRedoTests, undoBudget )
+{
+	startWithSimpleERM();
+
+	EXPECT_EQ( 0, _undoManager->getMaxChangesets() );
+	EXPECT_EQ( 0, _undoManager->getMaxMemory() );
+	EXPECT_EQ( 0, _undoManager->getMemoryUsage() );
+
+	const char* names[] = { "A1", "A2", "A3", "A4" };
+	for( int i = 0; i < 4; ++i )
+	{
+		_undoManager->beginChange( names[i] );
+		_entityA->setName( names[i] );
+		_space->addChange( _entityA.get() );
+		_undoManager->endChange();
+	}
+
+	ASSERT_EQ( 4, _undoManager->getUndoStack().getSize() );
+	double fullUsage = _undoManager->getMemoryUsage();
+	EXPECT_GT( fullUsage, 0 );
+
+	// limiting the number of changesets discards the oldest ones
+	_undoManager->setMaxChangesets( 2 );
+	co::TSlice<std::string> undoStack = _undoManager->getUndoStack();
+	ASSERT_EQ( 2, undoStack.getSize() );
+	EXPECT_EQ( "A3", undoStack[0] );
+	EXPECT_EQ( "A4", undoStack[1] );
+	EXPECT_LT( _undoManager->getMemoryUsage(), fullUsage );
+
+	// the remaining changesets can still be undone
+	_undoManager->undo();
+	_undoManager->undo();
+	EXPECT_EQ( "A2", _entityA->getName() );
+	EXPECT_THROW( _undoManager->undo(), ca::NoChangeException );
+	EXPECT_EQ( 2, _undoManager->getRedoStack().getSize() );
+
+	// a tiny memory budget keeps only the most recent changeset
+	_undoManager->redo();
+	_undoManager->redo();
+	_undoManager->setMaxChangesets( 0 );
+	_undoManager->setMaxMemory( 1 );
+	undoStack = _undoManager->getUndoStack();
+	ASSERT_EQ( 1, undoStack.getSize() );
+	EXPECT_EQ( "A4", undoStack[0] );
+
+	_undoManager->clear();
+	EXPECT_EQ( 0, _undoManager->getMemoryUsage() );
+
+	EXPECT_THROW( _undoManager->setMaxMemory( -1 ), co::IllegalArgumentException );
+}
+
+TEST_F( UndoRedoTests, redoStackNotBudgeted )
+{
+	startWithSimpleERM();
+
+	const char* names[] = { "A1", "A2", "A3", "A4", "A5" };
+	for( int i = 0; i < 4; ++i )
+	{
+		_undoManager->beginChange( names[i] );
+		_entityA->setName( names[i] );
+		_space->addChange( _entityA.get() );
+		_undoManager->endChange();
+	}
+
+	// a budget that fits the four changesets (and a little more)
+	double usage = _undoManager->getMemoryUsage();
+	_undoManager->setMaxMemory( usage * 1.2 );
+	ASSERT_EQ( 4, _undoManager->getUndoStack().getSize() );
+
+	// undone changesets move to the redo stack, and do not count against the budget
+	_undoManager->undo();
+	_undoManager->undo();
+	_undoManager->undo();
+	ASSERT_EQ( 1, _undoManager->getUndoStack().getSize() );
+	ASSERT_EQ( 3, _undoManager->getRedoStack().getSize() );
+
+	_undoManager->beginChange( names[4] );
+	_entityA->setName( names[4] );
+	_space->addChange( _entityA.get() );
+	_undoManager->endChange();
+
+	co::TSlice<std::string> undoStack = _undoManager->getUndoStack();
+	ASSERT_EQ( 2, undoStack.getSize() );
+	EXPECT_EQ( "A1", undoStack[0] );
+	EXPECT_EQ( "A5", undoStack[1] );
+	EXPECT_FALSE( _undoManager->getCanRedo() );
+}
+
+TEST_F( UndoRedoTests, mergedChangesets )
+{
+	startWithSimpleERM();
+
+	_undoManager->beginChange( "Rename A" );
+	_entityA->setName( "A0" );
+	_space->addChange( _entityA.get() );
+	_undoManager->endChange();
+
+	// a "drag" made of many small changesets under the same key
+	_undoManager->setMergeKey( "drag" );
+	const char* names[] = { "A1", "A2", "A3" };
+	for( int i = 0; i < 3; ++i )
+	{
+		_undoManager->beginChange( "Drag" );
+		_entityA->setName( names[i] );
+		_space->addChange( _entityA.get() );
+		if( i == 1 )
+		{
+			_entityB->setName( "B1" );
+			_space->addChange( _entityB.get() );
+		}
+		_undoManager->endChange();
+	}
+	_undoManager->setMergeKey( "" );
+
+	// the first drag changeset is not merged with the one recorded without a key
+	co::TSlice<std::string> undoStack = _undoManager->getUndoStack();
+	ASSERT_EQ( 2, undoStack.getSize() );
+	EXPECT_EQ( "Rename A", undoStack[0] );
+	EXPECT_EQ( "Drag", undoStack[1] );
+
+	// a single undo reverts the whole gesture
+	_undoManager->undo();
+	EXPECT_EQ( "A0", _entityA->getName() );
+	EXPECT_EQ( "Entity B", _entityB->getName() );
+
+	_undoManager->redo();
+	EXPECT_EQ( "A3", _entityA->getName() );
+	EXPECT_EQ( "B1", _entityB->getName() );
+
+	// changesets redone onto the undo stack are not merged with new ones
+	_undoManager->setMergeKey( "drag" );
+	_undoManager->beginChange( "Drag" );
+	_entityA->setName( "A4" );
+	_space->addChange( _entityA.get() );
+	_undoManager->endChange();
+	_undoManager->setMergeKey( "" );
+	EXPECT_EQ( 3, _undoManager->getUndoStack().getSize() );
+}
+
+TEST_F( UndoRedoTests, mergedChangesCancelOut )
+{
+	startWithSimpleERM();
+
+	_undoManager->beginChange( "Rename A" );
+	_entityA->setName( "A0" );
+	_space->addChange( _entityA.get() );
+	_undoManager->endChange();
+
+	// a gesture that moves A away and back only keeps its change to B
+	_undoManager->setMergeKey( "drag" );
+	_undoManager->beginChange( "Drag" );
+	_entityA->setName( "A1" );
+	_entityB->setName( "B1" );
+	_space->addChange( _entityA.get() );
+	_space->addChange( _entityB.get() );
+	_undoManager->endChange();
+
+	_undoManager->beginChange( "Drag" );
+	_entityA->setName( "A0" );
+	_space->addChange( _entityA.get() );
+	_undoManager->endChange();
+
+	ASSERT_EQ( 2, _undoManager->getUndoStack().getSize() );
+	_undoManager->undo();
+	EXPECT_EQ( "A0", _entityA->getName() );
+	EXPECT_EQ( "Entity B", _entityB->getName() );
+	_undoManager->redo();
+	EXPECT_EQ( "B1", _entityB->getName() );
+
+	// a gesture that ends where it began leaves no changeset behind
+	_undoManager->beginChange( "Drag" );
+	_entityB->setName( "B2" );
+	_space->addChange( _entityB.get() );
+	_undoManager->endChange();
+
+	_undoManager->beginChange( "Drag" );
+	_entityB->setName( "B1" );
+	_space->addChange( _entityB.get() );
+	_undoManager->endChange();
+	_undoManager->setMergeKey( "" );
+
+	co::TSlice<std::string> undoStack = _undoManager->getUndoStack();
+	ASSERT_EQ( 2, undoStack.getSize() );
+	EXPECT_EQ( "Drag", undoStack[1] );
+	EXPECT_FALSE( _undoManager->getCanRedo() );
+
+	// so every remaining entry can still be undone
+	_undoManager->undo();
+	EXPECT_EQ( "Entity B", _entityB->getName() );
+	_undoManager->undo();
+	EXPECT_EQ( "Entity A", _entityA->getName() );
+	EXPECT_FALSE( _undoManager->getCanUndo() );
+	EXPECT_EQ( 2, _undoManager->getRedoStack().getSize() );
+}
+
+TEST_F( UndoRedoTests, spilledHistory )
+{
+	startWithSimpleERM();
+
+	EXPECT_TRUE( _undoManager->getSpillFile().empty() );
+	EXPECT_EQ( 16, _undoManager->getResidentChangesets() );
+
+	_undoManager->setSpillFile( "UndoSpillTest.log" );
+	_undoManager->setResidentChangesets( 1 );
+
+	// exercise value fields, connections, ref vectors and added objects
+	_undoManager->beginChange( "Rename A" );
+	_entityA->setName( "A1" );
+	_space->addChange( _entityA.get() );
+	_undoManager->endChange();
+
+	_undoManager->beginChange( "Add C" );
+	_erm->addEntity( _entityC.get() );
+	_space->addChange( _erm.get() );
+	_undoManager->endChange();
+
+	_undoManager->beginChange( "Connect C" );
+	_relAB->setEntityB( _entityC.get() );
+	_space->addChange( _relAB.get() );
+	_space->addChange( _relAB->getProvider() );
+	_undoManager->endChange();
+
+	_undoManager->beginChange( "Rename C" );
+	_entityC->setName( "C1" );
+	_space->addChange( _entityC.get() );
+	_undoManager->endChange();
+
+	ASSERT_EQ( 4, _undoManager->getUndoStack().getSize() );
+
+	// undoing past the resident window pages changesets back in
+	_undoManager->undo();
+	EXPECT_EQ( "Entity C", _entityC->getName() );
+	_undoManager->undo();
+	EXPECT_EQ( _entityB.get(), _relAB->getEntityB() );
+	_undoManager->undo();
+	EXPECT_EQ( 2, _erm->getEntities().getSize() );
+	_undoManager->undo();
+	EXPECT_EQ( "Entity A", _entityA->getName() );
+	EXPECT_FALSE( _undoManager->getCanUndo() );
+
+	for( int i = 0; i < 4; ++i )
+		_undoManager->redo();
+
+	EXPECT_EQ( "A1", _entityA->getName() );
+	EXPECT_EQ( 3, _erm->getEntities().getSize() );
+	EXPECT_EQ( _entityC.get(), _relAB->getEntityB() );
+	EXPECT_EQ( "C1", _entityC->getName() );
+
+	// resetting the spill file brings the whole history back into memory
+	double spilledUsage = _undoManager->getMemoryUsage();
+	_undoManager->setSpillFile( "" );
+	EXPECT_GT( _undoManager->getMemoryUsage(), spilledUsage );
+	ASSERT_EQ( 4, _undoManager->getUndoStack().getSize() );
+
+	_undoManager->undo();
+	_undoManager->undo();
+	_undoManager->undo();
+	_undoManager->undo();
+	EXPECT_EQ( "Entity A", _entityA->getName() );
+	EXPECT_EQ( 2, _erm->getEntities().getSize() );
+}
+
+static long getFileSize( const char* fileName )
+{
+	FILE* file = fopen( fileName, "rb" );
+	if( !file )
+		return -1;
+
+	fseek( file, 0, SEEK_END );
+	long size = ftell( file );
+	fclose( file );
+	return size;
+}
+
+TEST_F( UndoRedoTests, spillFileStaysBounded )
+{
+	startWithSimpleERM();
+
+	_undoManager->setSpillFile( "UndoBoundedTest.log" );
+	_undoManager->setResidentChangesets( 1 );
+	_undoManager->setMaxChangesets( 4 );
+
+	// changesets discarded by the limits free their space in the log
+	std::string name;
+	long maxSize = 0;
+	for( int i = 0; i < 2000; ++i )
+	{
+		name = "Entity A ";
+		name.append( i % 2 ? "odd" : "even" );
+		_undoManager->beginChange( "Rename A" );
+		_entityA->setName( name );
+		_space->addChange( _entityA.get() );
+		_undoManager->endChange();
+
+		maxSize = std::max( maxSize, getFileSize( "UndoBoundedTest.log" ) );
+	}
+
+	EXPECT_EQ( 4, _undoManager->getUndoStack().getSize() );
+	EXPECT_GT( maxSize, 0 );
+	EXPECT_LT( maxSize, 40 * 1024 );
+
+	// the spilled changesets are still intact after being moved
+	for( int i = 0; i < 4; ++i )
+		_undoManager->undo();
+	EXPECT_EQ( "Entity A odd", _entityA->getName() );
+	EXPECT_FALSE( _undoManager->getCanUndo() );
+
+	_undoManager->setSpillFile( "" );
+}
+
+TEST_F( UndoRedoTests, untrackedChanges )
+{
+	startWithSimpleERM();
+
+	_undoManager->beginChange( "Rename A" );
+	_entityA->setName( "A1" );
+	_space->addChange( _entityA.get() );
+	_undoManager->endChange();
+
+	// a change made outside of a changeset is not in the undo stack
+	_entityA->setName( "A2" );
+	_space->addChange( _entityA.get() );
+	_space->notifyChanges();
+
+	// undo still restores the previous state...
+	_undoManager->undo();
+	EXPECT_EQ( "Entity A", _entityA->getName() );
+
+	// ...and the recorded reverse changes reflect the actual state that was reverted
+	_undoManager->redo();
+	EXPECT_EQ( "A2", _entityA->getName() );
+}
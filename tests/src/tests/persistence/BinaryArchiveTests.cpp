@@ -0,0 +1,160 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#include "../ERMSpace.h"
+#include <ca/INamed.h>
+#include <ca/IBinaryArchive.h>
+#include <ca/IOException.h>
+#include <ca/ModelException.h>
+#include <ca/FormatException.h>
+#include <cstdio>
+
+class BinaryArchiveTests : public ERMSpace
+{
+protected:
+	co::IObjectRef newArchive( const std::string& fileName )
+	{
+		co::IObjectRef object = co::newInstance( "ca.BinaryArchive" );
+		object->setService( "model", _model.get() );
+		object->getService<ca::INamed>()->setName( fileName );
+		return object;
+	}
+
+	void saveRestore( bool compressed );
+};
+
+TEST_F( BinaryArchiveTests, setup )
+{
+	co::IObjectRef object = co::newInstance( "ca.BinaryArchive" );
+
+	ca::IBinaryArchive* archive = object->getService<ca::IBinaryArchive>();
+	ASSERT_TRUE( archive != NULL );
+	EXPECT_FALSE( archive->getCompressed() );
+
+	// expect ModelExceptions since we have not set a model
+	EXPECT_THROW( archive->save( object.get() ), ca::ModelException );
+	EXPECT_THROW( archive->restore(), ca::ModelException );
+
+	EXPECT_NO_THROW( object->setService( "model", _model.get() ) );
+
+	// expect IOExceptions since we have not set a file name
+	EXPECT_THROW( archive->save( object.get() ), ca::IOException );
+	EXPECT_THROW( archive->restore(), ca::IOException );
+
+	EXPECT_NO_THROW( object->getService<ca::INamed>()->setName( "BinaryArchiveTest.cab" ) );
+
+	// restore() should fail because the file does not exist
+	remove( "BinaryArchiveTest.cab" );
+	EXPECT_THROW( archive->restore(), ca::IOException );
+
+	// save() with an undefined object type should raise a ModelException
+	EXPECT_THROW( archive->save( object.get() ), ca::ModelException );
+}
+
+void BinaryArchiveTests::saveRestore( bool compressed )
+{
+	startWithExtendedERM();
+
+	erm::Multiplicity m;
+	m.min = 3; m.max = 4;
+	_relBC->setMultiplicityA( m );
+
+	co::IObjectRef object = newArchive( compressed ? "CompressedTest.cab" : "UncompressedTest.cab" );
+	ca::IBinaryArchive* archive = object->getService<ca::IBinaryArchive>();
+	archive->setCompressed( compressed );
+
+	ASSERT_NO_THROW( archive->save( _erm->getProvider() ) );
+
+	co::IObjectRef restoredObj;
+	ASSERT_NO_THROW( restoredObj = archive->restore() );
+	ASSERT_TRUE( restoredObj.isValid() );
+
+	erm::IModel* erm = restoredObj->getService<erm::IModel>();
+	ASSERT_TRUE( erm != NULL );
+
+	co::TSlice<erm::IEntity*> entities = erm->getEntities();
+	ASSERT_EQ( 3, entities.getSize() );
+	EXPECT_EQ( "Entity A", entities[0]->getName() );
+	EXPECT_EQ( "Entity B", entities[1]->getName() );
+	EXPECT_EQ( "Entity C", entities[2]->getName() );
+
+	// references between objects (including cycles) are preserved
+	co::TSlice<erm::IRelationship*> rels = erm->getRelationships();
+	ASSERT_EQ( 3, rels.getSize() );
+	EXPECT_EQ( "relation B-C", rels[1]->getRelation() );
+	EXPECT_EQ( entities[1], rels[1]->getEntityA() );
+	EXPECT_EQ( entities[2], rels[1]->getEntityB() );
+	EXPECT_EQ( 3, rels[1]->getMultiplicityA().min );
+	EXPECT_EQ( 4, rels[1]->getMultiplicityA().max );
+	EXPECT_EQ( entities[2], rels[2]->getEntityA() );
+	EXPECT_EQ( entities[0], rels[2]->getEntityB() );
+}
+
+TEST_F( BinaryArchiveTests, saveRestore )
+{
+	saveRestore( false );
+}
+
+TEST_F( BinaryArchiveTests, compressedSaveRestore )
+{
+	saveRestore( true );
+}
+
+TEST_F( BinaryArchiveTests, invalidArchives )
+{
+	startWithSimpleERM();
+
+	co::IObjectRef object = newArchive( "InvalidTest.cab" );
+	ca::IArchive* archive = object->getService<ca::IArchive>();
+
+	// not an archive
+	FILE* file = fopen( "InvalidTest.cab", "wb" );
+	ASSERT_TRUE( file != NULL );
+	fputs( "-- Lua Archive File\n", file );
+	fclose( file );
+	EXPECT_THROW( archive->restore(), ca::FormatException );
+
+	// truncated archive
+	ASSERT_NO_THROW( archive->save( _erm->getProvider() ) );
+	file = fopen( "InvalidTest.cab", "rb" );
+	ASSERT_TRUE( file != NULL );
+	char data[64];
+	size_t size = fread( data, 1, sizeof(data), file );
+	fclose( file );
+	ASSERT_GT( size, 16U );
+
+	file = fopen( "InvalidTest.cab", "wb" );
+	fwrite( data, 1, 16, file );
+	fclose( file );
+	EXPECT_THROW( archive->restore(), ca::FormatException );
+}
+
+TEST_F( BinaryArchiveTests, invalidPayloadSize )
+{
+	startWithSimpleERM();
+
+	co::IObjectRef object = newArchive( "InvalidSizeTest.cab" );
+	ca::IArchive* archive = object->getService<ca::IArchive>();
+
+	// a compressed archive claiming a 4 GB payload, with a single tiny block
+	const unsigned char data[] = { 'C', 'A', 'B', 'A', 1, 1,
+		0xFF, 0xFF, 0xFF, 0xFF, 0x0F,	// payload size
+		0x04, 0x04, 1, 2, 3, 4 };		// rawSize, storedSize, data
+	FILE* file = fopen( "InvalidSizeTest.cab", "wb" );
+	ASSERT_TRUE( file != NULL );
+	fwrite( data, 1, sizeof(data), file );
+	fclose( file );
+	EXPECT_THROW( archive->restore(), ca::FormatException );
+
+	// a payload size within bounds, but larger than the blocks present
+	const unsigned char shortData[] = { 'C', 'A', 'B', 'A', 1, 1,
+		0x80, 0x04,						// payload size (512)
+		0x04, 0x04, 1, 2, 3, 4 };
+	file = fopen( "InvalidSizeTest.cab", "wb" );
+	ASSERT_TRUE( file != NULL );
+	fwrite( shortData, 1, sizeof(shortData), file );
+	fclose( file );
+	EXPECT_THROW( archive->restore(), ca::FormatException );
+}
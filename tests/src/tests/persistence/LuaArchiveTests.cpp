@@ -8,6 +8,7 @@
 #include <ca/IArchive.h>
 #include <ca/IOException.h>
 #include <ca/ModelException.h>
+#include <cstring>
 
 class LuaArchiveTests : public ERMSpace {};
 
@@ -120,3 +121,177 @@ TEST_F( LuaArchiveTests, simpleSaveRestore )
 	EXPECT_EQ( 9, rel->getMultiplicityB().min );
 	EXPECT_EQ( 0, rel->getMultiplicityB().max );
 }
+
+static void checkRestoredERM( co::IObject* restoredObj )
+{
+	ASSERT_TRUE( restoredObj != NULL );
+
+	erm::IModel* erm = restoredObj->getService<erm::IModel>();
+	ASSERT_TRUE( erm != NULL );
+
+	co::TSlice<erm::IEntity*> entities = erm->getEntities();
+	ASSERT_EQ( 3, entities.getSize() );
+
+	EXPECT_EQ( "Entity A", entities[0]->getName() );
+	EXPECT_EQ( "Entity B", entities[1]->getName() );
+	EXPECT_EQ( "Entity C", entities[2]->getName() );
+
+	co::TSlice<erm::IRelationship*> rels = erm->getRelationships();
+	ASSERT_EQ( 3, rels.getSize() );
+
+	erm::IRelationship* rel = rels[0];
+	EXPECT_EQ( "relation A-B", rel->getRelation() );
+	EXPECT_EQ( entities[0], rel->getEntityA() );
+	EXPECT_EQ( entities[1], rel->getEntityB() );
+	EXPECT_EQ( 0, rel->getMultiplicityA().min );
+	EXPECT_EQ( 0, rel->getMultiplicityA().max );
+	EXPECT_EQ( 1, rel->getMultiplicityB().min );
+	EXPECT_EQ( 2, rel->getMultiplicityB().max );
+
+	rel = rels[1];
+	EXPECT_EQ( "relation B-C", rel->getRelation() );
+	EXPECT_EQ( entities[1], rel->getEntityA() );
+	EXPECT_EQ( entities[2], rel->getEntityB() );
+	EXPECT_EQ( 3, rel->getMultiplicityA().min );
+	EXPECT_EQ( 4, rel->getMultiplicityA().max );
+	EXPECT_EQ( 5, rel->getMultiplicityB().min );
+	EXPECT_EQ( 6, rel->getMultiplicityB().max );
+
+	rel = rels[2];
+	EXPECT_EQ( "relation C-A", rel->getRelation() );
+	EXPECT_EQ( entities[2], rel->getEntityA() );
+	EXPECT_EQ( entities[0], rel->getEntityB() );
+	EXPECT_EQ( 7, rel->getMultiplicityA().min );
+	EXPECT_EQ( 8, rel->getMultiplicityA().max );
+	EXPECT_EQ( 9, rel->getMultiplicityB().min );
+	EXPECT_EQ( 0, rel->getMultiplicityB().max );
+}
+
+class NativeLuaArchiveTests : public LuaArchiveTests
+{
+protected:
+	void setupERM()
+	{
+		startWithExtendedERM();
+
+		_relAB->setMultiplicityB( mult( 1, 2 ) );
+		_relBC->setMultiplicityA( mult( 3, 4 ) );
+		_relBC->setMultiplicityB( mult( 5, 6 ) );
+		_relCA->setMultiplicityA( mult( 7, 8 ) );
+		_relCA->setMultiplicityB( mult( 9, 0 ) );
+	}
+
+	co::IObjectRef newArchive( const std::string& component, const std::string& fileName )
+	{
+		co::IObjectRef object = co::newInstance( component );
+		object->setService( "model", _model.get() );
+		object->getService<ca::INamed>()->setName( fileName );
+		return object;
+	}
+};
+
+TEST_F( NativeLuaArchiveTests, setup )
+{
+	co::IObjectRef object = co::newInstance( "ca.NativeLuaArchive" );
+
+	ca::IArchive* archive = object->getService<ca::IArchive>();
+	ASSERT_TRUE( archive != NULL );
+
+	// expect ModelExceptions since we have not set a model
+	EXPECT_THROW( archive->save( object.get() ), ca::ModelException );
+	EXPECT_THROW( archive->restore(), ca::ModelException );
+
+	EXPECT_NO_THROW( object->setService( "model", _model.get() ) );
+	EXPECT_EQ( _model.get(), object->getService( "model" ) );
+
+	// expect IOExceptions since we have not set a file name
+	EXPECT_THROW( archive->save( object.get() ), ca::IOException );
+	EXPECT_THROW( archive->restore(), ca::IOException );
+
+	EXPECT_NO_THROW( object->getService<ca::INamed>()->setName( "NativeLuaArchiveTest.lua" ) );
+
+	// restore() should fail because the file does not exist
+	EXPECT_THROW( archive->restore(), ca::IOException );
+
+	// save() with an undefined object type should raise a ModelException
+	EXPECT_THROW( archive->save( object.get() ), ca::ModelException );
+}
+
+TEST_F( NativeLuaArchiveTests, saveRestore )
+{
+	setupERM();
+
+	co::IObjectRef object = newArchive( "ca.NativeLuaArchive", "NativeSaveRestoreTest.lua" );
+	ca::IArchive* archive = object->getService<ca::IArchive>();
+
+	EXPECT_NO_THROW( archive->save( _erm->getProvider() ) );
+
+	co::IObjectRef restoredObj;
+	try { restoredObj = archive->restore(); }
+	catch( std::exception& e ) { printf("E: %s\n", e.what() ); }
+
+	checkRestoredERM( restoredObj.get() );
+}
+
+TEST_F( NativeLuaArchiveTests, crossSaveRestore )
+{
+	setupERM();
+
+	co::IObjectRef luaArchive = newArchive( "ca.LuaArchive", "CrossSaveRestoreTest.lua" );
+	co::IObjectRef nativeArchive = newArchive( "ca.NativeLuaArchive", "CrossSaveRestoreTest.lua" );
+
+	// files saved by the Lua archive are restored by the native archive...
+	ASSERT_NO_THROW( luaArchive->getService<ca::IArchive>()->save( _erm->getProvider() ) );
+	co::IObjectRef restoredObj;
+	ASSERT_NO_THROW( restoredObj = nativeArchive->getService<ca::IArchive>()->restore() );
+	checkRestoredERM( restoredObj.get() );
+
+	// ...and vice-versa
+	ASSERT_NO_THROW( nativeArchive->getService<ca::IArchive>()->save( _erm->getProvider() ) );
+	ASSERT_NO_THROW( restoredObj = luaArchive->getService<ca::IArchive>()->restore() );
+	checkRestoredERM( restoredObj.get() );
+}
+
+// Reads a file, skipping the line with the date it was saved.
+static std::string readArchiveContents( const char* fileName )
+{
+	std::string contents;
+	FILE* file = fopen( fileName, "rb" );
+	if( !file )
+		return contents;
+
+	char line[1024];
+	while( fgets( line, sizeof(line), file ) )
+	{
+		if( strncmp( line, "-- Saved on ", 12 ) != 0 )
+			contents += line;
+	}
+
+	fclose( file );
+	return contents;
+}
+
+TEST_F( NativeLuaArchiveTests, outputMatchesLua )
+{
+	setupERM();
+
+	// strings that need escaping
+	_entityA->setName( "Entity \"A\"\\\n\t1\0012" );
+
+	co::IObjectRef luaArchive = newArchive( "ca.LuaArchive", "LuaOutputTest.lua" );
+	co::IObjectRef nativeArchive = newArchive( "ca.NativeLuaArchive", "NativeOutputTest.lua" );
+
+	ASSERT_NO_THROW( luaArchive->getService<ca::IArchive>()->save( _erm->getProvider() ) );
+	ASSERT_NO_THROW( nativeArchive->getService<ca::IArchive>()->save( _erm->getProvider() ) );
+
+	std::string luaOutput = readArchiveContents( "LuaOutputTest.lua" );
+	ASSERT_FALSE( luaOutput.empty() );
+	EXPECT_EQ( luaOutput, readArchiveContents( "NativeOutputTest.lua" ) );
+
+	// the escaped name is restored intact
+	co::IObjectRef restoredObj;
+	ASSERT_NO_THROW( restoredObj = nativeArchive->getService<ca::IArchive>()->restore() );
+	erm::IModel* erm = restoredObj->getService<erm::IModel>();
+	ASSERT_EQ( 3, erm->getEntities().getSize() );
+	EXPECT_EQ( _entityA->getName(), erm->getEntities()[0]->getName() );
+}
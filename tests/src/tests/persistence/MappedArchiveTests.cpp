@@ -0,0 +1,113 @@
+/*
+ * Calcium - Domain Model Framework
+ * See copyright notice in LICENSE.md
+ */
+
+#include "../ERMSpace.h"
+#include <ca/INamed.h>
+#include <ca/IArchive.h>
+#include <ca/IOException.h>
+#include <ca/ModelException.h>
+#include <ca/FormatException.h>
+#include <cstdio>
+
+class MappedArchiveTests : public ERMSpace {};
+
+TEST_F( MappedArchiveTests, setup )
+{
+	co::IObjectRef object = co::newInstance( "ca.MappedArchive" );
+
+	ca::IArchive* archive = object->getService<ca::IArchive>();
+	ASSERT_TRUE( archive != NULL );
+
+	// expect ModelExceptions since we have not set a model
+	EXPECT_THROW( archive->save( object.get() ), ca::ModelException );
+	EXPECT_THROW( archive->restore(), ca::ModelException );
+
+	EXPECT_NO_THROW( object->setService( "model", _model.get() ) );
+
+	// expect IOExceptions since we have not set a file name
+	EXPECT_THROW( archive->save( object.get() ), ca::IOException );
+	EXPECT_THROW( archive->restore(), ca::IOException );
+
+	EXPECT_NO_THROW( object->getService<ca::INamed>()->setName( "MappedArchiveTest.cam" ) );
+
+	// restore() should fail because the file does not exist
+	remove( "MappedArchiveTest.cam" );
+	EXPECT_THROW( archive->restore(), ca::IOException );
+
+	// save() with an undefined object type should raise a ModelException
+	EXPECT_THROW( archive->save( object.get() ), ca::ModelException );
+}
+
+TEST_F( MappedArchiveTests, saveRestore )
+{
+	startWithExtendedERM();
+
+	erm::Multiplicity m;
+	m.min = 3; m.max = 4;
+	_relBC->setMultiplicityA( m );
+
+	co::IObjectRef object = co::newInstance( "ca.MappedArchive" );
+	object->setService( "model", _model.get() );
+	object->getService<ca::INamed>()->setName( "MappedSaveRestoreTest.cam" );
+	ca::IArchive* archive = object->getService<ca::IArchive>();
+
+	ASSERT_NO_THROW( archive->save( _erm->getProvider() ) );
+
+	co::IObjectRef restoredObj;
+	ASSERT_NO_THROW( restoredObj = archive->restore() );
+	ASSERT_TRUE( restoredObj.isValid() );
+
+	erm::IModel* erm = restoredObj->getService<erm::IModel>();
+	ASSERT_TRUE( erm != NULL );
+
+	// strings come from the pool
+	co::TSlice<erm::IEntity*> entities = erm->getEntities();
+	ASSERT_EQ( 3, entities.getSize() );
+	EXPECT_EQ( "Entity A", entities[0]->getName() );
+	EXPECT_EQ( "Entity B", entities[1]->getName() );
+	EXPECT_EQ( "Entity C", entities[2]->getName() );
+
+	// references (including cycles) and raw struct values
+	co::TSlice<erm::IRelationship*> rels = erm->getRelationships();
+	ASSERT_EQ( 3, rels.getSize() );
+	EXPECT_EQ( "relation B-C", rels[1]->getRelation() );
+	EXPECT_EQ( entities[1], rels[1]->getEntityA() );
+	EXPECT_EQ( entities[2], rels[1]->getEntityB() );
+	EXPECT_EQ( 3, rels[1]->getMultiplicityA().min );
+	EXPECT_EQ( 4, rels[1]->getMultiplicityA().max );
+	EXPECT_EQ( entities[2], rels[2]->getEntityA() );
+	EXPECT_EQ( entities[0], rels[2]->getEntityB() );
+}
+
+TEST_F( MappedArchiveTests, invalidArchives )
+{
+	startWithSimpleERM();
+
+	co::IObjectRef object = co::newInstance( "ca.MappedArchive" );
+	object->setService( "model", _model.get() );
+	object->getService<ca::INamed>()->setName( "MappedInvalidTest.cam" );
+	ca::IArchive* archive = object->getService<ca::IArchive>();
+
+	// not a mapped archive
+	FILE* file = fopen( "MappedInvalidTest.cam", "wb" );
+	ASSERT_TRUE( file != NULL );
+	fputs( "-- Lua Archive File\n", file );
+	fclose( file );
+	EXPECT_THROW( archive->restore(), ca::FormatException );
+
+	// truncated archive
+	ASSERT_NO_THROW( archive->save( _erm->getProvider() ) );
+	file = fopen( "MappedInvalidTest.cam", "rb" );
+	ASSERT_TRUE( file != NULL );
+	char data[256];
+	size_t size = fread( data, 1, sizeof(data), file );
+	fclose( file );
+	ASSERT_GT( size, 64U );
+
+	file = fopen( "MappedInvalidTest.cam", "wb" );
+	fwrite( data, 1, 64, file );
+	fclose( file );
+	EXPECT_THROW( archive->restore(), ca::FormatException );
+}
@@ -1,4 +1,5 @@
 #include <ca/ISpaceStore.h>
+#include <ca/ISpaceStoreCursor.h>
 #include <gtest/gtest.h>
 #include <co/Coral.h>
 #include <co/IObject.h>
@@ -154,6 +155,67 @@ TEST_F( SQLiteSpaceStoreTests, testAddAndGetValues )
 	spaceStore->close();
 }
 
+TEST_F( SQLiteSpaceStoreTests, testAddValuesBatch )
+{
+	spaceStore->open();
+	spaceStore->beginChanges();
+
+	co::uint32 objectId, serviceId;
+	ASSERT_NO_THROW( objectId = spaceStore->addObject( "type1" ) );
+	ASSERT_NO_THROW( serviceId = spaceStore->addService( "type2", objectId ) );
+	EXPECT_EQ( objectId + 1, serviceId );
+
+	std::vector<co::uint32> ids;
+	std::vector<std::string> fieldNames;
+	std::vector<std::string> values;
+
+	ids.push_back( objectId );
+	fieldNames.push_back( "service" );
+	values.push_back( "#2" );
+
+	ids.push_back( serviceId );
+	fieldNames.push_back( "field" );
+	values.push_back( "1" );
+
+	ids.push_back( serviceId );
+	fieldNames.push_back( "field2" );
+	values.push_back( "'stringValue'" );
+
+	EXPECT_NO_THROW( spaceStore->addValuesBatch( ids, fieldNames, values ) );
+
+	// arrays must be index matched
+	ids.pop_back();
+	EXPECT_THROW( spaceStore->addValuesBatch( ids, fieldNames, values ), ca::IOException );
+
+	spaceStore->commitChanges( "" );
+
+	std::vector<std::string> fieldNamesRestored;
+	std::vector<std::string> valuesRestored;
+
+	ASSERT_NO_THROW( spaceStore->getValues( objectId, 1, fieldNamesRestored, valuesRestored ) );
+	ASSERT_EQ( 1, valuesRestored.size() );
+	EXPECT_EQ( "service", fieldNamesRestored[0] );
+	EXPECT_EQ( "#2", valuesRestored[0] );
+
+	ASSERT_NO_THROW( spaceStore->getValues( serviceId, 1, fieldNamesRestored, valuesRestored ) );
+	ASSERT_EQ( 2, valuesRestored.size() );
+	EXPECT_EQ( "field", fieldNamesRestored[0] );
+	EXPECT_EQ( "1", valuesRestored[0] );
+	EXPECT_EQ( "field2", fieldNamesRestored[1] );
+	EXPECT_EQ( "'stringValue'", valuesRestored[1] );
+
+	// new ids continue after the ones already stored
+	spaceStore->beginChanges();
+	EXPECT_EQ( serviceId + 1, spaceStore->addObject( "type1" ) );
+	spaceStore->discardChanges();
+
+	spaceStore->beginChanges();
+	EXPECT_EQ( serviceId + 1, spaceStore->addObject( "type1" ) );
+	spaceStore->commitChanges( "" );
+
+	spaceStore->close();
+}
+
 TEST_F( SQLiteSpaceStoreTests, testDiscardChanges )
 {
 	spaceStore->open();
@@ -323,6 +385,190 @@ TEST_F( SQLiteSpaceStoreTests, addGetServiceTest )
 
 }
 
+TEST_F( SQLiteSpaceStoreTests, typeNamesTest )
+{
+	spaceStore->open();
+
+	spaceStore->beginChanges();
+	co::uint32 objectId = spaceStore->addObject( "type1" );
+	spaceStore->addService( "type2", objectId );
+	spaceStore->addObject( "type1" );
+	spaceStore->commitChanges( "" );
+
+	spaceStore->beginChanges();
+	spaceStore->addObject( "type3" );
+	spaceStore->commitChanges( "" );
+
+	std::vector<std::string> typeNames;
+	spaceStore->getTypeNames( 1, typeNames );
+	ASSERT_EQ( 2, typeNames.size() );
+	EXPECT_EQ( "type1", typeNames[0] );
+	EXPECT_EQ( "type2", typeNames[1] );
+
+	spaceStore->getTypeNames( 2, typeNames );
+	ASSERT_EQ( 3, typeNames.size() );
+	EXPECT_EQ( "type3", typeNames[2] );
+
+	spaceStore->close();
+}
+
+TEST_F( SQLiteSpaceStoreTests, cursorTest )
+{
+	spaceStore->open();
+	spaceStore->beginChanges();
+
+	co::uint32 objectId, serviceId;
+	ASSERT_NO_THROW( objectId = spaceStore->addObject( "type1" ) );
+	ASSERT_NO_THROW( serviceId = spaceStore->addService( "type2", objectId ) );
+
+	std::vector<std::string> fieldNames;
+	std::vector<std::string> values;
+	fieldNames.push_back( "field" );
+	values.push_back( "1" );
+	spaceStore->addValues( serviceId, fieldNames, values );
+	spaceStore->commitChanges( "" );
+
+	spaceStore->beginChanges();
+	values[0] = "2";
+	spaceStore->addValues( serviceId, fieldNames, values );
+	spaceStore->commitChanges( "" );
+
+	// the cursor must visit the same rows as getAllValues()
+	std::vector<co::uint32> allIds;
+	std::vector<std::string> allFieldNames, allValues;
+	for( co::uint32 revision = 1; revision <= 2; ++revision )
+	{
+		spaceStore->getAllValues( revision, allIds, allFieldNames, allValues );
+
+		ca::ISpaceStoreCursorRef cursor = spaceStore->openCursor( revision );
+
+		co::uint32 id;
+		std::string fieldName, value;
+		size_t numRows = 0;
+		while( cursor->next( id, fieldName, value ) )
+		{
+			ASSERT_LT( numRows, allIds.size() );
+			EXPECT_EQ( allIds[numRows], id );
+			EXPECT_EQ( allFieldNames[numRows], fieldName );
+			EXPECT_EQ( allValues[numRows], value );
+			++numRows;
+		}
+		EXPECT_EQ( allIds.size(), numRows );
+
+		// the cursor is closed once all rows are read
+		EXPECT_THROW( cursor->next( id, fieldName, value ), ca::IOException );
+	}
+
+	// cursors must be closed before the store
+	ca::ISpaceStoreCursorRef cursor = spaceStore->openCursor( 2 );
+	cursor->close();
+
+	spaceStore->close();
+}
+
+// adds three revisions where 'field' is changed to "1", "2" and "3"; 'field2' is only set in the first one
+static co::uint32 addRevisions( ca::ISpaceStore* spaceStore )
+{
+	co::uint32 objectId = 0;
+	std::vector<std::string> fieldNames;
+	std::vector<std::string> values;
+
+	for( int i = 1; i <= 3; ++i )
+	{
+		spaceStore->beginChanges();
+		if( i == 1 )
+		{
+			objectId = spaceStore->addObject( "type1" );
+			fieldNames.push_back( "field2" );
+			values.push_back( "'value'" );
+		}
+
+		fieldNames.push_back( "field" );
+		values.push_back( std::string( 1, '0' + i ) );
+
+		spaceStore->addValues( objectId, fieldNames, values );
+		spaceStore->commitChanges( "" );
+
+		fieldNames.clear();
+		values.clear();
+	}
+	return objectId;
+}
+
+static void checkRevision( ca::ISpaceStore* spaceStore, co::uint32 objectId, co::uint32 revision )
+{
+	std::vector<std::string> fieldNames;
+	std::vector<std::string> values;
+	ASSERT_NO_THROW( spaceStore->getValues( objectId, revision, fieldNames, values ) );
+	ASSERT_EQ( 2, values.size() );
+	EXPECT_EQ( "field", fieldNames[0] );
+	EXPECT_EQ( std::string( 1, '0' + revision ), values[0] );
+	EXPECT_EQ( "field2", fieldNames[1] );
+	EXPECT_EQ( "'value'", values[1] );
+
+	std::string typeName;
+	ASSERT_NO_THROW( spaceStore->getObjectType( objectId, revision, typeName ) );
+	EXPECT_EQ( "type1", typeName );
+}
+
+TEST_F( SQLiteSpaceStoreTests, compactTest )
+{
+	spaceStore->open();
+	co::uint32 objectId = addRevisions( spaceStore );
+
+	spaceStore->beginChanges();
+	EXPECT_THROW( spaceStore->compact( 2 ), ca::IOException ); // changes being added
+	spaceStore->discardChanges();
+
+	ASSERT_NO_THROW( spaceStore->compact( 2 ) );
+	EXPECT_EQ( 3, spaceStore->getLatestRevision() );
+
+	// revision 2 now holds all values up to it
+	EXPECT_THROW( spaceStore->getRootObject( 1 ), ca::IOException );
+	checkRevision( spaceStore, objectId, 2 );
+	checkRevision( spaceStore, objectId, 3 );
+
+	// the store is still usable after a reopen
+	spaceStore->close();
+	spaceStore->open();
+	EXPECT_EQ( 3, spaceStore->getLatestRevision() );
+	EXPECT_EQ( objectId, spaceStore->getRootObject( 3 ) );
+
+	spaceStore->beginChanges();
+	EXPECT_EQ( objectId + 1, spaceStore->addObject( "type2" ) );
+	spaceStore->commitChanges( "" );
+	checkRevision( spaceStore, objectId, 3 );
+
+	// keeping more revisions than there are does nothing
+	ASSERT_NO_THROW( spaceStore->compact( 10 ) );
+	checkRevision( spaceStore, objectId, 2 );
+
+	spaceStore->close();
+}
+
+TEST_F( SQLiteSpaceStoreTests, checkpointTest )
+{
+	spaceStore->setCheckpointInterval( 2 );
+	EXPECT_EQ( 2, spaceStore->getCheckpointInterval() );
+
+	spaceStore->open();
+	co::uint32 objectId = addRevisions( spaceStore );
+
+	// all revisions remain readable, with or without a checkpoint
+	for( co::uint32 revision = 1; revision <= 3; ++revision )
+		checkRevision( spaceStore, objectId, revision );
+
+	ca::ISpaceStoreCursorRef cursor = spaceStore->openCursor( 3 );
+	co::uint32 id;
+	std::string fieldName, value;
+	size_t numRows = 0;
+	while( cursor->next( id, fieldName, value ) )
+		++numRows;
+	EXPECT_EQ( 3, numRows ); // _type, field and field2
+
+	spaceStore->close();
+}
+
 TEST_F( SQLiteSpaceStoreTests, invalidFilesTest )
 {
 	fileName = "textFile.db";
@@ -25,6 +25,7 @@
 #include <ca/IOException.h>
 #include <ca/ISpaceStore.h>
 #include <ca/ISpacePersister.h>
+#include <ca/IUndoManager.h>
 
 class SpacePersisterTests : public ERMSpace 
 {
@@ -578,3 +579,153 @@ TEST_F( SpacePersisterTests, testSaveMultipleRevisions )
 	spaceRestored->notifyChanges();
 	ASSERT_NO_THROW( persiterRestore4->save() ); //it's ok to save new revision
 }
+
+TEST_F( SpacePersisterTests, testDepthLimitedRestore )
+{
+	const char* fileName = "SimpleSpaceSave.db";
+	remove( fileName );
+
+	ca::ISpacePersisterRef persister = createPersister( fileName );
+	ASSERT_NO_THROW( persister->initialize( _erm->getProvider() ) );
+
+	// entity A gets a parent, two references away from the root
+	ca::ISpace* spaceInitialized = persister->getSpace();
+	applyAddedObjectChange( spaceInitialized, _entityA.get() );
+	ASSERT_NO_THROW( persister->save() );
+
+	ca::ISpacePersisterRef persisterRestore = createPersister( fileName );
+	persisterRestore->setRestoreDepth( 1 );
+	ASSERT_NO_THROW( persisterRestore->restore() );
+
+	ca::ISpace* spaceRestored = persisterRestore->getSpace();
+	erm::IModel* erm = spaceRestored->getRootObject()->getService<erm::IModel>();
+
+	co::TSlice<erm::IEntity*> entities = erm->getEntities();
+	ASSERT_EQ( 3, entities.getSize() );
+	EXPECT_EQ( "Entity A", entities[0]->getName() );
+	EXPECT_TRUE( entities[0]->getParent() == NULL );
+
+	// references among loaded objects are resolved
+	co::TSlice<erm::IRelationship*> rels = erm->getRelationships();
+	ASSERT_EQ( 3, rels.getSize() );
+	EXPECT_EQ( entities[0], rels[0]->getEntityA() );
+	EXPECT_EQ( entities[1], rels[0]->getEntityB() );
+
+	// loading is not a change: it can happen while a change is being recorded
+	co::IObjectRef undoManagerObj = co::newInstance( "ca.UndoManager" );
+	undoManagerObj->setService( "graph", spaceRestored );
+	ca::IUndoManager* undoManager = undoManagerObj->getService<ca::IUndoManager>();
+
+	undoManager->beginChange( "Rename Entity B" );
+	ASSERT_NO_THROW( persisterRestore->loadSubgraph( entities[0]->getProvider() ) );
+	entities[1]->setName( "changedName" );
+	spaceRestored->addChange( entities[1] );
+	ASSERT_NO_THROW( undoManager->endChange() );
+
+	ASSERT_TRUE( entities[0]->getParent() != NULL );
+	EXPECT_EQ( "\newEntity\\Parent", entities[0]->getParent()->getName() );
+
+	// only the rename was recorded
+	ASSERT_NO_THROW( undoManager->undo() );
+	EXPECT_EQ( "Entity B", entities[1]->getName() );
+	ASSERT_TRUE( entities[0]->getParent() != NULL );
+	ASSERT_NO_THROW( undoManager->redo() );
+	EXPECT_EQ( "changedName", entities[1]->getName() );
+
+	// loaded references are not saved as changes
+	ASSERT_NO_THROW( persisterRestore->save() );
+
+	ca::ISpacePersisterRef persisterFull = createPersister( fileName );
+	ASSERT_NO_THROW( persisterFull->restore() );
+
+	erm = persisterFull->getSpace()->getRootObject()->getService<erm::IModel>();
+	entities = erm->getEntities();
+	ASSERT_EQ( 3, entities.getSize() );
+	EXPECT_EQ( "changedName", entities[1]->getName() );
+	ASSERT_TRUE( entities[0]->getParent() != NULL );
+	EXPECT_EQ( "\newEntity\\Parent", entities[0]->getParent()->getName() );
+}
+
+TEST_F( SpacePersisterTests, testDiscardedPendingRefs )
+{
+	const char* fileName = "SimpleSpaceSave.db";
+	remove( fileName );
+
+	ca::ISpacePersisterRef persister = createPersister( fileName );
+	ASSERT_NO_THROW( persister->initialize( _erm->getProvider() ) );
+	applyAddedObjectChange( persister->getSpace(), _entityA.get() );
+	ASSERT_NO_THROW( persister->save() );
+
+	ca::ISpacePersisterRef persisterRestore = createPersister( fileName );
+	persisterRestore->setRestoreDepth( 1 );
+	ASSERT_NO_THROW( persisterRestore->restore() );
+
+	ca::ISpace* spaceRestored = persisterRestore->getSpace();
+	erm::IModel* erm = spaceRestored->getRootObject()->getService<erm::IModel>();
+	co::TSlice<erm::IEntity*> entities = erm->getEntities();
+	ASSERT_TRUE( entities[0]->getParent() == NULL );
+
+	// a new value for a pending reference is not overwritten by a later load
+	entities[0]->setParent( entities[1] );
+	spaceRestored->addChange( entities[0] );
+	spaceRestored->notifyChanges();
+
+	ASSERT_NO_THROW( persisterRestore->loadSubgraph( entities[0]->getProvider() ) );
+	EXPECT_EQ( entities[1], entities[0]->getParent() );
+}
+
+TEST_F( SpacePersisterTests, testQueuedSaves )
+{
+	const char* fileName = "SimpleSpaceSave.db";
+	remove( fileName );
+
+	ca::ISpacePersisterRef persister = createPersister( fileName );
+	ASSERT_NO_THROW( persister->initialize( _erm->getProvider() ) );
+	ca::ISpace* space = persister->getSpace();
+
+	applyValueFieldChange( space );
+	ASSERT_NO_THROW( persister->queueSave() );
+	EXPECT_EQ( 1, persister->getPendingSaves() );
+
+	applyAddedObjectChange( space, _entityA.get() );
+	ASSERT_NO_THROW( persister->queueSave() );
+	EXPECT_EQ( 2, persister->getPendingSaves() );
+
+	// edits to an added object after its save is queued belong to the next save
+	erm::IEntity* parent = _entityA->getParent();
+	ASSERT_TRUE( parent != NULL );
+	parent->setName( "renamedParent" );
+	space->addChange( parent );
+	space->notifyChanges();
+	ASSERT_NO_THROW( persister->queueSave() );
+	EXPECT_EQ( 3, persister->getPendingSaves() );
+
+	// nothing is written until the saves are flushed
+	ca::ISpacePersisterRef persisterRestore = createPersister( fileName );
+	ASSERT_NO_THROW( persisterRestore->restore() );
+	erm::IModel* erm = persisterRestore->getSpace()->getRootObject()->getService<erm::IModel>();
+	EXPECT_EQ( "Entity A", erm->getEntities()[0]->getName() );
+
+	ASSERT_NO_THROW( persister->flushSaves() );
+	EXPECT_EQ( 0, persister->getPendingSaves() );
+
+	// each queued save is a revision
+	persisterRestore = createPersister( fileName );
+	ASSERT_NO_THROW( persisterRestore->restoreRevision( 2 ) );
+	erm = persisterRestore->getSpace()->getRootObject()->getService<erm::IModel>();
+	EXPECT_EQ( "changedName", erm->getEntities()[0]->getName() );
+	EXPECT_TRUE( erm->getEntities()[0]->getParent() == NULL );
+
+	persisterRestore = createPersister( fileName );
+	ASSERT_NO_THROW( persisterRestore->restoreRevision( 3 ) );
+	erm = persisterRestore->getSpace()->getRootObject()->getService<erm::IModel>();
+	EXPECT_EQ( "changedName", erm->getEntities()[0]->getName() );
+	ASSERT_TRUE( erm->getEntities()[0]->getParent() != NULL );
+	EXPECT_EQ( "\newEntity\\Parent", erm->getEntities()[0]->getParent()->getName() );
+
+	persisterRestore = createPersister( fileName );
+	ASSERT_NO_THROW( persisterRestore->restore() );
+	erm = persisterRestore->getSpace()->getRootObject()->getService<erm::IModel>();
+	ASSERT_TRUE( erm->getEntities()[0]->getParent() != NULL );
+	EXPECT_EQ( "renamedParent", erm->getEntities()[0]->getParent()->getName() );
+}
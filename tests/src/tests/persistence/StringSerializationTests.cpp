@@ -16,6 +16,8 @@
 #include <serialization/ArrayStruct.h>
 #include <serialization/TwoLevelNestedStruct.h>
 
+#include <clocale>
+
 
 TEST( StringSerializationTests, stringDefinitionBasicTypes )
 {
@@ -83,8 +85,9 @@ TEST( StringSerializationTests, stringDefinitionBasicTypes )
 	serializer.toString(co::Any(floatValue), actual);
 	EXPECT_EQ(expected, actual);
 
+	// floats are written with the fewest digits that read back the same
 	floatValue = 0.0000512f;
-	expected = "5.12000005983282e-05";
+	expected = "5.12e-05";
 	
 	serializer.toString( co::Any(floatValue), actual );
 	EXPECT_EQ(expected, actual);
@@ -113,6 +116,13 @@ TEST( StringSerializationTests, stringDefinitionBasicTypes )
 	serializer.toString( co::Any(doubleValue), actual );
 	EXPECT_EQ(expected, actual);
 
+	// doubles that need more than 15 digits are not truncated
+	doubleValue = 0.1 + 0.2;
+	expected = "0.30000000000000004";
+
+	serializer.toString( co::Any(doubleValue), actual );
+	EXPECT_EQ(expected, actual);
+
 	std::string stringValue = "value";
 	co::Any anyString;
 	anyString.set<const std::string&>(stringValue);
@@ -120,6 +130,22 @@ TEST( StringSerializationTests, stringDefinitionBasicTypes )
 	
 	serializer.toString( anyString, actual );
 	EXPECT_EQ( expected, actual );
+
+	// long strings are scanned in blocks, plus a tail
+	stringValue = "a longer string value, with a tail";
+	anyString.set<const std::string&>( stringValue );
+	serializer.toString( anyString, actual );
+	EXPECT_EQ( "'a longer string value, with a tail'", actual );
+
+	stringValue = "a longer string\twith a tab";
+	anyString.set<const std::string&>( stringValue );
+	serializer.toString( anyString, actual );
+	EXPECT_EQ( "[=[a longer string\twith a tab]=]", actual );
+
+	stringValue = "a longer string with a quote: '";
+	anyString.set<const std::string&>( stringValue );
+	serializer.toString( anyString, actual );
+	EXPECT_EQ( "[=[a longer string with a quote: ']=]", actual );
 	
 	expected = "Two";
 
@@ -296,3 +322,156 @@ TEST( StringSerializationTests, stringDefinitionArray )
 	EXPECT_EQ( "{}", actual );
 
 }
+
+TEST( StringSerializationTests, parseBasicTypes )
+{
+	ca::StringSerializer serializer;
+
+	co::IObjectRef modelObj = co::newInstance( "ca.Model" );
+	ca::IModel* model = modelObj->getService<ca::IModel>();
+	model->setName( "serialization" );
+	serializer.setModel( model );
+
+	co::AnyValue value;
+
+	serializer.fromString( "-127", co::typeOf<co::int8>::get(), value );
+	EXPECT_EQ( -127, value.get<co::int8>() );
+
+	serializer.fromString( "true", co::typeOf<bool>::get(), value );
+	EXPECT_TRUE( value.get<bool>() );
+
+	serializer.fromString( "234", co::typeOf<co::uint16>::get(), value );
+	EXPECT_EQ( 234, value.get<co::uint16>() );
+
+	serializer.fromString( "-1", co::typeOf<co::int32>::get(), value );
+	EXPECT_EQ( -1, value.get<co::int32>() );
+
+	serializer.fromString( "5.12000005983282e-05", co::typeOf<float>::get(), value );
+	EXPECT_EQ( 0.0000512f, value.get<float>() );
+
+	serializer.fromString( "8.23745647e-09", co::typeOf<double>::get(), value );
+	EXPECT_DOUBLE_EQ( 0.00000000823745647, value.get<double>() );
+
+	serializer.fromString( "'value'", co::typeOf<std::string>::get(), value );
+	EXPECT_EQ( "value", value.get<const std::string&>() );
+
+	serializer.fromString( "[=[\nescaped\']=]", co::typeOf<std::string>::get(), value );
+	EXPECT_EQ( "\nescaped\'", value.get<const std::string&>() );
+
+	serializer.fromString( "Two", co::typeOf<serialization::SimpleEnum>::get(), value );
+	EXPECT_EQ( serialization::Two, value.get<serialization::SimpleEnum>() );
+}
+
+TEST( StringSerializationTests, parseCompositeTypes )
+{
+	ca::StringSerializer serializer;
+
+	co::IObjectRef modelObj = co::newInstance( "ca.Model" );
+	ca::IModel* model = modelObj->getService<ca::IModel>();
+	model->setName( "serialization" );
+	serializer.setModel( model );
+
+	co::AnyValue value;
+
+	serializer.fromString( "{byteValue=-64,doubleValue=6.52,intValue=4386}",
+		co::typeOf<serialization::NativeClassCoral>::get(), value );
+	const serialization::NativeClassCoral& nativeValue = value.get<const serialization::NativeClassCoral&>();
+	EXPECT_EQ( -64, nativeValue.byteValue );
+	EXPECT_EQ( 6.52, nativeValue.doubleValue );
+	EXPECT_EQ( 4386, nativeValue.intValue );
+
+	serializer.fromString( "{basicStructs={{byteValue=123,intValue=1,strValue='name'},"
+		"{byteValue=67,intValue=73246,strValue=[=[{tricky},']=]}},enums={One,Two}}",
+		co::typeOf<serialization::ArrayStruct>::get(), value );
+	const serialization::ArrayStruct& arrayStruct = value.get<const serialization::ArrayStruct&>();
+	ASSERT_EQ( 2, arrayStruct.basicStructs.size() );
+	EXPECT_EQ( "name", arrayStruct.basicStructs[0].strValue );
+	EXPECT_EQ( 73246, arrayStruct.basicStructs[1].intValue );
+	EXPECT_EQ( "{tricky},'", arrayStruct.basicStructs[1].strValue );
+	ASSERT_EQ( 2, arrayStruct.enums.size() );
+	EXPECT_EQ( serialization::Two, arrayStruct.enums[1] );
+	EXPECT_TRUE( arrayStruct.integers.empty() );
+
+	// every serialized value must parse back to an equivalent value
+	serialization::TwoLevelNestedStruct nested;
+	nested.boolean = true;
+	nested.nativeClass.intValue = 4386;
+	nested.nested.int16Value = 1234;
+	nested.nested.structValue.strValue = "name";
+
+	std::string expected, actual;
+	serializer.toString( nested, expected );
+	serializer.fromString( expected, co::typeOf<serialization::TwoLevelNestedStruct>::get(), value );
+	serializer.toString( value.getAny(), actual );
+	EXPECT_EQ( expected, actual );
+}
+
+TEST( StringSerializationTests, parseArray )
+{
+	ca::StringSerializer serializer;
+
+	co::IObjectRef modelObj = co::newInstance( "ca.Model" );
+	ca::IModel* model = modelObj->getService<ca::IModel>();
+	model->setName( "serialization" );
+	serializer.setModel( model );
+
+	co::AnyValue value;
+
+	serializer.fromString( "{123,-234,345}", co::typeOf<std::vector<co::int32> >::get(), value );
+	const std::vector<co::int32>& ints = value.get<const std::vector<co::int32>&>();
+	ASSERT_EQ( 3, ints.size() );
+	EXPECT_EQ( -234, ints[1] );
+
+	serializer.fromString( "{'string1',[=[escaped\']=],'[notScaped'}", co::typeOf<std::vector<std::string> >::get(), value );
+	const std::vector<std::string>& strings = value.get<const std::vector<std::string>&>();
+	ASSERT_EQ( 3, strings.size() );
+	EXPECT_EQ( "escaped\'", strings[1] );
+	EXPECT_EQ( "[notScaped", strings[2] );
+
+	serializer.fromString( "{}", co::typeOf<std::vector<co::int32> >::get(), value );
+	EXPECT_TRUE( value.get<const std::vector<co::int32>&>().empty() );
+}
+
+TEST( StringSerializationTests, parseInvalidValues )
+{
+	ca::StringSerializer serializer;
+
+	co::IObjectRef modelObj = co::newInstance( "ca.Model" );
+	ca::IModel* model = modelObj->getService<ca::IModel>();
+	model->setName( "serialization" );
+	serializer.setModel( model );
+
+	co::AnyValue value;
+
+	EXPECT_THROW( serializer.fromString( "abc", co::typeOf<co::int32>::get(), value ), ca::FormatException );
+	EXPECT_THROW( serializer.fromString( "12 3", co::typeOf<co::int32>::get(), value ), ca::FormatException );
+	EXPECT_THROW( serializer.fromString( "'unfinished", co::typeOf<std::string>::get(), value ), ca::FormatException );
+	EXPECT_THROW( serializer.fromString( "Four", co::typeOf<serialization::SimpleEnum>::get(), value ), ca::FormatException );
+	EXPECT_THROW( serializer.fromString( "{1,2", co::typeOf<std::vector<co::int32> >::get(), value ), ca::FormatException );
+	EXPECT_THROW( serializer.fromString( "{noSuchField=1}", co::typeOf<serialization::BasicTypesStruct>::get(), value ), ca::FormatException );
+}
+
+TEST( StringSerializationTests, localeIndependence )
+{
+	ca::StringSerializer serializer;
+
+	// switch to a locale with a decimal comma, if one is installed
+	std::string original = setlocale( LC_NUMERIC, NULL );
+	const char* locales[] = { "de_DE.UTF-8", "de_DE.utf8", "de_DE", "pt_BR.UTF-8", "fr_FR.UTF-8", "German", NULL };
+	for( int i = 0; locales[i] && !setlocale( LC_NUMERIC, locales[i] ); ++i )
+		;
+
+	std::string actual;
+	serializer.toString( 0.5, actual );
+	EXPECT_EQ( "0.5", actual );
+	serializer.toString( 1.25f, actual );
+	EXPECT_EQ( "1.25", actual );
+
+	co::AnyValue value;
+	serializer.fromString( "0.5", co::typeOf<double>::get(), value );
+	EXPECT_EQ( 0.5, value.get<double>() );
+	serializer.fromString( "-2.75", co::typeOf<float>::get(), value );
+	EXPECT_EQ( -2.75f, value.get<float>() );
+
+	setlocale( LC_NUMERIC, original.c_str() );
+}